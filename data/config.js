@@ -12,6 +12,22 @@ document.addEventListener("DOMContentLoaded", function () {
       .catch((error) => console.error("Error loading Sensor Sample Rate:", error));
   }
 
+  // Function to load the retention tiers and what compaction has reclaimed
+  function loadRetention() {
+    fetch("/get-retention")
+      .then((response) => response.json())
+      .then((data) => showRetention(data))
+      .catch((error) => console.error("Error loading retention:", error));
+  }
+
+  function showRetention(data) {
+    document.getElementById("retention-raw-input").value = data.rawDays;
+    document.getElementById("retention-minute-input").value = data.minuteDays;
+    document.getElementById("retention-status").textContent =
+      `Compacted ${data.daysCompacted} days, ${(data.bytesReclaimed / 1024).toFixed(0)} KB reclaimed since restart` +
+      (data.running ? " (compacting...)" : "");
+  }
+
   // Function to load Location data
   function loadLocation() {
     fetch("/get-location")
@@ -133,6 +149,25 @@ document.addEventListener("DOMContentLoaded", function () {
       .catch((error) => console.error("Error submitting Sensor Rate:", error));
   }
 
+  // Submit the retention tiers as "rawDays,minuteDays"
+  function submitRetention() {
+    const rawDays = document.getElementById("retention-raw-input").value;
+    const minuteDays = document.getElementById("retention-minute-input").value;
+    fetch("/retention-input", {
+      method: "POST",
+      headers: {
+        "Content-Type": "text/plain",
+      },
+      body: `${rawDays},${minuteDays}`,
+    })
+      .then((response) => response.json())
+      .then((result) => {
+        showRetention(result);
+        alert("Retention submitted successfully!");
+      })
+      .catch((error) => console.error("Error submitting retention:", error));
+  }
+
   // Submit Location data
   function submitLocation() {
     const locData = document.getElementById("loc-input").value;
@@ -423,10 +458,12 @@ document.addEventListener("DOMContentLoaded", function () {
   document.getElementById("zone-form-submit").addEventListener("click", submitZoneForm);
   document.getElementById("calib-submit").addEventListener("click", submitCalibration);
   document.getElementById("sensor-rate-submit").addEventListener("click", submitSensorRate);
+  document.getElementById("retention-submit").addEventListener("click", submitRetention);
   document.getElementById("loc-submit").addEventListener("click", submitLocation);
 
   // Call the functions to load the data when the page loads
   loadSensorRate();
+  loadRetention();
   loadLocation();
   loadZoneTable("/load-sd-zone-table");
   loadCalibOffset();
@@ -9,9 +9,7 @@ function populateFileSelector(selectorId, files) {
   fileSelector.options.length = 0; // Clear existing options
   console.log("Files to populate selector:", files); // Debugging line
 
-  // Optional: Sort files by date (assuming filenames follow the format 'dDDMMYY.txt')
-  files.sort();
-
+  // SD files come from the ESP32 with the daily files in date order
   files.forEach((file) => {
     console.log("Adding file to selector:", file); // Debugging line
     let option = document.createElement("option");
@@ -35,6 +33,7 @@ function displaySdCardFiles(files) {
 // Display SPIFFS Files
 function displaySPIFFSFiles(files) {
   const spiffsFileList = document.getElementById("spiffsFileList");
+  files.sort();
   populateFileSelector("deleteSPIFFSFileSelector", files); // Populate the delete SPIFFS file selector
   spiffsFileList.textContent = files.join("\n"); // Display the list of SPIFFS files with formatted names
 }
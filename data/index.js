@@ -262,6 +262,7 @@ function setupRealTimeUpdates() {
     // console.log(`Days: ${activeZone.days}`);
 
     document.getElementById("zone-info").innerHTML = `
+      Min/Max PSI: ${myObj["Min Pressure"]} / ${myObj["Max Pressure"]}<br>
       Zone: ${activeZone.znumber}<br>
       Name: ${activeZone.zname}<br>
       Controller: ${activeZone.controller}<br>
@@ -326,6 +327,119 @@ function plotPressure(currentPressure, activeZoneNumber, activeZoneAvgPsi) {
   chartP.redraw();
 }
 
+// The current day's log as fetched so far. Refresh only asks the ESP32 for
+// the bytes appended since the last fetch (an HTTP Range request on the
+// binary log) and redraws from these arrays.
+let currentDayFile = "";
+let currentDayBytes = 0; // Bytes of the log consumed, always whole records
+let currentDayRecordSize = 0;
+let currentDayPsi = [];
+let currentDayZones = [];
+
+// Add one logged reading to the current day's points
+function addCurrentDayPoint(timestampUTC, y1, z1, avgpsi) {
+  if ((z1 != 0) && (Math.abs(y1 - avgpsi) > 2.0)) {
+    pointColor = '#FF0000';
+  } else {
+    pointColor = '#87bef2';  // Default color is blue
+  }
+
+  currentDayPsi.push({
+    x: timestampUTC,
+    y: y1,
+    color: pointColor,  // This color applies to the point
+    marker: {
+      enabled: true,
+      symbol: "circle",
+      radius: 3,  // Ensure the radius is always set
+      fillColor: pointColor,  // Ensure the marker fill color is applied
+    },
+  }); // PSI
+
+  currentDayZones.push({
+    x: timestampUTC,
+    y: z1,
+    color: "#f28f43",
+    marker: {
+      enabled: true,
+      symbol: "diamond",
+      radius: 3,
+      fillColor: "#f28f43",
+    },
+  }); // Zone
+}
+
+// Fetch the records of a binary log (layout in src/LogFormat.h) that are not
+// in currentDayPsi yet
+async function fetchCurrentDayRecords(dailyFileName) {
+  const append = dailyFileName === currentDayFile && currentDayBytes > 0;
+  const dataResponse = await fetch(
+    `/get-data-file?filename=${encodeURIComponent(dailyFileName)}&format=bin`,
+    {
+      headers: append ? { Range: `bytes=${currentDayBytes}-` } : {},
+      cache: "no-store",
+    }
+  );
+  if (append && dataResponse.status === 416) {
+    return; // Nothing logged since the last fetch
+  }
+  if (!dataResponse.ok) {
+    throw new Error(`HTTP error! Status: ${dataResponse.status}`);
+  }
+
+  const data = new DataView(await dataResponse.arrayBuffer());
+  let offset = 0;
+  if (dataResponse.status !== 206) {
+    // The whole file, start over from its header
+    currentDayFile = dailyFileName;
+    currentDayRecordSize = data.getUint8(5);
+    currentDayBytes = data.getUint16(6, true);
+    currentDayPsi = [];
+    currentDayZones = [];
+    offset = currentDayBytes;
+  }
+
+  for (; offset + currentDayRecordSize <= data.byteLength; offset += currentDayRecordSize) {
+    const epoch = data.getUint32(offset, true); // Local time, shown as UTC like the CSV
+    const y1 = data.getInt16(offset + 4, true) / 100;
+    const z1 = data.getUint8(offset + 6);
+    const avgpsi = data.getUint8(offset + 7);
+    addCurrentDayPoint(epoch * 1000, y1, z1, avgpsi);
+    currentDayBytes += currentDayRecordSize;
+  }
+}
+
+// Fetch an older text log in full
+async function fetchCurrentDayText(dailyFileName) {
+  const dataResponse = await fetch(
+    `/get-data-file?filename=${encodeURIComponent(dailyFileName)}`
+  );
+  if (!dataResponse.ok) {
+    throw new Error(`HTTP error! Status: ${dataResponse.status}`);
+  }
+
+  const textData = await dataResponse.text();
+  currentDayFile = dailyFileName;
+  currentDayBytes = 0;
+  currentDayPsi = [];
+  currentDayZones = [];
+
+  // Parse the fetched data and remove empty or whitespace-only lines
+  const lines = textData.split("\n").filter((line) => line.trim() !== "");
+
+  lines.forEach((line) => {
+    const parts = line.split(",");
+    if (parts.length >= 5) {
+      // Ensure there are enough parts in each line
+      const timestampUTC = Date.parse(parts[1] + "T" + parts[2] + "Z");
+      const y1 = parseFloat(parts[3]);
+      const z1 = parseInt(parts[4], 10); // activeZoneNumber is an integer
+      const avgpsi = parseFloat(parts[5]); // average psi
+      addCurrentDayPoint(timestampUTC, y1, z1, avgpsi);
+    }
+  });
+}
+
 async function loadCurrentDayData() {
   // Display a loading message
   const loadingMessage = document.getElementById("loadingMessage");
@@ -339,68 +453,15 @@ async function loadCurrentDayData() {
     const response = await fetch("/get-daily-filename");
     const dailyFileName = await response.text();
 
-    // Fetch the current day's SD file data
-    const dataResponse = await fetch(
-      `/get-data-file?filename=${encodeURIComponent(dailyFileName)}`
-    );
-    if (!dataResponse.ok) {
-      throw new Error(`HTTP error! Status: ${dataResponse.status}`);
+    if (dailyFileName.endsWith(".bin")) {
+      await fetchCurrentDayRecords(dailyFileName);
+    } else {
+      await fetchCurrentDayText(dailyFileName);
     }
 
-    const textData = await dataResponse.text();
-
-    // Clear the series data to start fresh
-    chartP.series[0].setData([], false); // Clear PSI series
-    chartP.series[1].setData([], false); // Clear Zone series
-
-    // Parse the fetched data and remove empty or whitespace-only lines
-    const lines = textData.split("\n").filter((line) => line.trim() !== "");
-
-    lines.forEach((line) => {
-      const parts = line.split(",");
-      if (parts.length >= 5) {
-        // Ensure there are enough parts in each line
-        const timestampUTC = Date.parse(parts[1] + "T" + parts[2] + "Z");
-        const y1 = parseFloat(parts[3]);
-        const z1 = parseInt(parts[4], 10); // activeZoneNumber is an integer
-        const avgpsi = parseFloat(parts[5]); // average psi
-
-        if ((z1 != 0) && (Math.abs(y1 - avgpsi) > 2.0)) {
-        //if ((Math.abs(y1 - avgpsi) > 2.0)) {
-          pointColor = '#FF0000';
-        } else {
-          pointColor = '#87bef2';  // Default color is blue
-        }
-
-        // Add points to the chart using addPoint
-        //chartP.series[0].addPoint([timestampUTC, y1], false, false, false); // Add PSI point
-        //chartP.series[1].addPoint([timestampUTC, z1], false, false, false); // Add Zone point
-        // Add new points to the chart with specific marker and line color for PSI
-        chartP.series[0].addPoint({
-          x: timestampUTC,
-          y: y1,
-          color: pointColor,  // This color applies to the point
-          marker: {
-            enabled: true,
-            symbol: "circle",
-            radius: 3,  // Ensure the radius is always set
-            fillColor: pointColor,  // Ensure the marker fill color is applied
-          },
-        }, false, false, false); // PSI
-        
-        chartP.series[1].addPoint({
-          x: timestampUTC, 
-          y: z1,
-          color: "#f28f43",
-          marker: {
-            enabled: true,
-            symbol: "diamond",
-            radius: 3,
-            fillColor: "#f28f43",
-          },
-        }, false, false, false); // Zone
-      }
-    });
+    // Replace the points, including the live ones, with the logged readings
+    chartP.series[0].setData(currentDayPsi.slice(), false); // PSI series
+    chartP.series[1].setData(currentDayZones.slice(), false); // Zone series
 
     // Update the chart title with the filename
     chartP.setTitle({ text: `File: ${dailyFileName}` });
@@ -431,7 +492,13 @@ function loadHistoricalData(fileName) {
     loadingMessage.style.display = "block"; // Show the message
   }
 
-  fetch(`/get-data-file?filename=${encodeURIComponent(fileName)}`)
+  // Binary logs are downsampled on the ESP32 to about one point per pixel,
+  // so the chart costs the same whatever the sample rate
+  const url = fileName.endsWith(".bin")
+    ? `/get-data-range?file=${encodeURIComponent(fileName)}&points=${Math.round(chartH.plotWidth)}`
+    : `/get-data-file?filename=${encodeURIComponent(fileName)}`;
+
+  fetch(url)
     .then((response) => {
       if (!response.ok) {
         throw new Error(`HTTP error! Status: ${response.status}`);
@@ -440,6 +507,10 @@ function loadHistoricalData(fileName) {
     })
     .then((textData) => {
       try {
+        // Replace whatever file was shown before
+        chartH.series[0].setData([], false);
+        chartH.series[1].setData([], false);
+
         // Log the received text data to check if it's being fetched properly
         //console.log("Received text data:", textData);
 
@@ -549,22 +620,35 @@ function populateFileSelector(selectorId, files) {
   fileSelector.options.length = 0; // Clear existing options
   //console.log("Files to populate selector:", files);
 
-  // Optional: Sort files by date (assuming filenames follow the format
-  // 'dDDMMYY.txt')
-  files.sort();
-
+  // The ESP32 lists the daily files in date order, with their day and size
   files.forEach((file) => {
     //console.log("Adding file to selector:", file);
     let option = document.createElement("option");
-    option.value = file;
-
-    // Optionally format the display text to show day range for better readability
-    option.text = file;
+    option.value = file.name;
+    option.text = file.records
+      ? `${file.date} (${file.records} readings)`
+      : `${file.date} (${file.name})`;
 
     fileSelector.add(option);
   });
 }
 
+// Fetch the whole list of daily logs, one page at a time
+async function fetchLogList() {
+  let files = [];
+  for (;;) {
+    const response = await fetch(`/list-sd-card-files?logs=1&offset=${files.length}`);
+    if (!response.ok) {
+      throw new Error(`HTTP error! Status: ${response.status}`);
+    }
+    const page = await response.json();
+    files = files.concat(page.files);
+    if (page.files.length === 0 || files.length >= page.total) {
+      return files;
+    }
+  }
+}
+
 // Function to load Location data
 function loadLocation() {
   fetch("/get-location")
@@ -648,7 +732,10 @@ document.addEventListener("DOMContentLoaded", function () {
     .then((response) => response.text())
     .then((dailyFileName) => {
       console.log("Loading: ", dailyFileName);
-      fetch(`/get-data-file?filename=${encodeURIComponent(dailyFileName)}`)
+      // Only the first byte, to see whether the file exists
+      fetch(`/get-data-file?filename=${encodeURIComponent(dailyFileName)}&format=bin`, {
+        headers: { Range: "bytes=0-0" },
+      })
         .then((response) => {
           if (response.ok) {
             console.log("File exists and is being loaded.");
@@ -669,14 +756,7 @@ document.addEventListener("DOMContentLoaded", function () {
     });
 
   // Load historical data files into the selector if files exist
-  fetch("/list-sd-card-files")
-    .then((response) => {
-      if (!response.ok) {
-        console.log("No SD card files found or failed to fetch.");
-        return null;
-      }
-      return response.json();
-    })
+  fetchLogList()
     .then((files) => {
       if (files && files.length > 0) {
         console.log("Files received for historical data:", files);
@@ -88,30 +88,36 @@ bool NTPClient::forceUpdate() {
   #ifdef DEBUG_NTPClient
     Serial.println("Update from NTP Server");
   #endif
+  this->beginUpdate();
+
+  // Wait till data is there or timeout...
+  NTPUpdateResult result;
+  do {
+    delay ( 10 );
+    result = this->pollUpdate();
+  } while (result == NTP_UPDATE_PENDING);
+
+  return result == NTP_UPDATE_DONE;
+}
+
+void NTPClient::beginUpdate() {
+  if (!this->_udpSetup) this->begin();                           // setup the UDP client if needed
+
   // flush any existing packets
   while(this->_udp->parsePacket() != 0)
     this->_udp->flush();
   this->sendNTPPacket();
 
-  // Wait till data is there or timeout...
-  byte timeout = 0;
-  int cb = 0;
-  do {
-    delay ( 10 );
-    cb = this->_udp->parsePacket();
-    
-    if(cb > 0)
-    {
-      this->_udp->read(this->_packetBuffer, NTP_PACKET_SIZE);
-      if(!this->isValid(this->_packetBuffer))
-        cb = 0;
-    }
-    
-    if (timeout > 100) return false; // timeout after 1000 ms
-    timeout++;
-  } while (cb == 0);
+  this->_requestPending = true;
+  this->_requestSent = millis();
+}
+
+// Reads a waiting reply into the packet buffer and sets the time from it
+bool NTPClient::readReply() {
+  if (this->_udp->parsePacket() <= 0) return false;
 
-  this->_lastUpdate = millis() - (10 * (timeout + 1)); // Account for delay in reading the time
+  this->_udp->read(this->_packetBuffer, NTP_PACKET_SIZE);
+  if (!this->isValid(this->_packetBuffer)) return false;
 
   unsigned long highWord = word(this->_packetBuffer[40], this->_packetBuffer[41]);
   unsigned long lowWord = word(this->_packetBuffer[42], this->_packetBuffer[43]);
@@ -119,15 +125,54 @@ bool NTPClient::forceUpdate() {
   // this is NTP time (seconds since Jan 1 1900):
   unsigned long secsSince1900 = highWord << 16 | lowWord;
 
-  this->_currentEpoc = secsSince1900 - SEVENZYYEARS;
+  // The transmit timestamp fraction, so seconds roll over on time
+  unsigned long fractionMs = ((unsigned long)word(this->_packetBuffer[44], this->_packetBuffer[45]) * 1000) >> 16;
 
+  this->_currentEpoc = secsSince1900 - SEVENZYYEARS;
+  this->_lastUpdate = (millis() - fractionMs) | 1;  // 0 means never updated
   return true;
 }
 
+NTPUpdateResult NTPClient::pollUpdate() {
+  if (!this->_requestPending) return NTP_UPDATE_IDLE;
+
+  if (this->readReply()) {
+    this->_requestPending = false;
+    this->_lastAttempt = 0;
+    return NTP_UPDATE_DONE;
+  }
+
+  if (millis() - this->_requestSent >= this->_timeout) {
+    this->_requestPending = false;
+    this->_lastAttempt = this->_requestSent | 1;
+    return NTP_UPDATE_TIMEOUT;
+  }
+  return NTP_UPDATE_PENDING;
+}
+
+NTPUpdateResult NTPClient::updateAsync() {
+  if (this->_requestPending) return this->pollUpdate();
+
+  bool due = this->_lastUpdate == 0 ||                           // Update if there was no update yet.
+             millis() - this->_lastUpdate >= this->_updateInterval; // Update after _updateInterval
+  bool retryWait = this->_lastAttempt != 0 && millis() - this->_lastAttempt < this->_retryInterval;
+  if (!due || retryWait) return NTP_UPDATE_IDLE;
+
+  this->beginUpdate();
+  return NTP_UPDATE_PENDING;
+}
+
+bool NTPClient::isUpdatePending() {
+  return this->_requestPending;
+}
+
+bool NTPClient::isTimeSet() {
+  return this->_lastUpdate != 0;
+}
+
 bool NTPClient::update() {
   if ((millis() - this->_lastUpdate >= this->_updateInterval)     // Update after _updateInterval
     || this->_lastUpdate == 0) {                                // Update if there was no update yet.
-    if (!this->_udpSetup) this->begin();                         // setup the UDP client if needed
     return this->forceUpdate();
   }
   return true;
@@ -207,6 +252,11 @@ void NTPClient::setUpdateInterval(unsigned long updateInterval) {
   this->_updateInterval = updateInterval;
 }
 
+void NTPClient::setRequestTimeout(unsigned long timeout, unsigned long retryInterval) {
+  this->_timeout        = timeout;
+  this->_retryInterval  = retryInterval;
+}
+
 void NTPClient::sendNTPPacket() {
   // set all bytes in the buffer to 0
   memset(this->_packetBuffer, 0, NTP_PACKET_SIZE);
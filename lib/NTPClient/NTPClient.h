@@ -7,9 +7,18 @@
 #define SEVENZYYEARS 2208988800UL
 #define NTP_PACKET_SIZE 48
 #define NTP_DEFAULT_LOCAL_PORT 1337
+#define NTP_DEFAULT_TIMEOUT 1000      // ms to wait for a reply
+#define NTP_DEFAULT_RETRY_INTERVAL 5000 // ms between attempts after a failure
 #define LEAP_YEAR(Y)     ( (Y>0) && !(Y%4) && ( (Y%100) || !(Y%400) ) )
 
 
+enum NTPUpdateResult {
+  NTP_UPDATE_IDLE,      // No request outstanding, time is current
+  NTP_UPDATE_PENDING,   // Request sent, waiting for the reply
+  NTP_UPDATE_DONE,      // Reply received, time updated
+  NTP_UPDATE_TIMEOUT    // No valid reply in time, will retry later
+};
+
 class NTPClient {
   private:
     UDP*          _udp;
@@ -24,10 +33,17 @@ class NTPClient {
     unsigned long _currentEpoc    = 0;      // In s
     unsigned long _lastUpdate     = 0;      // In ms
 
+    bool          _requestPending = false;
+    unsigned long _requestSent    = 0;      // In ms
+    unsigned long _lastAttempt    = 0;      // In ms, 0 = no failed attempt
+    unsigned long _timeout        = NTP_DEFAULT_TIMEOUT;
+    unsigned long _retryInterval  = NTP_DEFAULT_RETRY_INTERVAL;
+
     byte          _packetBuffer[NTP_PACKET_SIZE];
 
     void          sendNTPPacket();
     bool          isValid(byte * ntpPacket);
+    bool          readReply();
 
   public:
     NTPClient(UDP& udp);
@@ -61,6 +77,38 @@ class NTPClient {
      */
     bool forceUpdate();
 
+    /**
+     * Flushes stale replies and sends a request to the NTP Server without waiting
+     * for the reply. Complete it with pollUpdate().
+     */
+    void beginUpdate();
+
+    /**
+     * Checks for the reply to the request sent by beginUpdate(). Never blocks.
+     *
+     * @return NTP_UPDATE_DONE when the time was updated, NTP_UPDATE_PENDING while
+     * waiting, NTP_UPDATE_TIMEOUT once the timeout has passed, NTP_UPDATE_IDLE if
+     * no request is outstanding
+     */
+    NTPUpdateResult pollUpdate();
+
+    /**
+     * Non-blocking update(). Call it often: it sends a request every update interval,
+     * completes it when the reply arrives and retries after the retry interval if no
+     * reply comes.
+     */
+    NTPUpdateResult updateAsync();
+
+    /**
+     * @return true while a request is waiting for its reply
+     */
+    bool isUpdatePending();
+
+    /**
+     * @return true once the time has been set from the NTP Server
+     */
+    bool isTimeSet();
+
     int getDay();
     int getHours();
     int getMinutes();
@@ -77,6 +125,12 @@ class NTPClient {
      */
     void setUpdateInterval(unsigned long updateInterval);
 
+    /**
+     * Set how long to wait for a reply, and how long to wait before trying
+     * again after a request got no reply
+     */
+    void setRequestTimeout(unsigned long timeout, unsigned long retryInterval);
+
     /**
     * @return secs argument (or 0 for current time) formatted like `hh:mm:ss`
     */
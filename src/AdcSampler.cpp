@@ -0,0 +1,28 @@
+#include "AdcSampler.h"
+
+RingBuffer<uint16_t, ADC_RING_SIZE> adcRing;
+
+static uint8_t samplerPin;
+static TaskHandle_t samplerTask = NULL;
+
+// Read the sensor at a fixed rate and hand the raw codes to the ring buffer.
+// When the consumer falls behind the newest samples are dropped and counted.
+static void adcSamplerTask(void *param) {
+	const TickType_t period = pdMS_TO_TICKS(1000 / ADC_SAMPLE_HZ);
+	TickType_t lastWake = xTaskGetTickCount();
+
+	for (;;) {
+		adcRing.push(analogRead(samplerPin));
+		vTaskDelayUntil(&lastWake, period);
+	}
+}
+
+// Start continuous sampling of the pressure sensor
+void startAdcSampler(uint8_t pin) {
+	if (samplerTask != NULL) {
+		return;
+	}
+	samplerPin = pin;
+	xTaskCreatePinnedToCore(adcSamplerTask, "adcSampler", 2048, NULL, 5, &samplerTask, 1);
+	Serial.printf("ADC sampler started at %d Hz\n", ADC_SAMPLE_HZ);
+}
@@ -0,0 +1,16 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <Arduino.h>
+#include "RingBuffer.h"
+
+#define ADC_SAMPLE_HZ 500		// Raw sensor sample rate
+#define ADC_RING_SIZE 1024	// Raw samples buffered, about 2 sec at ADC_SAMPLE_HZ
+
+// Raw ADC codes from the sampler task, consumed by loop()
+extern RingBuffer<uint16_t, ADC_RING_SIZE> adcRing;
+
+// Function prototypes
+void startAdcSampler(uint8_t pin);
+
+#endif	// ADC_SAMPLER_H
@@ -0,0 +1,43 @@
+#include "AdcToPsi.h"
+
+// The sensor calibration was fitted to a burst of 11 ADC reads divided by 10,
+// so a true average reads 10% below the codes the polynomial expects
+#define ADC_CALIB_GAIN 1.1
+
+// The table readers use and a spare. A rebuild runs on the web server task
+// while the analytics task converts samples, so it fills the spare and then
+// publishes it, the way the zone schedule is published. Rebuilds only come
+// from setup() and calibration requests, one at a time and far apart, so no
+// reader still holds the spare by the time it is filled again.
+static int16_t psiTables[2][ADC_LEVELS];
+std::atomic<const int16_t *> psiTable(psiTables[0]);
+
+// Map floating point numbers
+// mapFLoat is from https://github.com/radishlogic/MapFloat
+static float mapFloat(float value, float fromLow, float fromHigh, float toLow, float toHigh) {
+	return (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
+}
+
+// Precompute the pressure for every averaged ADC code so a reading is a table lookup.
+// Folds in the ADC linearisation polynomial, the sensor voltage to pressure
+// mapping and the calibration offset. Rebuild whenever calibOffset changes.
+void buildPsiTable(float minVoltage, float maxVoltage, float minPressure, float maxPressure, float calibOffset) {
+	unsigned long startTime = micros();
+
+	int16_t *table = psiTable.load() == psiTables[0] ? psiTables[1] : psiTables[0];
+	for (uint16_t code = 0; code < ADC_LEVELS; code++) {
+		double adcReading = code * ADC_CALIB_GAIN;
+
+		// Apply ADC correction and calculate voltage and pressure
+		double voltage = -0.000000000000016 * pow(adcReading, 4) +
+										 0.000000000118171 * pow(adcReading, 3) -
+										 0.000000301211691 * pow(adcReading, 2) +
+										 0.001109019271794 * adcReading + 0.034143524634089;
+
+		float pressure = mapFloat(voltage, minVoltage, maxVoltage, minPressure, maxPressure) - calibOffset;
+		table[code] = (int16_t)lroundf(pressure * 100.0f);
+	}
+	psiTable.store(table, std::memory_order_release);
+
+	Serial.printf("PSI table built in %lu us, offset %.1f\n", micros() - startTime, calibOffset);
+}
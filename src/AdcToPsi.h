@@ -0,0 +1,22 @@
+#ifndef ADC_TO_PSI_H
+#define ADC_TO_PSI_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#define ADC_LEVELS 4096	 // 12-bit ADC
+
+// Pressure in hundredths of a PSI for every ADC code. Points at one of two
+// tables; a rebuild fills the other one and then switches this pointer.
+extern std::atomic<const int16_t *> psiTable;
+
+// Function prototypes
+void buildPsiTable(float minVoltage, float maxVoltage, float minPressure, float maxPressure, float calibOffset);
+
+// Convert an averaged ADC reading to hundredths of a PSI
+inline int16_t adcToCentiPsi(uint16_t adcReading) {
+	const int16_t *table = psiTable.load(std::memory_order_acquire);
+	return table[adcReading < ADC_LEVELS ? adcReading : ADC_LEVELS - 1];
+}
+
+#endif	// ADC_TO_PSI_H
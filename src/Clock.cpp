@@ -0,0 +1,82 @@
+#include "Clock.h"
+
+// The clock runs from millis() between NTP syncs. Readers on other tasks see
+// the base and the last value together, so they are kept under a spinlock.
+static portMUX_TYPE clockMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t baseEpoch = 0;
+static uint32_t baseMillis = 0;
+static uint32_t lastEpoch = 0;
+
+// Set the clock from a fresh NTP time
+void clockSync(uint32_t epoch) {
+	portENTER_CRITICAL(&clockMux);
+	baseEpoch = epoch;
+	baseMillis = millis();
+	// A large correction (first sync, bad server) is taken as is
+	if (epoch + CLOCK_MAX_HOLD_SEC < lastEpoch) {
+		lastEpoch = epoch;
+	}
+	portEXIT_CRITICAL(&clockMux);
+}
+
+// Current local epoch. Never goes backwards, a small backward correction
+// holds the clock until it catches up.
+uint32_t clockEpoch() {
+	portENTER_CRITICAL(&clockMux);
+	uint32_t elapsed = millis() - baseMillis;	// Wraps with millis()
+	uint32_t epoch = baseEpoch + elapsed / 1000;
+	if (epoch < lastEpoch) {
+		epoch = lastEpoch;
+	}
+	lastEpoch = epoch;
+	portEXIT_CRITICAL(&clockMux);
+	return epoch;
+}
+
+ClockTime clockNow() {
+	ClockTime time;
+	clockBreakdown(clockEpoch(), time);
+	return time;
+}
+
+// Split an epoch into calendar fields with integer math only (days to
+// civil date from H. Hinnant's date algorithms)
+void clockBreakdown(uint32_t epoch, ClockTime &time) {
+	uint32_t days = epoch / 86400;
+	uint32_t secondOfDay = epoch % 86400;
+
+	time.epoch = epoch;
+	time.hour = secondOfDay / 3600;
+	time.minute = secondOfDay / 60 % 60;
+	time.second = secondOfDay % 60;
+	time.weekday = (days + 4) % 7;	// 1970-01-01 was a Thursday
+	time.minuteOfWeek = time.weekday * 1440 + time.hour * 60 + time.minute;
+
+	// Shift to years starting March 1 so the leap day is last
+	uint32_t shifted = days + 719468;
+	uint32_t era = shifted / 146097;
+	uint32_t dayOfEra = shifted - era * 146097;
+	uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	uint32_t monthIndex = (5 * dayOfYear + 2) / 153;	// 0 = March
+
+	time.day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+	time.month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+	time.year = yearOfEra + era * 400 + (time.month <= 2 ? 1 : 0);
+}
+
+// Local time of the start of the log day containing epoch
+uint32_t logDayStart(uint32_t epoch) {
+	const uint32_t dayOffset = DAY_START_HOUR * 3600UL;
+	return epoch - (epoch - dayOffset) % 86400UL;
+}
+
+// YYYYMMDD of the log day now falls in. Before the start of the log day
+// that is the previous calendar day.
+uint32_t logDayKey(const ClockTime &now) {
+	ClockTime logDay = now;
+	if (now.hour < DAY_START_HOUR) {
+		clockBreakdown(now.epoch - 86400, logDay);
+	}
+	return logDay.year * 10000UL + logDay.month * 100 + logDay.day;
+}
@@ -0,0 +1,30 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <Arduino.h>
+
+#define CLOCK_MAX_HOLD_SEC 60	// Backward NTP corrections up to this are absorbed, larger ones step the clock
+#define DAY_START_HOUR 6			// Log day runs from 6:00 A.M. to 5:59 A.M.
+
+// Local time broken down once per tick, read by everything that needs the time
+struct ClockTime {
+	uint32_t epoch;					// Local seconds since 1970 (time zone already applied)
+	uint16_t year;
+	uint8_t month;					// 1-12
+	uint8_t day;						// 1-31
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+	uint8_t weekday;				// 0 = Sunday
+	uint16_t minuteOfWeek;	// Minutes after Sunday 00:00
+};
+
+// Function prototypes
+void clockSync(uint32_t epoch);
+uint32_t clockEpoch();
+ClockTime clockNow();
+void clockBreakdown(uint32_t epoch, ClockTime &time);
+uint32_t logDayStart(uint32_t epoch);
+uint32_t logDayKey(const ClockTime &now);
+
+#endif	// CLOCK_H
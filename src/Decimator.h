@@ -0,0 +1,46 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <stdint.h>
+
+// Summary of the raw samples in one output interval, in hundredths of a PSI
+struct DecimatedSample {
+	int16_t mean;
+	int16_t min;
+	int16_t max;
+	uint32_t count;	 // Raw samples in the interval, 0 if there were none
+};
+
+// Boxcar average plus min/max of every raw sample between two take() calls
+class Decimator {
+public:
+	void add(int16_t centiPsi) {
+		_sum += centiPsi;
+		if (_count == 0 || centiPsi < _min) _min = centiPsi;
+		if (_count == 0 || centiPsi > _max) _max = centiPsi;
+		_count++;
+	}
+
+	// Return the interval summary and start a new interval
+	DecimatedSample take() {
+		DecimatedSample sample = {0, 0, 0, _count};
+		if (_count > 0) {
+			sample.mean = (int16_t)((_sum + (_sum >= 0 ? 1 : -1) * (int32_t)(_count / 2)) / (int32_t)_count);
+			sample.min = _min;
+			sample.max = _max;
+		}
+		_sum = 0;
+		_count = 0;
+		return sample;
+	}
+
+	uint32_t count() const { return _count; }
+
+private:
+	int64_t _sum = 0;
+	uint32_t _count = 0;
+	int16_t _min = 0;
+	int16_t _max = 0;
+};
+
+#endif	// DECIMATOR_H
@@ -0,0 +1,99 @@
+#include "FileStream.h"
+#include "SdCardUtils.h"
+
+#define BENCH_MAX_BYTES (256 * 1024)	// Read at most this much of the file per timing
+
+// Read up to len bytes straight into data. A read longer than a sector stops
+// at a sector boundary, so the next one starts on one and the FAT driver can
+// copy whole sectors into the caller's buffer instead of through its cache.
+size_t readFileAligned(File &file, uint8_t *data, size_t len) {
+	if (len > FILE_STREAM_SECTOR) {
+		size_t position = file.position();
+		len = ((position + len) & ~(size_t)(FILE_STREAM_SECTOR - 1)) - position;
+	}
+	return file.read(data, len);
+}
+
+// Response that sends an open file from its current position, reading straight
+// into the web server's send buffer. length = 0 sends it chunked up to the end
+// of the file, otherwise exactly length bytes with a Content-Length. Reads of an
+// SD file are SD jobs, so logging runs between chunks; a chunk whose job can't
+// start in time is tried again later. The file is closed after the last read,
+// or by the SD owner task when the response is dropped early.
+AsyncWebServerResponse *beginFileStream(AsyncWebServerRequest *request, std::shared_ptr<File> file, const String &contentType,
+																				uint32_t length, bool sdFile) {
+	if (sdFile) {
+		std::shared_ptr<std::shared_ptr<File>> holder = sdShared(new std::shared_ptr<File>(std::move(file)));
+		file = std::shared_ptr<File>(holder, holder->get());
+	}
+	auto filler = [file, length, sdFile](uint8_t *data, size_t len, size_t index) -> size_t {
+		if (length) {
+			len = min(len, (size_t)(length - index));
+		}
+		size_t bytesRead = 0;
+		auto read = [&]() {
+			bytesRead = len ? readFileAligned(*file, data, len) : 0;
+			if (bytesRead == 0 || (length && index + bytesRead >= length)) {
+				file->close();
+			}
+		};
+		if (sdFile) {
+			if (!sdRun(SD_PRIORITY_READ, read, SD_WEB_WAIT)) {
+				return RESPONSE_TRY_AGAIN;
+			}
+		} else {
+			read();
+		}
+		return bytesRead;	 // 0 ends a chunked response
+	};
+	if (length) {
+		return request->beginResponse(contentType, length, filler);
+	}
+	return request->beginChunkedResponse(contentType, filler);
+}
+
+// Read a file from the start in readSize pieces. Call it inside an SD job for
+// a file on SD.
+FileReadTiming timeFileRead(fs::FS &fs, const char *path, size_t readSize, bool aligned) {
+	static uint8_t buffer[4096];
+	FileReadTiming timing = {0, 0};
+	File file = fs.open(path, FILE_READ);
+	if (!file) {
+		return timing;
+	}
+	readSize = min(readSize, sizeof(buffer));
+	uint32_t start = micros();
+	while (timing.bytes < BENCH_MAX_BYTES) {
+		size_t n = aligned ? readFileAligned(file, buffer, readSize) : file.read(buffer, readSize);
+		if (n == 0) {
+			break;
+		}
+		timing.bytes += n;
+	}
+	timing.micros = micros() - start;
+	file.close();
+	return timing;
+}
+
+// SD read throughput of a file for the piece sizes the web server asks for,
+// plain and sector aligned. Each timing is its own SD job; one the card is
+// too busy to take is left out.
+String sdReadBenchmarkJson(const char *path) {
+	static const uint16_t sizes[] = {256, 512, 1436, 2048, 2920, 4096};
+	String json = "[";
+	for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (uint8_t aligned = 0; aligned < 2; aligned++) {
+			FileReadTiming timing;
+			if (!sdRun(SD_PRIORITY_READ, [&]() { timing = timeFileRead(SD, path, sizes[i], aligned); }, SD_WEB_WAIT)) {
+				continue;
+			}
+			char entry[96];
+			snprintf(entry, sizeof(entry), "%s{\"size\":%u,\"aligned\":%s,\"bytes\":%lu,\"us\":%lu,\"kBps\":%lu}",
+							 json.length() > 1 ? "," : "", sizes[i], aligned ? "true" : "false", (unsigned long)timing.bytes,
+							 (unsigned long)timing.micros, (unsigned long)(timing.micros ? (uint64_t)timing.bytes * 1000 / timing.micros : 0));
+			json += entry;
+		}
+	}
+	json += "]";
+	return json;
+}
@@ -0,0 +1,24 @@
+#ifndef FILE_STREAM_H
+#define FILE_STREAM_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <memory>
+#include "FS.h"
+
+#define FILE_STREAM_SECTOR 512	// SD sector size, reads end on a sector boundary when they can
+
+// Time to read a whole file in pieces of one size
+struct FileReadTiming {
+	uint32_t bytes;
+	uint32_t micros;
+};
+
+// Function prototypes
+size_t readFileAligned(File &file, uint8_t *data, size_t len);
+AsyncWebServerResponse *beginFileStream(AsyncWebServerRequest *request, std::shared_ptr<File> file, const String &contentType,
+																				uint32_t length = 0, bool sdFile = true);
+FileReadTiming timeFileRead(fs::FS &fs, const char *path, size_t readSize, bool aligned);
+String sdReadBenchmarkJson(const char *path);
+
+#endif	// FILE_STREAM_H
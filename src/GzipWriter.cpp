@@ -0,0 +1,220 @@
+#include "GzipWriter.h"
+
+// Deflate length and distance code tables (RFC 1951 3.2.5)
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+																				31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+																					257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+																					7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void flushOut(GzipWriter &gz) {
+	if (gz.outLen > 0 && gz.file.write(gz.out, gz.outLen) != gz.outLen) {
+		gz.failed = true;
+	}
+	gz.outLen = 0;
+}
+
+static void putByte(GzipWriter &gz, uint8_t value) {
+	gz.out[gz.outLen++] = value;
+	if (gz.outLen == GZIP_OUT_SIZE) {
+		flushOut(gz);
+	}
+}
+
+// Deflate packs bits starting at the least significant bit
+static void putBits(GzipWriter &gz, uint32_t value, uint8_t count) {
+	gz.bitBuffer |= value << gz.bitCount;
+	gz.bitCount += count;
+	while (gz.bitCount >= 8) {
+		putByte(gz, gz.bitBuffer & 0xFF);
+		gz.bitBuffer >>= 8;
+		gz.bitCount -= 8;
+	}
+}
+
+// Huffman codes are sent most significant bit first
+static void putCode(GzipWriter &gz, uint16_t code, uint8_t count) {
+	uint16_t reversed = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	putBits(gz, reversed, count);
+}
+
+// Fixed Huffman code of a literal/length symbol
+static void putSymbol(GzipWriter &gz, uint16_t symbol) {
+	if (symbol < 144) {
+		putCode(gz, 0x30 + symbol, 8);
+	} else if (symbol < 256) {
+		putCode(gz, 0x190 + symbol - 144, 9);
+	} else if (symbol < 280) {
+		putCode(gz, symbol - 256, 7);
+	} else {
+		putCode(gz, 0xC0 + symbol - 280, 8);
+	}
+}
+
+static void putMatch(GzipWriter &gz, uint16_t length, uint16_t distance) {
+	uint8_t code = 28;
+	while (lengthBase[code] > length) {
+		code--;
+	}
+	putSymbol(gz, 257 + code);
+	putBits(gz, length - lengthBase[code], lengthExtra[code]);
+
+	code = 29;
+	while (distanceBase[code] > distance) {
+		code--;
+	}
+	putCode(gz, code, 5);
+	putBits(gz, distance - distanceBase[code], distanceExtra[code]);
+}
+
+static inline uint16_t hashAt(const GzipWriter &gz, uint32_t index) {
+	return ((gz.window[index] << 10) ^ (gz.window[index + 1] << 5) ^ gz.window[index + 2]) & (GZIP_HASH_SIZE - 1);
+}
+
+// Add window position index to its hash chain
+static void insertHash(GzipWriter &gz, uint32_t index) {
+	if (index + GZIP_MIN_MATCH > gz.fill) {
+		return;
+	}
+	uint16_t hash = hashAt(gz, index);
+	uint32_t position = gz.base + index;
+	uint32_t previous = gz.head[hash];
+	uint32_t distance = previous ? position - (previous - 1) : 0;
+	gz.prev[position & (GZIP_WINDOW - 1)] = distance < GZIP_WINDOW ? distance : 0;
+	gz.head[hash] = position + 1;
+}
+
+// Longest earlier match for window position index, 0 if none is long enough
+static uint16_t findMatch(GzipWriter &gz, uint32_t index, uint16_t &distance) {
+	uint32_t maxLength = min(gz.fill - index, (uint32_t)GZIP_MAX_MATCH);
+	if (maxLength < GZIP_MIN_MATCH) {
+		return 0;
+	}
+	uint32_t position = gz.base + index;
+	uint32_t candidate = gz.head[hashAt(gz, index)];
+	uint16_t bestLength = 0;
+	for (uint8_t chain = 0; chain < GZIP_MAX_CHAIN && candidate != 0; chain++) {
+		candidate--;
+		uint32_t back = position - candidate;
+		if (candidate < gz.base || back == 0 || back >= GZIP_WINDOW) {
+			break;
+		}
+		const uint8_t *a = gz.window + index;
+		const uint8_t *b = gz.window + (candidate - gz.base);
+		uint16_t length = 0;
+		while (length < maxLength && a[length] == b[length]) {
+			length++;
+		}
+		if (length > bestLength) {
+			bestLength = length;
+			distance = back;
+			if (length == maxLength) {
+				break;
+			}
+		}
+		uint16_t step = gz.prev[candidate & (GZIP_WINDOW - 1)];
+		candidate = step ? candidate - step + 1 : 0;
+	}
+	return bestLength >= GZIP_MIN_MATCH ? bestLength : 0;
+}
+
+// Encode window bytes up to limit
+static void encodeTo(GzipWriter &gz, uint32_t limit) {
+	while (gz.pos < limit) {
+		uint16_t distance = 0;
+		uint16_t length = findMatch(gz, gz.pos, distance);
+		if (length) {
+			putMatch(gz, length, distance);
+			for (uint16_t i = 0; i < length; i++) {
+				insertHash(gz, gz.pos + i);
+			}
+			gz.pos += length;
+		} else {
+			putSymbol(gz, gz.window[gz.pos]);
+			insertHash(gz, gz.pos);
+			gz.pos++;
+		}
+	}
+}
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t len) {
+	static const uint32_t nibbleTable[16] = {0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+																					 0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+																					 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+		crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+// Start a gzip stream in file, which must be open for writing
+bool gzipBegin(GzipWriter &gz, File file) {
+	memset(gz.head, 0, sizeof(gz.head));
+	gz.file = file;
+	gz.base = 0;
+	gz.pos = 0;
+	gz.fill = 0;
+	gz.crc = 0;
+	gz.inputSize = 0;
+	gz.bitBuffer = 0;
+	gz.bitCount = 0;
+	gz.outLen = 0;
+	gz.failed = false;
+
+	// Member header: magic, deflate, no flags, no time, no extra flags, Unix
+	static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 3};
+	for (uint8_t i = 0; i < sizeof(header); i++) {
+		putByte(gz, header[i]);
+	}
+	// The whole archive is one final block with the fixed Huffman codes
+	putBits(gz, 1, 1);
+	putBits(gz, 1, 2);
+	return true;
+}
+
+// Compress len more bytes
+bool gzipWrite(GzipWriter &gz, const uint8_t *data, size_t len) {
+	gz.crc = crc32Update(gz.crc, data, len);
+	gz.inputSize += len;
+	while (len > 0) {
+		if (gz.fill == sizeof(gz.window)) {
+			// Encode all but a full match of lookahead, then drop the oldest half
+			encodeTo(gz, gz.fill - GZIP_MAX_MATCH);
+			memmove(gz.window, gz.window + GZIP_WINDOW, gz.fill - GZIP_WINDOW);
+			gz.base += GZIP_WINDOW;
+			gz.pos -= GZIP_WINDOW;
+			gz.fill -= GZIP_WINDOW;
+		}
+		size_t n = min(len, sizeof(gz.window) - gz.fill);
+		memcpy(gz.window + gz.fill, data, n);
+		gz.fill += n;
+		data += n;
+		len -= n;
+	}
+	return !gz.failed;
+}
+
+// Encode the rest, end the block and write the gzip trailer
+bool gzipFinish(GzipWriter &gz) {
+	encodeTo(gz, gz.fill);
+	putSymbol(gz, 256);
+	if (gz.bitCount > 0) {
+		putBits(gz, 0, 8 - gz.bitCount);
+	}
+	for (uint8_t i = 0; i < 4; i++) {
+		putByte(gz, gz.crc >> (8 * i));
+	}
+	for (uint8_t i = 0; i < 4; i++) {
+		putByte(gz, gz.inputSize >> (8 * i));
+	}
+	flushOut(gz);
+	return !gz.failed;
+}
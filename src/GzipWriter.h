@@ -0,0 +1,38 @@
+#ifndef GZIP_WRITER_H
+#define GZIP_WRITER_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define GZIP_WINDOW 4096				// LZ77 window, matches reach back at most this far
+#define GZIP_HASH_SIZE 2048			// Heads of the 3-byte hash chains
+#define GZIP_MAX_CHAIN 16				// Candidates tried per position
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+#define GZIP_OUT_SIZE 512				// Compressed bytes buffered before a file write
+
+// Streaming gzip (deflate, fixed Huffman codes) writer for log archives. It
+// needs about 25 KB, so allocate it only while an archive is being made.
+struct GzipWriter {
+	File file;
+	uint8_t window[2 * GZIP_WINDOW];	// Recent input followed by the lookahead
+	uint32_t head[GZIP_HASH_SIZE];		// Newest position + 1 for each hash, 0 = none
+	uint16_t prev[GZIP_WINDOW];				// Distance to the previous position with the same hash
+	uint32_t base;										// Stream position of window[0]
+	uint32_t pos;											// Next window byte to encode
+	uint32_t fill;										// Bytes in window
+	uint32_t crc;
+	uint32_t inputSize;
+	uint32_t bitBuffer;
+	uint8_t bitCount;
+	uint8_t out[GZIP_OUT_SIZE];
+	uint16_t outLen;
+	bool failed;											// A file write came up short
+};
+
+// Function prototypes
+bool gzipBegin(GzipWriter &gz, File file);
+bool gzipWrite(GzipWriter &gz, const uint8_t *data, size_t len);
+bool gzipFinish(GzipWriter &gz);
+
+#endif	// GZIP_WRITER_H
@@ -0,0 +1,89 @@
+#include "HttpCache.h"
+#include "Clock.h"
+
+// "Sun, 06 Nov 1994 08:49:37 GMT"
+String httpDate(uint32_t utcEpoch) {
+	static const char *days[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+	static const char *months[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+	ClockTime time;
+	clockBreakdown(utcEpoch, time);
+	char text[32];
+	snprintf(text, sizeof(text), "%s, %02u %s %u %02u:%02u:%02u GMT", days[time.weekday], time.day, months[time.month - 1],
+					 time.year, time.hour, time.minute, time.second);
+	return text;
+}
+
+// True if the client's If-None-Match lists etag. An empty etag never matches.
+bool etagMatches(AsyncWebServerRequest *request, const String &etag) {
+	if (etag.length() == 0 || !request->hasHeader("If-None-Match")) {
+		return false;
+	}
+	String tags = request->getHeader("If-None-Match")->value();
+	return tags == "*" || tags.indexOf(etag.c_str()) != -1;
+}
+
+void addCacheHeaders(AsyncWebServerResponse *response, const String &etag, const char *cacheControl) {
+	if (etag.length()) {
+		response->addHeader("ETag", etag);
+	}
+	response->addHeader("Cache-Control", cacheControl);
+}
+
+void sendNotModified(AsyncWebServerRequest *request, const String &etag, const char *cacheControl) {
+	AsyncWebServerResponse *response = request->beginResponse(304);
+	addCacheHeaders(response, etag, cacheControl);
+	request->send(response);
+}
+
+// Single byte range of a request: "bytes=N-", "bytes=N-M" or "bytes=-N" (the
+// last N bytes). Multiple ranges and other units are ignored, which the
+// client then sees as a normal 200 with the whole file.
+ByteRangeResult parseByteRange(AsyncWebServerRequest *request, uint32_t size, uint32_t &first, uint32_t &last) {
+	if (!request->hasHeader("Range")) {
+		return BYTE_RANGE_NONE;
+	}
+	String range = request->getHeader("Range")->value();
+	range.trim();
+	if (!range.startsWith("bytes=") || range.indexOf(',') != -1) {
+		return BYTE_RANGE_NONE;
+	}
+	int dash = range.indexOf('-');
+	if (dash < 6) {
+		return BYTE_RANGE_NONE;
+	}
+	String from = range.substring(6, dash);
+	String to = range.substring(dash + 1);
+	if (from.length() == 0) {
+		// Suffix range
+		uint32_t count = strtoul(to.c_str(), NULL, 10);
+		if (count == 0 || size == 0) {
+			return BYTE_RANGE_UNSATISFIABLE;
+		}
+		first = count < size ? size - count : 0;
+		last = size - 1;
+		return BYTE_RANGE_OK;
+	}
+	first = strtoul(from.c_str(), NULL, 10);
+	if (first >= size) {
+		return BYTE_RANGE_UNSATISFIABLE;
+	}
+	last = to.length() ? strtoul(to.c_str(), NULL, 10) : size - 1;
+	if (last < first) {
+		return BYTE_RANGE_NONE;
+	}
+	last = min(last, size - 1);
+	return BYTE_RANGE_OK;
+}
+
+// "bytes first-last/size"
+String contentRange(uint32_t first, uint32_t last, uint32_t size) {
+	char text[40];
+	snprintf(text, sizeof(text), "bytes %lu-%lu/%lu", (unsigned long)first, (unsigned long)last, (unsigned long)size);
+	return text;
+}
+
+void sendRangeNotSatisfiable(AsyncWebServerRequest *request, uint32_t size) {
+	AsyncWebServerResponse *response = request->beginResponse(416);
+	response->addHeader("Content-Range", "bytes */" + String(size));
+	request->send(response);
+}
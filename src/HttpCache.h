@@ -0,0 +1,25 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#define HTTP_CACHE_IMMUTABLE "public, max-age=31536000, immutable"	// Content that never changes
+
+// Outcome of reading a Range header against a file size
+enum ByteRangeResult : uint8_t {
+	BYTE_RANGE_NONE,						// No usable Range header, send the whole file
+	BYTE_RANGE_OK,							// Send bytes first..last with 206
+	BYTE_RANGE_UNSATISFIABLE,		// Starts past the end, send 416
+};
+
+// Function prototypes
+String httpDate(uint32_t utcEpoch);
+bool etagMatches(AsyncWebServerRequest *request, const String &etag);
+void addCacheHeaders(AsyncWebServerResponse *response, const String &etag, const char *cacheControl);
+void sendNotModified(AsyncWebServerRequest *request, const String &etag, const char *cacheControl);
+ByteRangeResult parseByteRange(AsyncWebServerRequest *request, uint32_t size, uint32_t &first, uint32_t &last);
+String contentRange(uint32_t first, uint32_t last, uint32_t size);
+void sendRangeNotSatisfiable(AsyncWebServerRequest *request, uint32_t size);
+
+#endif	// HTTP_CACHE_H
@@ -0,0 +1,176 @@
+#include "LogArchive.h"
+#include "GzipWriter.h"
+#include "LogDirectory.h"
+#include "LogFormat.h"
+#include "LogPath.h"
+#include "SdCardUtils.h"
+#include <new>
+
+// Logs waiting to be archived, oldest first
+static char archiveQueue[LOG_ARCHIVE_QUEUE][32];
+static uint8_t archiveQueued = 0;
+static portMUX_TYPE archiveMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Boot scan for closed days without an archive: days after scanKey and
+// before scanEnd are still to be checked
+static bool scanActive = false;
+static uint32_t scanKey = 0;
+static uint32_t scanEnd = 0;
+
+// The archive being written. The writer is only allocated while one is.
+static GzipWriter *archiveWriter = nullptr;
+static LogRenderState archiveRender;
+static char archiveLog[32];
+static uint8_t archiveText[LOG_ARCHIVE_SLICE];
+
+String logArchivePath(const String &logPath) {
+	return logPath.substring(0, logPath.lastIndexOf('.')) + LOG_ARCHIVE_EXTENSION;
+}
+
+// Archive a closed daily log in the background. Returns false if the queue is full.
+bool queueLogArchive(const char *logPath) {
+	bool queued = false;
+	portENTER_CRITICAL(&archiveMux);
+	if (archiveQueued < LOG_ARCHIVE_QUEUE) {
+		strlcpy(archiveQueue[archiveQueued++], logPath, sizeof(archiveQueue[0]));
+		queued = true;
+	}
+	portEXIT_CRITICAL(&archiveMux);
+	return queued;
+}
+
+static bool nextQueuedLog(char *logPath, size_t size) {
+	bool found = false;
+	portENTER_CRITICAL(&archiveMux);
+	if (archiveQueued > 0) {
+		strlcpy(logPath, archiveQueue[0], size);
+		archiveQueued--;
+		memmove(archiveQueue[0], archiveQueue[1], archiveQueued * sizeof(archiveQueue[0]));
+		found = true;
+	}
+	portEXIT_CRITICAL(&archiveMux);
+	return found;
+}
+
+// Look for archives missing since a reset emptied the queue, on every closed
+// day before todayKey (YYYYMMDD). Call it once at boot after the log
+// directory is built.
+void startArchiveScan(uint32_t todayKey) {
+	scanKey = 0;
+	scanEnd = todayKey;
+	scanActive = true;
+}
+
+// Check the next LOG_ARCHIVE_SCAN_BATCH days of the boot scan in one SD job
+// and take the first raw log without an archive. Compacted days are left
+// out, their archive is dropped on purpose. Returns true with logPath set
+// when one is found.
+static bool nextUnarchivedLog(fs::FS &fs, char *logPath, size_t size) {
+	bool found = false;
+	sdRun(SD_PRIORITY_BACKGROUND, [&]() {
+		for (uint8_t n = 0; n < LOG_ARCHIVE_SCAN_BATCH && scanActive && !found; n++) {
+			LogDirEntry entry;
+			if (!nextLogDirEntry(scanKey, entry) || entry.dateKey >= scanEnd) {
+				scanActive = false;
+				break;
+			}
+			scanKey = entry.dateKey;
+			if (entry.records == 0 || entry.step != 0) {
+				continue;
+			}
+			String path = resolveLogPath(fs, entry.name);	// A day not migrated yet is archived in the root
+			if (fs.exists(path) && !fs.exists(logArchivePath(path))) {
+				strlcpy(logPath, path.c_str(), size);
+				found = true;
+			}
+		}
+	});
+	return found;
+}
+
+// Open the next queued log, or the next one found by the boot scan, and its
+// temporary archive
+static bool startArchive(fs::FS &fs) {
+	if (!nextQueuedLog(archiveLog, sizeof(archiveLog))) {
+		if (!scanActive) {
+			return false;
+		}
+		if (!nextUnarchivedLog(fs, archiveLog, sizeof(archiveLog))) {
+			return scanActive;	// More days to check on the next slice
+		}
+		Serial.printf("Archiving %s, missed before a reset\n", archiveLog);
+	}
+	archiveWriter = new (std::nothrow) GzipWriter;
+	if (!archiveWriter) {
+		Serial.printf("Not enough memory to archive %s\n", archiveLog);
+		return false;
+	}
+
+	bool started = false;
+	sdRun(SD_PRIORITY_BACKGROUND, [&]() {
+		File log = fs.open(archiveLog, FILE_READ);
+		if (!log || !beginLogRender(archiveRender, log, LOG_FORMAT_CSV)) {
+			log.close();
+			return;
+		}
+		File out = fs.open(logArchivePath(archiveLog) + ".tmp", FILE_WRITE);
+		if (!out) {
+			archiveRender.file.close();
+			return;
+		}
+		started = gzipBegin(*archiveWriter, out);
+	});
+	if (!started) {
+		Serial.printf("Failed to start the archive of %s\n", archiveLog);
+		delete archiveWriter;
+		archiveWriter = nullptr;
+	}
+	return started;
+}
+
+// Do one slice of the background archiving: compress the next
+// LOG_ARCHIVE_SLICE bytes of CSV in one short SD job. The archive is written
+// under a temporary name and renamed when complete, so a partial one is never
+// served. Returns true while there is more to do.
+bool archiveLogSlice(fs::FS &fs) {
+	if (!archiveWriter) {
+		return startArchive(fs);
+	}
+
+	bool done = false;
+	bool ok = true;
+	sdRun(SD_PRIORITY_BACKGROUND, [&]() {
+		String archivePath = logArchivePath(archiveLog);
+		String tempPath = archivePath + ".tmp";
+		size_t len = renderLogRecords(archiveRender, archiveText, sizeof(archiveText));
+		if (len > 0) {
+			ok = gzipWrite(*archiveWriter, archiveText, len);
+		} else {
+			done = true;
+			ok = gzipFinish(*archiveWriter);
+		}
+		if (done || !ok) {
+			archiveRender.file.close();
+			archiveWriter->file.close();
+			if (ok) {
+				fs.remove(archivePath);
+				ok = fs.rename(tempPath, archivePath);
+			}
+			if (!ok) {
+				fs.remove(tempPath);
+			}
+		}
+	});
+
+	if (done || !ok) {
+		if (ok) {
+			Serial.printf("Archived %s (%lu bytes of CSV)\n", archiveLog, (unsigned long)archiveWriter->inputSize);
+		} else {
+			Serial.printf("Failed to archive %s\n", archiveLog);
+		}
+		delete archiveWriter;
+		archiveWriter = nullptr;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,24 @@
+#ifndef LOG_ARCHIVE_H
+#define LOG_ARCHIVE_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define LOG_ARCHIVE_EXTENSION ".csv.gz"
+#define LOG_ARCHIVE_QUEUE 4					// Closed days waiting to be archived
+#define LOG_ARCHIVE_SLICE 1024			// CSV bytes compressed per SD job
+#define LOG_ARCHIVE_SCAN_BATCH 8		// Days checked for a missing archive per SD job
+
+// Closed daily logs are archived as the gzip of their CSV form
+// (YYYYMMDD.csv.gz next to YYYYMMDD.bin), so downloads by browsers can be sent
+// as stored. The .bin stays the source for everything else. The queue is
+// only in RAM, so at boot the closed days are scanned for raw logs that have
+// no archive yet and those are archived once the queue is empty.
+
+// Function prototypes
+String logArchivePath(const String &logPath);
+bool queueLogArchive(const char *logPath);
+void startArchiveScan(uint32_t todayKey);
+bool archiveLogSlice(fs::FS &fs);
+
+#endif	// LOG_ARCHIVE_H
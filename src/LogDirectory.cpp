@@ -0,0 +1,331 @@
+#include "LogDirectory.h"
+#include "LogFormat.h"
+#include "LogIndex.h"
+#include "LogPath.h"
+#include <algorithm>
+#include <vector>
+
+static std::vector<LogDirEntry> directory;
+static uint16_t directoryCapacity = LOG_DIR_MAX_FILES;	// Set from the free heap at boot
+static SemaphoreHandle_t directoryMutex = NULL;
+
+static bool entryBefore(const LogDirEntry &a, const LogDirEntry &b) {
+	if (a.dateKey != b.dateKey) {
+		return a.dateKey < b.dateKey;
+	}
+	return strcmp(a.name, b.name) < 0;
+}
+
+static const char *baseName(const char *path) {
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+// Files shown in listings. Index and archive files belong to their daily
+// log and are left out.
+bool isListedFile(const String &name) {
+	String base = baseName(name.c_str());
+	if (base.length() >= sizeof(LogDirEntry::name)) {
+		Serial.println("File name too long to list: " + base);
+		return false;
+	}
+	return !base.endsWith(LOG_INDEX_EXTENSION) && !base.endsWith(".gz") && !base.endsWith(".tmp");
+}
+
+// Metadata of an open file
+static void readEntry(File &file, const char *name, LogDirEntry &entry) {
+	memset(&entry, 0, sizeof(entry));
+	strlcpy(entry.name, baseName(name), sizeof(entry.name));
+	entry.dateKey = logDateKey(entry.name);
+	entry.size = file.size();
+
+	LogFileHeader header;
+	LogAggregateRecord first;
+	LogRecord last;
+	if (isBinaryLog(entry.name) && readLogHeader(file, header)) {
+		// Reserved space of a day still being logged is not counted
+		entry.size = logDataSize(file, header);
+		entry.records = logRecordCount(file, header);
+		if (readLogAggregate(file, header, first) && readLastLogRecord(file, header, last)) {
+			entry.firstEpoch = first.sample.epoch;
+			entry.lastEpoch = last.epoch;
+			entry.step = first.seconds;
+		}
+	}
+}
+
+static void lockDirectory() {
+	if (directoryMutex) {
+		xSemaphoreTake(directoryMutex, portMAX_DELAY);
+	}
+}
+
+static void unlockDirectory() {
+	if (directoryMutex) {
+		xSemaphoreGive(directoryMutex);
+	}
+}
+
+// Position of name in the sorted index, or where it would go
+static std::vector<LogDirEntry>::iterator findEntry(const LogDirEntry &key) {
+	return std::lower_bound(directory.begin(), directory.end(), key, entryBefore);
+}
+
+// Make room in a full index for a file of day dateKey (0 for other files) by
+// dropping the oldest daily file, so the newest days always stay listed.
+// entries need not be sorted. Returns false if the file is older than all of
+// them and should not be listed.
+static bool evictOldest(std::vector<LogDirEntry> &entries, uint32_t dateKey) {
+	auto oldest = entries.end();
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		if (it->dateKey != 0 && (oldest == entries.end() || entryBefore(*it, *oldest))) {
+			oldest = it;
+		}
+	}
+	if (oldest == entries.end() || (dateKey != 0 && dateKey <= oldest->dateKey)) {
+		return false;
+	}
+	entries.erase(oldest);
+	return true;
+}
+
+// Add the files of a directory to entries, and those of its subdirectories
+// down to depth more levels. Returns the number of files left out.
+static uint16_t indexDirectory(fs::FS &fs, const String &dirPath, uint8_t depth, std::vector<LogDirEntry> &entries) {
+	uint16_t dropped = 0;
+	File dir = fs.open(dirPath);
+	File file = dir ? dir.openNextFile() : File();
+	while (file) {
+		String name = baseName(file.name());
+		if (file.isDirectory()) {
+			// Close the entry first, only a few files can be open at a time
+			file.close();
+			if (depth > 0) {
+				dropped += indexDirectory(fs, dirPath + "/" + name, depth - 1, entries);
+			}
+		} else if (isListedFile(name)) {
+			if (entries.size() >= directoryCapacity && !evictOldest(entries, logDateKey(name.c_str()))) {
+				dropped++;
+			} else {
+				LogDirEntry entry;
+				readEntry(file, name.c_str(), entry);
+				entries.push_back(entry);
+			}
+		}
+		file = dir.openNextFile();
+	}
+	return dropped;
+}
+
+// Read every file of the SD root and of the LOG_ROOT tree into the index.
+// Call it once at boot, inside an SD job. Returns the number of entries.
+uint16_t buildLogDirectory(fs::FS &fs) {
+	if (!directoryMutex) {
+		directoryMutex = xSemaphoreCreateMutex();
+	}
+	// Reserve the whole index up front, growing it later would need twice the space
+	size_t spare = ESP.getMaxAllocHeap() / LOG_DIR_HEAP_SHARE / sizeof(LogDirEntry);
+	directoryCapacity = constrain(spare, (size_t)LOG_DIR_MIN_FILES, (size_t)LOG_DIR_MAX_FILES);
+	std::vector<LogDirEntry> entries;
+	entries.reserve(directoryCapacity);
+
+	uint16_t dropped = indexDirectory(fs, "/", 0, entries);
+	dropped += indexDirectory(fs, LOG_ROOT, 2, entries);	// YYYY/MM/
+	if (dropped > 0) {
+		Serial.printf("Index holds %u files, the %u oldest days on SD are not listed\n", directoryCapacity, dropped);
+	}
+	std::sort(entries.begin(), entries.end(), entryBefore);
+
+	lockDirectory();
+	directory.swap(entries);
+	uint16_t count = directory.size();
+	unlockDirectory();
+	return count;
+}
+
+// Add or refresh the entry of a file after it was created or written. A file
+// that no longer exists is removed. Call it inside an SD job.
+void updateLogDirectory(fs::FS &fs, const char *path) {
+	if (!isListedFile(path)) {
+		return;
+	}
+	File file = fs.open(path, FILE_READ);
+	if (!file || file.isDirectory()) {
+		removeFromLogDirectory(path);
+		return;
+	}
+	LogDirEntry entry;
+	readEntry(file, path, entry);
+	file.close();
+
+	lockDirectory();
+	auto it = findEntry(entry);
+	if (it != directory.end() && strcmp(it->name, entry.name) == 0) {
+		*it = entry;
+	} else if (directory.size() < directoryCapacity) {
+		directory.insert(it, entry);
+	} else if (evictOldest(directory, entry.dateKey)) {
+		directory.insert(findEntry(entry), entry);
+	}
+	unlockDirectory();
+}
+
+void removeFromLogDirectory(const char *path) {
+	LogDirEntry key;
+	strlcpy(key.name, baseName(path), sizeof(key.name));
+	key.dateKey = logDateKey(key.name);
+
+	lockDirectory();
+	auto it = findEntry(key);
+	if (it != directory.end() && strcmp(it->name, key.name) == 0) {
+		directory.erase(it);
+	}
+	unlockDirectory();
+}
+
+// First binary daily log after the day afterKey, in date order
+bool nextLogDirEntry(uint32_t afterKey, LogDirEntry &entry) {
+	LogDirEntry key;
+	memset(&key, 0, sizeof(key));
+	key.dateKey = afterKey + 1;
+
+	bool found = false;
+	lockDirectory();
+	for (auto it = findEntry(key); it != directory.end() && !found; ++it) {
+		if (it->dateKey != 0 && isBinaryLog(it->name)) {
+			entry = *it;
+			found = true;
+		}
+	}
+	unlockDirectory();
+	return found;
+}
+
+// Newest binary daily log
+bool lastLogDirEntry(LogDirEntry &entry) {
+	bool found = false;
+	lockDirectory();
+	for (auto it = directory.rbegin(); it != directory.rend() && it->dateKey != 0 && !found; ++it) {
+		if (isBinaryLog(it->name)) {
+			entry = *it;
+			found = true;
+		}
+	}
+	unlockDirectory();
+	return found;
+}
+
+static bool entryMatches(const LogDirEntry &entry, const LogDirQuery &query) {
+	if (query.logsOnly && entry.dateKey == 0) {
+		return false;
+	}
+	if (query.fromKey && entry.dateKey < query.fromKey) {
+		return false;
+	}
+	if (query.toKey && entry.dateKey > query.toKey) {
+		return false;
+	}
+	return true;
+}
+
+void beginLogDirList(LogDirListState &state, const LogDirQuery &query) {
+	state.query = query;
+	state.position = 0;
+	state.matched = 0;
+	state.sent = 0;
+	state.total = 0;
+	state.textLen = 0;
+	state.textPos = 0;
+	state.opened = false;
+	state.closed = false;
+
+	lockDirectory();
+	for (const LogDirEntry &entry : directory) {
+		if (entryMatches(entry, query)) {
+			state.total++;
+		}
+	}
+	unlockDirectory();
+}
+
+// Next matching entry of the page, copied out of the index so the lock is
+// held only briefly. Entries added or removed meanwhile may shift the page.
+static bool nextEntry(LogDirListState &state, LogDirEntry &entry) {
+	bool found = false;
+	lockDirectory();
+	while (!found && state.sent < state.query.limit && state.position < directory.size()) {
+		const LogDirEntry &candidate = directory[state.position++];
+		if (!entryMatches(candidate, state.query)) {
+			continue;
+		}
+		if (state.matched++ < state.query.offset) {
+			continue;
+		}
+		entry = candidate;
+		found = true;
+	}
+	unlockDirectory();
+	return found;
+}
+
+// Render the next entry into state.text
+static size_t formatEntry(LogDirListState &state, const LogDirEntry &entry) {
+	const char *comma = state.sent ? "," : "";
+	int n;
+	if (!state.query.detail) {
+		n = snprintf(state.text, sizeof(state.text), "%s\"%s\"", comma, entry.name);
+	} else if (entry.dateKey) {
+		n = snprintf(state.text, sizeof(state.text),
+								 "%s{\"name\":\"%s\",\"size\":%lu,\"date\":\"%04lu-%02lu-%02lu\",\"records\":%lu,\"first\":%lu,\"last\":%lu,\"step\":%u}",
+								 comma, entry.name, (unsigned long)entry.size, (unsigned long)(entry.dateKey / 10000),
+								 (unsigned long)(entry.dateKey / 100 % 100), (unsigned long)(entry.dateKey % 100),
+								 (unsigned long)entry.records, (unsigned long)entry.firstEpoch, (unsigned long)entry.lastEpoch,
+								 entry.step);
+	} else {
+		n = snprintf(state.text, sizeof(state.text), "%s{\"name\":\"%s\",\"size\":%lu}", comma, entry.name,
+								 (unsigned long)entry.size);
+	}
+	return n < 0 ? 0 : min((size_t)n, sizeof(state.text) - 1);
+}
+
+// Fill data with up to len bytes of the listing. Returns 0 when done. The
+// plain listing is a JSON array of names; the detailed one is
+// {"total":N,"offset":N,"files":[{name,size,date,records,first,last,step},...]}.
+size_t renderLogDirList(LogDirListState &state, uint8_t *data, size_t len) {
+	size_t out = 0;
+	while (out < len) {
+		if (state.textPos < state.textLen) {
+			size_t n = min((size_t)(state.textLen - state.textPos), len - out);
+			memcpy(data + out, state.text + state.textPos, n);
+			state.textPos += n;
+			out += n;
+			continue;
+		}
+
+		size_t textLen = 0;
+		LogDirEntry entry;
+		if (!state.opened) {
+			if (state.query.detail) {
+				int n = snprintf(state.text, sizeof(state.text), "{\"total\":%u,\"offset\":%u,\"files\":[", state.total,
+												 state.query.offset);
+				textLen = n < 0 ? 0 : n;
+			} else {
+				state.text[0] = '[';
+				textLen = 1;
+			}
+			state.opened = true;
+		} else if (nextEntry(state, entry)) {
+			textLen = formatEntry(state, entry);
+			state.sent++;
+		} else if (!state.closed) {
+			strcpy(state.text, state.query.detail ? "]}" : "]");
+			textLen = strlen(state.text);
+			state.closed = true;
+		} else {
+			break;
+		}
+		state.textLen = textLen;
+		state.textPos = 0;
+	}
+	return out;
+}
@@ -0,0 +1,58 @@
+#ifndef LOG_DIRECTORY_H
+#define LOG_DIRECTORY_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define LOG_DIR_MAX_FILES 1200	// Entries kept in RAM at most, 48 bytes each
+#define LOG_DIR_MIN_FILES 100		// Entries kept even when the heap is short
+#define LOG_DIR_HEAP_SHARE 4		// The index takes at most 1/n of the largest free heap block
+#define LOG_DIR_PAGE_MAX 200		// Entries per page of a detailed listing
+
+// One file of the SD root or of the LOG_ROOT tree, kept sorted by day and
+// then by name
+struct LogDirEntry {
+	char name[24];				// "20250101.bin", "location.txt", ...
+	uint32_t dateKey;			// YYYYMMDD of a daily file, 0 for other files
+	uint32_t size;
+	uint32_t records;			// Records of a binary log, 0 otherwise
+	uint32_t firstEpoch;	// Times of the first and last record of a binary log,
+	uint32_t lastEpoch;		// 0 if it has none or is not one
+	uint16_t step;				// Seconds per record of a compacted log, 0 for raw samples
+};
+
+// Which entries a listing returns
+struct LogDirQuery {
+	uint32_t fromKey;	 // Daily files from this YYYYMMDD on, 0 = no limit
+	uint32_t toKey;		 // Daily files up to this YYYYMMDD, 0 = no limit
+	bool logsOnly;		 // Daily files only
+	bool detail;			 // Objects with metadata and a total instead of a name array
+	uint16_t offset;	 // Matching entries to skip
+	uint16_t limit;		 // Matching entries to return
+};
+
+// Progress of a listing sent as a chunked response
+struct LogDirListState {
+	LogDirQuery query;
+	uint16_t position;	// Next index entry to look at
+	uint16_t matched;		// Matching entries seen, including skipped ones
+	uint16_t sent;
+	uint16_t total;			// Matching entries in the whole index
+	char text[192];
+	uint8_t textLen;
+	uint8_t textPos;
+	bool opened;
+	bool closed;
+};
+
+// Function prototypes
+bool isListedFile(const String &name);
+uint16_t buildLogDirectory(fs::FS &fs);
+void updateLogDirectory(fs::FS &fs, const char *path);
+void removeFromLogDirectory(const char *path);
+bool nextLogDirEntry(uint32_t afterKey, LogDirEntry &entry);
+bool lastLogDirEntry(LogDirEntry &entry);
+void beginLogDirList(LogDirListState &state, const LogDirQuery &query);
+size_t renderLogDirList(LogDirListState &state, uint8_t *data, size_t len);
+
+#endif	// LOG_DIRECTORY_H
@@ -0,0 +1,309 @@
+#include "LogFormat.h"
+#include <stddef.h>
+
+bool isBinaryLog(const String &fileName) {
+	return fileName.endsWith(LOG_EXTENSION);
+}
+
+// Write the header of a new daily log file
+bool writeLogHeader(File &file, uint32_t dayStart, uint32_t firstReadingId) {
+	LogFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LOG_MAGIC, 4);
+	header.version = LOG_VERSION;
+	header.recordSize = sizeof(LogCheckedRecord);
+	header.headerSize = sizeof(LogFileHeader);
+	header.dayStart = dayStart;
+	header.firstReadingId = firstReadingId;
+
+	return file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+}
+
+// Read and check the header, leaving the file positioned at the first record
+bool readLogHeader(File &file, LogFileHeader &header) {
+	if (!file.seek(0) || file.read((uint8_t *)&header, LOG_HEADER_V1_SIZE) != LOG_HEADER_V1_SIZE) {
+		return false;
+	}
+	if (memcmp(header.magic, LOG_MAGIC, 4) != 0 || header.version == 0 || header.version > LOG_VERSION ||
+			header.recordSize < sizeof(LogRecord) || header.recordSize > LOG_MAX_RECORD_SIZE) {
+		return false;
+	}
+	header.recordCount = 0;
+	if (header.version >= 2 &&
+			(header.headerSize < sizeof(LogFileHeader) ||
+			 file.read((uint8_t *)&header.recordCount, sizeof(header.recordCount)) != sizeof(header.recordCount))) {
+		return false;
+	}
+	return file.seek(header.headerSize);
+}
+
+// Records in a log. Version 1 files end with their last record, version 2
+// files count them in the header because the file may be preallocated.
+uint32_t logRecordCount(File &file, const LogFileHeader &header) {
+	if (header.version >= 2) {
+		return header.recordCount;
+	}
+	return file.size() > header.headerSize ? (file.size() - header.headerSize) / header.recordSize : 0;
+}
+
+// Bytes of header and records, without reserved space
+uint32_t logDataSize(File &file, const LogFileHeader &header) {
+	return header.headerSize + logRecordCount(file, header) * header.recordSize;
+}
+
+// Store the record count of a version 2 file after records were written.
+// Version 1 files need nothing.
+bool setLogRecordCount(File &file, const LogFileHeader &header, uint32_t count) {
+	if (header.version < 2) {
+		return true;
+	}
+	return file.seek(offsetof(LogFileHeader, recordCount)) &&
+				 file.write((const uint8_t *)&count, sizeof(count)) == sizeof(count);
+}
+
+// CRC-16/CCITT (poly 0x1021, init 0xFFFF) of the record and its sequence number
+static uint16_t logRecordCrc(const LogCheckedRecord &checked) {
+	const uint8_t *bytes = (const uint8_t *)&checked;
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < offsetof(LogCheckedRecord, crc); i++) {
+		crc ^= (uint16_t)bytes[i] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+// Fill in a record as it is written to the log
+void sealLogRecord(LogCheckedRecord &checked, const LogRecord &record, uint32_t sequence) {
+	checked.record = record;
+	checked.sequence = sequence;
+	checked.crc = logRecordCrc(checked);
+}
+
+// False for a record that was only partly written, or never
+bool isLogRecordIntact(const LogCheckedRecord &checked) {
+	return checked.crc == logRecordCrc(checked);
+}
+
+// Records of a version 3 log that survived a reset or power cut. Only the
+// tail of the file is read: the last counted records are checked back to the
+// first intact one, then intact records written after them by a flush that
+// was cut short before it could update the count are taken in. window is the
+// most records one flush writes. The newest intact record goes to last.
+uint32_t recoverLogRecordCount(File &file, const LogFileHeader &header, uint8_t window, LogCheckedRecord &last,
+															 bool &haveLast) {
+	uint32_t count = logRecordCount(file, header);
+	haveLast = false;
+
+	// The count is only written after its records, but a card may not write
+	// the sectors in order
+	for (uint8_t n = 0; n < window && count > 0 && !haveLast; n++) {
+		haveLast = file.seek(header.headerSize + (count - 1) * header.recordSize) &&
+							 file.read((uint8_t *)&last, sizeof(last)) == sizeof(last) && isLogRecordIntact(last);
+		if (!haveLast) {
+			count--;
+		}
+	}
+	// At most one flush can be on the card without being counted
+	LogCheckedRecord record;
+	file.seek(header.headerSize + count * header.recordSize);
+	for (uint8_t n = 0; n < window; n++) {
+		bool intact = file.read((uint8_t *)&record, sizeof(record)) == sizeof(record) && isLogRecordIntact(record) &&
+									record.record.epoch >= header.dayStart && record.record.epoch < header.dayStart + 86400UL &&
+									(!haveLast || (record.sequence > last.sequence && record.record.epoch >= last.record.epoch));
+		if (!intact) {
+			break;
+		}
+		last = record;
+		haveLast = true;
+		count++;
+	}
+	return count;
+}
+
+// Read the raw bytes of the next record, stopping at the last one counted in
+// header, so the reserved space of a preallocated file is never read. The
+// record's readingID goes to readingId if it is wanted: version 3 samples
+// carry their own, the others count on from the header's firstReadingId.
+static bool readRawRecord(File &file, const LogFileHeader &header, uint8_t *raw, uint32_t *readingId) {
+	size_t position = file.position();
+	if (header.version >= 2 && position + header.recordSize > header.headerSize + header.recordCount * header.recordSize) {
+		return false;
+	}
+	if (file.read(raw, header.recordSize) != header.recordSize) {
+		return false;
+	}
+	if (readingId && header.recordSize == sizeof(LogCheckedRecord)) {
+		memcpy(readingId, raw + offsetof(LogCheckedRecord, sequence), sizeof(*readingId));
+	} else if (readingId) {
+		*readingId = header.firstReadingId + (position - header.headerSize) / header.recordSize;
+	}
+	return true;
+}
+
+// Read the next record. Newer record versions only append fields, so the
+// common prefix is read and the rest skipped.
+bool readLogRecord(File &file, const LogFileHeader &header, LogRecord &record, uint32_t *readingId) {
+	uint8_t raw[LOG_MAX_RECORD_SIZE];
+	if (!readRawRecord(file, header, raw, readingId)) {
+		return false;
+	}
+	memcpy(&record, raw, sizeof(LogRecord));
+	return true;
+}
+
+// Read the next record as an aggregate. A raw sample is an aggregate of
+// one sample with seconds = 0.
+bool readLogAggregate(File &file, const LogFileHeader &header, LogAggregateRecord &record, uint32_t *readingId) {
+	uint8_t raw[LOG_MAX_RECORD_SIZE];
+	if (!readRawRecord(file, header, raw, readingId)) {
+		return false;
+	}
+	memcpy(&record.sample, raw, sizeof(LogRecord));
+	if ((record.sample.flags & LOG_FLAG_AGGREGATE) && header.recordSize >= sizeof(LogAggregateRecord)) {
+		memcpy(&record, raw, sizeof(LogAggregateRecord));
+	} else {
+		record.minCentiPsi = record.sample.centiPsi;
+		record.maxCentiPsi = record.sample.centiPsi;
+		record.count = 1;
+		record.seconds = 0;
+	}
+	return true;
+}
+
+// Read the newest record without moving the file position
+bool readLastLogRecord(File &file, const LogFileHeader &header, LogRecord &record) {
+	uint32_t count = logRecordCount(file, header);
+	size_t position = file.position();
+	bool found = count > 0 && file.seek(header.headerSize + (count - 1) * header.recordSize) &&
+							 readLogRecord(file, header, record);
+	file.seek(position);
+	return found;
+}
+
+// Fill in the summary of a finished daily log
+bool writeLogSummary(fs::FS &fs, const char *path, uint32_t closedAt) {
+	File file = fs.open(path, "r+");
+	if (!file) {
+		return false;
+	}
+	LogFileHeader header;
+	if (!readLogHeader(file, header)) {
+		file.close();
+		return false;
+	}
+
+	LogDaySummary summary;
+	memset(&summary, 0, sizeof(summary));
+	summary.closedAt = closedAt;
+	summary.minCentiPsi = INT16_MAX;
+	summary.maxCentiPsi = INT16_MIN;
+	int64_t sum = 0;
+	LogRecord record;
+	while (readLogRecord(file, header, record)) {
+		summary.recordCount++;
+		if ((record.flags & LOG_FLAG_OUT_OF_BAND) && summary.outOfBandCount < UINT16_MAX) {
+			summary.outOfBandCount++;
+		}
+		summary.minCentiPsi = min(summary.minCentiPsi, record.centiPsi);
+		summary.maxCentiPsi = max(summary.maxCentiPsi, record.centiPsi);
+		sum += record.centiPsi;
+	}
+	if (summary.recordCount == 0) {
+		summary.minCentiPsi = 0;
+		summary.maxCentiPsi = 0;
+	} else {
+		summary.meanCentiPsi = sum / summary.recordCount;
+	}
+
+	bool written = file.seek(offsetof(LogFileHeader, summary)) &&
+								 file.write((const uint8_t *)&summary, sizeof(summary)) == sizeof(summary);
+	file.close();
+	return written;
+}
+
+// Format a record the way logData() wrote the original text logs:
+// readingID,YYYY-MM-DD,HH:MM:SS,psi,zone,avg
+size_t formatLogRecordCsv(const LogRecord &record, uint32_t readingId, char *buffer, size_t size) {
+	time_t epoch = record.epoch;
+	struct tm timeinfo;
+	gmtime_r(&epoch, &timeinfo);
+
+	int len = snprintf(buffer, size, "%lu,%04d-%02d-%02d,%02d:%02d:%02d,%.2f,%u,%u\r\n",
+										 (unsigned long)readingId, timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+										 timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+										 record.centiPsi / 100.0f, record.zone, record.avgPsi);
+	return len < 0 ? 0 : min((size_t)len, size - 1);
+}
+
+LogFormat parseLogFormat(const String &name) {
+	if (name == "bin") return LOG_FORMAT_BIN;
+	if (name == "json") return LOG_FORMAT_JSON;
+	return LOG_FORMAT_CSV;
+}
+
+bool beginLogRender(LogRenderState &state, File file, LogFormat format) {
+	state.file = file;
+	state.format = format;
+	state.index = 0;
+	state.rendered = 0;
+	state.toEpoch = UINT32_MAX;
+	state.textLen = 0;
+	state.textPos = 0;
+	state.opened = false;
+	state.closed = false;
+	if (!readLogHeader(state.file, state.header)) {
+		return false;
+	}
+	// The binary form is the file as stored, header included
+	return format != LOG_FORMAT_BIN || file.seek(0);
+}
+
+// Fill data with up to len bytes of the converted log. Returns 0 when done.
+size_t renderLogRecords(LogRenderState &state, uint8_t *data, size_t len) {
+	if (state.format == LOG_FORMAT_BIN) {
+		return state.file.read(data, len);
+	}
+
+	size_t out = 0;
+	while (out < len) {
+		// Send what is left of the last rendered record first
+		if (state.textPos < state.textLen) {
+			size_t n = min((size_t)(state.textLen - state.textPos), len - out);
+			memcpy(data + out, state.text + state.textPos, n);
+			state.textPos += n;
+			out += n;
+			continue;
+		}
+
+		size_t textLen = 0;
+		LogRecord record;
+		uint32_t readingId;
+		if (state.format == LOG_FORMAT_JSON && !state.opened) {
+			state.text[0] = '[';
+			textLen = 1;
+			state.opened = true;
+		} else if (readLogRecord(state.file, state.header, record, &readingId) && record.epoch <= state.toEpoch) {
+			if (state.format == LOG_FORMAT_JSON) {
+				int n = snprintf(state.text, sizeof(state.text), "%s{\"id\":%lu,\"t\":%lu,\"psi\":%.2f,\"zone\":%u,\"avg\":%u,\"flags\":%u}",
+												 state.rendered ? "," : "", (unsigned long)readingId, (unsigned long)record.epoch,
+												 record.centiPsi / 100.0f, record.zone, record.avgPsi, record.flags);
+				textLen = n < 0 ? 0 : min((size_t)n, sizeof(state.text) - 1);
+			} else {
+				textLen = formatLogRecordCsv(record, readingId, state.text, sizeof(state.text));
+			}
+			state.index++;
+			state.rendered++;
+		} else if (state.format == LOG_FORMAT_JSON && !state.closed) {
+			state.text[0] = ']';
+			textLen = 1;
+			state.closed = true;
+		} else {
+			break;	// All records sent
+		}
+		state.textLen = textLen;
+		state.textPos = 0;
+	}
+	return out;
+}
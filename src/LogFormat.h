@@ -0,0 +1,113 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define LOG_MAGIC "WPLG"
+#define LOG_VERSION 3
+#define LOG_HEADER_V1_SIZE 32		// Header of version 1 files, without recordCount
+#define LOG_EXTENSION ".bin"
+#define LOG_MAX_RECORD_SIZE 32	// Largest record of any version
+
+// Record flags
+#define LOG_FLAG_OUT_OF_BAND 0x01	 // Pressure more than 2 PSI from the zone's average
+#define LOG_FLAG_AGGREGATE 0x02		 // Record is a LogAggregateRecord of a compacted day
+
+// Totals of a finished log day, written into the header when the day closes
+struct LogDaySummary {
+	uint32_t closedAt;				 // Local time the day was closed, 0 = still open
+	uint32_t recordCount;
+	uint16_t outOfBandCount;	 // Records with LOG_FLAG_OUT_OF_BAND
+	int16_t minCentiPsi;
+	int16_t maxCentiPsi;
+	int16_t meanCentiPsi;
+} __attribute__((packed));
+
+// Header at the start of every binary daily log file
+struct LogFileHeader {
+	char magic[4];						 // LOG_MAGIC
+	uint8_t version;					 // LOG_VERSION
+	uint8_t recordSize;				 // Bytes per record
+	uint16_t headerSize;			 // Bytes before the first record
+	uint32_t dayStart;				 // Local time of the first second of the log day
+	uint32_t firstReadingId;	 // readingID of the first record
+	LogDaySummary summary;		 // Zero until the day is closed
+	// Version 2: records written so far. The file may be longer, the space
+	// after the records is reserved for the rest of the day.
+	uint32_t recordCount;
+} __attribute__((packed));
+
+// One logged sample, fixed width
+struct LogRecord {
+	uint32_t epoch;		 // Local time of the sample
+	int16_t centiPsi;	 // Pressure in hundredths of a PSI
+	uint8_t zone;			 // Active zone number, 0 = all off
+	uint8_t avgPsi;		 // Expected pressure of the active zone
+	uint8_t flags;		 // LOG_FLAG_* bits
+	uint8_t zoneRow;	 // Row of the zone table running, 0 = all off or logged by older firmware
+} __attribute__((packed));
+
+// A sample as the logger stores it from version 3 on: the record, its
+// readingID and a CRC of both, so a record torn by a power cut is found
+// and the readingID can be restored from the log at boot
+struct LogCheckedRecord {
+	LogRecord record;
+	uint32_t sequence;	 // readingID
+	uint16_t crc;				 // CRC-16/CCITT of record and sequence
+} __attribute__((packed));
+
+// Samples of one interval of a compacted daily log. It starts with the
+// LogRecord fields, so readers that only know LogRecord see the mean as a
+// sample at the time of the first one.
+struct LogAggregateRecord {
+	LogRecord sample;		 // Mean pressure, flags of every sample and LOG_FLAG_AGGREGATE
+	int16_t minCentiPsi;
+	int16_t maxCentiPsi;
+	uint16_t count;			 // Samples in the interval
+	uint16_t seconds;		 // Length of the interval, 0 for a raw sample
+} __attribute__((packed));
+
+// Output forms of a daily log
+enum LogFormat : uint8_t {
+	LOG_FORMAT_CSV,		// readingID,YYYY-MM-DD,HH:MM:SS,psi,zone,avg lines
+	LOG_FORMAT_JSON,	// Array of {"id","t","psi","zone","avg","flags"} objects
+	LOG_FORMAT_BIN,		// The file as stored
+};
+
+// Progress of converting one log file for a chunked response
+struct LogRenderState {
+	File file;
+	LogFileHeader header;
+	LogFormat format;
+	uint32_t index;			 // Next record to render
+	uint32_t rendered;	 // Records rendered so far
+	uint32_t toEpoch;		 // Stop after the last record at or before this time
+	char text[80];			 // Rendered text not yet sent
+	uint8_t textLen;
+	uint8_t textPos;
+	bool opened;				 // JSON "[" sent
+	bool closed;				 // JSON "]" sent
+};
+
+// Function prototypes
+bool isBinaryLog(const String &fileName);
+bool writeLogHeader(File &file, uint32_t dayStart, uint32_t firstReadingId);
+bool readLogHeader(File &file, LogFileHeader &header);
+uint32_t logRecordCount(File &file, const LogFileHeader &header);
+uint32_t logDataSize(File &file, const LogFileHeader &header);
+bool setLogRecordCount(File &file, const LogFileHeader &header, uint32_t count);
+void sealLogRecord(LogCheckedRecord &checked, const LogRecord &record, uint32_t sequence);
+bool isLogRecordIntact(const LogCheckedRecord &checked);
+uint32_t recoverLogRecordCount(File &file, const LogFileHeader &header, uint8_t window, LogCheckedRecord &last,
+															 bool &haveLast);
+bool readLogRecord(File &file, const LogFileHeader &header, LogRecord &record, uint32_t *readingId = nullptr);
+bool readLogAggregate(File &file, const LogFileHeader &header, LogAggregateRecord &record, uint32_t *readingId = nullptr);
+bool readLastLogRecord(File &file, const LogFileHeader &header, LogRecord &record);
+bool writeLogSummary(fs::FS &fs, const char *path, uint32_t closedAt);
+size_t formatLogRecordCsv(const LogRecord &record, uint32_t readingId, char *buffer, size_t size);
+LogFormat parseLogFormat(const String &name);
+bool beginLogRender(LogRenderState &state, File file, LogFormat format);
+size_t renderLogRecords(LogRenderState &state, uint8_t *data, size_t len);
+
+#endif	// LOG_FORMAT_H
@@ -0,0 +1,137 @@
+#include "LogIndex.h"
+
+// Minute of the log day a record belongs to, late records count as the last minute
+static uint32_t logMinute(uint32_t dayStart, uint32_t epoch) {
+	if (epoch < dayStart) {
+		return 0;
+	}
+	return min((epoch - dayStart) / 60, (uint32_t)LOG_INDEX_MINUTES - 1);
+}
+
+String logIndexPath(const String &logPath) {
+	return logPath.substring(0, logPath.lastIndexOf('.')) + LOG_INDEX_EXTENSION;
+}
+
+// Write the entries of records [firstRecord, firstRecord + count) after they
+// were appended to the log. The index is only extended if it covers exactly
+// the records before them, otherwise it is rebuilt from the log.
+bool updateLogIndex(fs::FS &fs, const char *logPath, uint32_t dayStart, uint32_t firstRecord,
+										const LogCheckedRecord *records, uint32_t count) {
+	String indexPath = logIndexPath(logPath);
+	File file = fs.open(indexPath, "r+");
+	if (!file) {
+		return rebuildLogIndex(fs, logPath);
+	}
+
+	LogIndexHeader header;
+	size_t size = file.size();
+	bool valid = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+							 memcmp(header.magic, LOG_INDEX_MAGIC, 4) == 0 && header.recordCount == firstRecord &&
+							 (size - sizeof(header)) % sizeof(uint32_t) == 0;
+	if (!valid) {
+		file.close();
+		return rebuildLogIndex(fs, logPath);
+	}
+
+	// Entries are added for every minute up to the one of the newest record
+	uint32_t minutes = (size - sizeof(header)) / sizeof(uint32_t);
+	bool written = file.seek(size);
+	for (uint32_t i = 0; i < count && written; i++) {
+		uint32_t recordIndex = firstRecord + i;
+		for (uint32_t minute = logMinute(dayStart, records[i].record.epoch); minutes <= minute && written; minutes++) {
+			written = file.write((const uint8_t *)&recordIndex, sizeof(recordIndex)) == sizeof(recordIndex);
+		}
+	}
+
+	// The count goes last, so an update cut short by a reset is detected
+	header.recordCount = firstRecord + count;
+	written = written && file.seek(0) && file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+	file.close();
+	return written;
+}
+
+// Recreate the index of a log by reading every record
+bool rebuildLogIndex(fs::FS &fs, const char *logPath) {
+	File log = fs.open(logPath, FILE_READ);
+	if (!log) {
+		return false;
+	}
+	LogFileHeader logHeader;
+	if (!readLogHeader(log, logHeader)) {
+		log.close();
+		return false;
+	}
+	File file = fs.open(logIndexPath(logPath), FILE_WRITE);
+	if (!file) {
+		log.close();
+		return false;
+	}
+
+	LogIndexHeader header;
+	memcpy(header.magic, LOG_INDEX_MAGIC, 4);
+	header.recordCount = 0;
+	bool written = file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+
+	uint32_t minutes = 0;
+	LogRecord record;
+	while (written && readLogRecord(log, logHeader, record)) {
+		for (uint32_t minute = logMinute(logHeader.dayStart, record.epoch); minutes <= minute && written; minutes++) {
+			written = file.write((const uint8_t *)&header.recordCount, sizeof(uint32_t)) == sizeof(uint32_t);
+		}
+		header.recordCount++;
+	}
+	log.close();
+
+	written = written && file.seek(0) && file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+	file.close();
+	Serial.printf("Rebuilt index of %s: %lu records, %lu minutes\n", logPath, (unsigned long)header.recordCount,
+								(unsigned long)minutes);
+	return written;
+}
+
+// Read the index entry for a minute. Returns false if the index is missing,
+// damaged or doesn't cover that minute.
+static bool readIndexEntry(fs::FS &fs, const char *logPath, uint32_t recordCount, uint32_t minute, uint32_t &recordIndex) {
+	File file = fs.open(logIndexPath(logPath), FILE_READ);
+	if (!file) {
+		return false;
+	}
+	LogIndexHeader header;
+	bool valid = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+							 memcmp(header.magic, LOG_INDEX_MAGIC, 4) == 0 && header.recordCount <= recordCount;
+	uint32_t minutes = (file.size() - sizeof(header)) / sizeof(uint32_t);
+	if (valid && minute >= minutes) {
+		// Past the last indexed minute, so after every indexed record
+		recordIndex = header.recordCount;
+	} else if (valid) {
+		valid = file.seek(sizeof(header) + minute * sizeof(uint32_t)) &&
+						file.read((uint8_t *)&recordIndex, sizeof(recordIndex)) == sizeof(recordIndex) &&
+						recordIndex <= header.recordCount;
+	}
+	file.close();
+	return valid;
+}
+
+// Position file at the first record at or after epoch and return its index.
+// The index sidecar gets the read to the right minute, the rest is a short
+// scan. A missing or damaged index is rebuilt first.
+uint32_t findLogRecord(fs::FS &fs, const char *logPath, File &file, const LogFileHeader &header, uint32_t epoch) {
+	uint32_t recordCount = logRecordCount(file, header);
+	uint32_t minute = logMinute(header.dayStart, epoch);
+	uint32_t recordIndex = 0;
+	if (!readIndexEntry(fs, logPath, recordCount, minute, recordIndex) &&
+			!(rebuildLogIndex(fs, logPath) && readIndexEntry(fs, logPath, recordCount, minute, recordIndex))) {
+		recordIndex = 0;	// No index, scan from the start
+	}
+
+	file.seek(header.headerSize + recordIndex * header.recordSize);
+	LogRecord record;
+	while (recordIndex < recordCount && readLogRecord(file, header, record)) {
+		if (record.epoch >= epoch) {
+			break;
+		}
+		recordIndex++;
+	}
+	file.seek(header.headerSize + recordIndex * header.recordSize);
+	return recordIndex;
+}
@@ -0,0 +1,27 @@
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "LogFormat.h"
+
+#define LOG_INDEX_MAGIC "WPIX"
+#define LOG_INDEX_EXTENSION ".idx"
+#define LOG_INDEX_MINUTES 1440	// One entry per minute of the log day
+
+// Header of the index sidecar of a daily log (YYYYMMDD.idx next to YYYYMMDD.bin).
+// It is followed by one uint32_t per minute of the log day: the index of the
+// first record logged in that minute or later.
+struct LogIndexHeader {
+	char magic[4];					// LOG_INDEX_MAGIC
+	uint32_t recordCount;		// Records of the log covered by the entries
+} __attribute__((packed));
+
+// Function prototypes
+String logIndexPath(const String &logPath);
+bool updateLogIndex(fs::FS &fs, const char *logPath, uint32_t dayStart, uint32_t firstRecord,
+										const LogCheckedRecord *records, uint32_t count);
+bool rebuildLogIndex(fs::FS &fs, const char *logPath);
+uint32_t findLogRecord(fs::FS &fs, const char *logPath, File &file, const LogFileHeader &header, uint32_t epoch);
+
+#endif	// LOG_INDEX_H
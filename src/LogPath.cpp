@@ -0,0 +1,190 @@
+#include "LogPath.h"
+#include "LogArchive.h"
+#include "LogDirectory.h"
+#include "LogFormat.h"
+#include "LogIndex.h"
+#include "SdCardUtils.h"
+
+// Background move of the legacy root files, see migrateLogSlice()
+static File migrationRoot;
+static bool migrationDone = false;
+static uint16_t migratedFiles = 0;
+
+static const char *baseName(const char *path) {
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+// Digits before the extension of a daily file name: 6 for DDMMYY, 8 for
+// YYYYMMDD, 0 if it is not one
+static uint8_t dateDigits(const char *name) {
+	uint8_t n = 0;
+	while (n < 9 && isdigit((unsigned char)name[n])) {
+		n++;
+	}
+	return (n == 6 || n == 8) && name[n] == '.' ? n : 0;
+}
+
+static uint32_t digitsValue(const char *text, uint8_t count) {
+	uint32_t value = 0;
+	while (count--) {
+		value = value * 10 + *text++ - '0';
+	}
+	return value;
+}
+
+// YYYYMMDD of a daily file name ("20250101.bin", or the legacy "010125.bin"),
+// 0 for other names
+uint32_t logDateKey(const char *name) {
+	name = baseName(name);
+	uint32_t year, month, day;
+	switch (dateDigits(name)) {
+		case 6:
+			day = digitsValue(name, 2);
+			month = digitsValue(name + 2, 2);
+			year = 2000 + digitsValue(name + 4, 2);
+			break;
+		case 8:
+			year = digitsValue(name, 4);
+			month = digitsValue(name + 4, 2);
+			day = digitsValue(name + 6, 2);
+			break;
+		default:
+			return 0;
+	}
+	if (day < 1 || day > 31 || month < 1 || month > 12) {
+		return 0;
+	}
+	return year * 10000 + month * 100 + day;
+}
+
+// "20250101" + extension
+String logDayName(uint32_t dateKey, const char *extension) {
+	char name[24];
+	snprintf(name, sizeof(name), "%08lu%s", (unsigned long)dateKey, extension);
+	return String(name);
+}
+
+// "/log/2025/01/20250101.bin" for a daily file name in either form, empty
+// for other names
+String logDayPath(const String &name) {
+	const char *base = baseName(name.c_str());
+	uint32_t key = logDateKey(base);
+	if (key == 0) {
+		return String();
+	}
+	char path[40];
+	snprintf(path, sizeof(path), LOG_ROOT "/%04lu/%02lu/%08lu%s", (unsigned long)(key / 10000),
+					 (unsigned long)(key / 100 % 100), (unsigned long)key, base + dateDigits(base));
+	return String(path);
+}
+
+// Root path of the legacy DDMMYY name of a day
+static String legacyLogPath(uint32_t dateKey, const char *extension) {
+	char path[24];
+	snprintf(path, sizeof(path), "/%02lu%02lu%02lu%s", (unsigned long)(dateKey % 100), (unsigned long)(dateKey / 100 % 100),
+					 (unsigned long)(dateKey / 10000 % 100), extension);
+	return String(path);
+}
+
+// SD path of a file named by a client: a daily file in either form, or a
+// file of the root such as "location.txt". Until the migration is done a day
+// that has not been moved yet resolves to its legacy root file. Call it
+// inside an SD job.
+String resolveLogPath(fs::FS &fs, const String &name) {
+	String path = logDayPath(name);
+	if (path.length() == 0) {
+		return name.startsWith("/") ? name : "/" + name;
+	}
+	if (!migrationDone && !fs.exists(path)) {
+		const char *base = baseName(path.c_str());
+		String legacy = legacyLogPath(logDateKey(base), base + 8);
+		if (fs.exists(legacy)) {
+			return legacy;
+		}
+	}
+	return path;
+}
+
+// Create the year and month directories of a daily file path
+bool makeLogDayDir(fs::FS &fs, const String &path) {
+	int slash = 0;
+	while ((slash = path.indexOf('/', slash + 1)) > 0) {
+		String dir = path.substring(0, slash);
+		if (!fs.exists(dir) && !fs.mkdir(dir)) {
+			Serial.println("Failed to create directory " + dir);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Move one legacy root file to its place under LOG_ROOT and update the
+// directory index
+static void migrateFile(fs::FS &fs, const String &legacyPath) {
+	// An archive that was being written when the ESP32 reset is never finished
+	if (legacyPath.endsWith(".tmp")) {
+		fs.remove(legacyPath);
+		return;
+	}
+	String path = logDayPath(legacyPath);
+	if (fs.exists(path)) {
+		Serial.printf("%s already exists, %s is left in the root\n", path.c_str(), legacyPath.c_str());
+		return;
+	}
+	if (!makeLogDayDir(fs, path) || !fs.rename(legacyPath, path)) {
+		Serial.printf("Failed to move %s to %s\n", legacyPath.c_str(), path.c_str());
+		return;
+	}
+	removeFromLogDirectory(legacyPath.c_str());
+	updateLogDirectory(fs, path.c_str());
+	migratedFiles++;
+}
+
+// Move the legacy files of one day right away, for the day about to be
+// logged to. Call it inside an SD job.
+void migrateLogDay(fs::FS &fs, const String &path) {
+	if (migrationDone) {
+		return;
+	}
+	static const char *const extensions[] = {LOG_EXTENSION, ".txt", LOG_INDEX_EXTENSION, LOG_ARCHIVE_EXTENSION};
+	uint32_t key = logDateKey(path.c_str());
+	for (const char *extension : extensions) {
+		String legacy = legacyLogPath(key, extension);
+		if (fs.exists(legacy)) {
+			migrateFile(fs, legacy);
+		}
+	}
+}
+
+// Do one slice of the move of legacy DDMMYY.* files out of the SD root:
+// look at the next LOG_MIGRATE_BATCH root entries in one short SD job. The
+// root stays open between slices. Returns true while there is more to do.
+bool migrateLogSlice(fs::FS &fs) {
+	if (migrationDone) {
+		return false;
+	}
+	sdRun(SD_PRIORITY_BACKGROUND, [&]() {
+		if (!migrationRoot) {
+			migrationRoot = fs.open("/");
+		}
+		for (uint8_t i = 0; i < LOG_MIGRATE_BATCH && !migrationDone; i++) {
+			File file = migrationRoot ? migrationRoot.openNextFile() : File();
+			if (!file) {
+				migrationRoot.close();
+				migrationDone = true;
+				break;
+			}
+			String path = String("/") + baseName(file.name());
+			bool legacy = !file.isDirectory() && dateDigits(path.c_str() + 1) == 6 && logDateKey(path.c_str());
+			file.close();
+			if (legacy) {
+				migrateFile(fs, path);
+			}
+		}
+	});
+	if (migrationDone && migratedFiles > 0) {
+		Serial.printf("Moved %u daily files to " LOG_ROOT "\n", migratedFiles);
+	}
+	return !migrationDone;
+}
@@ -0,0 +1,25 @@
+#ifndef LOG_PATH_H
+#define LOG_PATH_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define LOG_ROOT "/log"
+#define LOG_MIGRATE_BATCH 8		// Root entries looked at per migration slice
+
+// Daily logs and their index and archive are stored as
+// /log/YYYY/MM/YYYYMMDD.bin, .idx and .csv.gz, so opening a day never scans
+// a directory of more than a month of files. Older firmware kept them in the
+// SD root as DDMMYY.*; those are moved in the background after boot, and
+// both forms of a day's name are accepted by the web endpoints.
+
+// Function prototypes
+uint32_t logDateKey(const char *name);
+String logDayName(uint32_t dateKey, const char *extension);
+String logDayPath(const String &name);
+String resolveLogPath(fs::FS &fs, const String &name);
+bool makeLogDayDir(fs::FS &fs, const String &path);
+void migrateLogDay(fs::FS &fs, const String &path);
+bool migrateLogSlice(fs::FS &fs);
+
+#endif	// LOG_PATH_H
@@ -0,0 +1,125 @@
+#include "LogRange.h"
+#include "LogIndex.h"
+
+// Open a daily log and seek to the start of the window. A window of
+// from = 0, to = UINT32_MAX covers the whole file.
+bool beginRangeQuery(RangeQueryState &state, fs::FS &fs, const char *logPath, uint32_t from, uint32_t to, uint16_t points) {
+	state.file = fs.open(logPath, FILE_READ);
+	if (!state.file) {
+		return false;
+	}
+	if (!readLogHeader(state.file, state.header)) {
+		state.file.close();
+		return false;
+	}
+
+	// Clip the window to the records in the file
+	uint32_t recordCount = logRecordCount(state.file, state.header);
+	LogRecord first;
+	LogRecord last;
+	if (recordCount > 0 && readLogRecord(state.file, state.header, first) &&
+			state.file.seek(state.header.headerSize + (recordCount - 1) * state.header.recordSize) &&
+			readLogRecord(state.file, state.header, last)) {
+		from = max(from, first.epoch);
+		to = min(to, last.epoch);
+	}
+
+	points = constrain(points, 2, RANGE_MAX_POINTS);
+	uint32_t buckets = points / 2;
+	state.from = from;
+	state.to = to;
+	state.bucketSeconds = to >= from ? (to - from) / buckets + 1 : 1;
+	state.haveBucket = false;
+	state.done = recordCount == 0 || to < from;
+	state.textLen = 0;
+	state.textPos = 0;
+	state.index = state.done ? 0 : findLogRecord(fs, logPath, state.file, state.header, from);
+	return true;
+}
+
+// Render the finished bucket into state.text
+static void renderBucket(RangeQueryState &state) {
+	const LogRecord *records[2] = {&state.minRecord, &state.maxRecord};
+	uint32_t readingIds[2] = {state.minReadingId, state.maxReadingId};
+	if (state.maxIndex < state.minIndex) {
+		std::swap(records[0], records[1]);
+		std::swap(readingIds[0], readingIds[1]);
+	}
+
+	size_t len = 0;
+	// One line for a single raw sample, two for an aggregate with a spread
+	uint8_t count = state.minIndex == state.maxIndex && state.minRecord.centiPsi == state.maxRecord.centiPsi ? 1 : 2;
+	for (uint8_t i = 0; i < count; i++) {
+		len += formatLogRecordCsv(*records[i], readingIds[i], state.text + len, sizeof(state.text) - len);
+	}
+	state.textLen = len;
+	state.textPos = 0;
+	state.haveBucket = false;
+}
+
+// Fill data with up to len bytes of downsampled CSV. Returns 0 when done.
+size_t renderRangeQuery(RangeQueryState &state, uint8_t *data, size_t len) {
+	size_t out = 0;
+	while (out < len) {
+		// Send what is left of the last rendered bucket first
+		if (state.textPos < state.textLen) {
+			size_t n = min((size_t)(state.textLen - state.textPos), len - out);
+			memcpy(data + out, state.text + state.textPos, n);
+			state.textPos += n;
+			out += n;
+			continue;
+		}
+		if (state.done) {
+			break;
+		}
+
+		// A compacted day's records carry the low and high of their interval
+		LogAggregateRecord aggregate;
+		const LogRecord &record = aggregate.sample;
+		uint32_t readingId;
+		if (!readLogAggregate(state.file, state.header, aggregate, &readingId) || record.epoch > state.to) {
+			state.done = true;
+			if (state.haveBucket) {
+				renderBucket(state);
+			}
+			continue;
+		}
+
+		if (record.epoch < state.from) {
+			state.index++;	// Out of order, before the window
+			continue;
+		}
+
+		uint32_t bucket = (record.epoch - state.from) / state.bucketSeconds;
+		if (state.haveBucket && bucket != state.bucket) {
+			renderBucket(state);
+		}
+		LogRecord low = record;
+		LogRecord high = record;
+		low.centiPsi = aggregate.minCentiPsi;
+		high.centiPsi = aggregate.maxCentiPsi;
+		if (!state.haveBucket) {
+			state.haveBucket = true;
+			state.bucket = bucket;
+			state.minRecord = low;
+			state.maxRecord = high;
+			state.minIndex = state.index;
+			state.maxIndex = state.index;
+			state.minReadingId = readingId;
+			state.maxReadingId = readingId;
+		} else {
+			if (low.centiPsi < state.minRecord.centiPsi) {
+				state.minRecord = low;
+				state.minIndex = state.index;
+				state.minReadingId = readingId;
+			}
+			if (high.centiPsi > state.maxRecord.centiPsi) {
+				state.maxRecord = high;
+				state.maxIndex = state.index;
+				state.maxReadingId = readingId;
+			}
+		}
+		state.index++;
+	}
+	return out;
+}
@@ -0,0 +1,39 @@
+#ifndef LOG_RANGE_H
+#define LOG_RANGE_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "LogFormat.h"
+
+#define RANGE_DEFAULT_POINTS 500	// Points returned when the client doesn't ask for a number
+#define RANGE_MAX_POINTS 4000
+
+// Progress of a downsampled range read for a chunked response. The window is
+// split into equal time buckets and each bucket is sent as its lowest and
+// highest record, in time order, as the same CSV lines /get-data-file sends.
+struct RangeQueryState {
+	File file;
+	LogFileHeader header;
+	uint32_t from;					// First second of the window
+	uint32_t to;						// Last second of the window
+	uint32_t bucketSeconds;
+	uint32_t index;					// Next record to read
+	uint32_t bucket;				// Bucket of minRecord/maxRecord
+	bool haveBucket;
+	bool done;
+	LogRecord minRecord;
+	LogRecord maxRecord;
+	uint32_t minIndex;
+	uint32_t maxIndex;
+	uint32_t minReadingId;
+	uint32_t maxReadingId;
+	char text[160];					// Rendered lines not yet sent
+	uint8_t textLen;
+	uint8_t textPos;
+};
+
+// Function prototypes
+bool beginRangeQuery(RangeQueryState &state, fs::FS &fs, const char *logPath, uint32_t from, uint32_t to, uint16_t points);
+size_t renderRangeQuery(RangeQueryState &state, uint8_t *data, size_t len);
+
+#endif	// LOG_RANGE_H
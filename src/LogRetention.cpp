@@ -0,0 +1,319 @@
+#include "LogRetention.h"
+#include "LogArchive.h"
+#include "LogDirectory.h"
+#include "LogFormat.h"
+#include "LogIndex.h"
+#include "LogPath.h"
+#include "SdCardUtils.h"
+#include <vector>
+
+// Settings and pass requests come from the web server task, the pass itself
+// runs on the SD writer task. They meet only here, under retentionMux.
+static portMUX_TYPE retentionMux = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t rawDays = RETENTION_RAW_DAYS;
+static uint16_t minuteDays = RETENTION_MINUTE_DAYS;
+static bool passRequested = false;
+static uint32_t requestedNow;
+static RetentionStats stats;
+
+// The pass in progress, only touched by the SD writer task
+static bool passActive = false;
+static uint32_t passNow;				// Local time the pass started
+static uint16_t passRawDays;		// Tiers the pass was started with
+static uint16_t passMinuteDays;
+static uint32_t passKey;				// Last day looked at
+static uint32_t passBytes;
+
+// The day being compacted
+static bool compacting = false;
+static char compactPath[32];
+static File compactIn;
+static File compactOut;
+static LogFileHeader compactHeader;
+static uint32_t compactSize;			// Size of the log before compaction
+static uint16_t compactSeconds;	// Interval of the new records
+static LogAggregateRecord bucket;
+static bool haveBucket;
+static uint32_t bucketStart;
+static uint32_t bucketsWritten;
+static uint32_t bucketCount;		// Samples in bucket, not capped like bucket.count
+static int64_t bucketSum;				// Sum of their pressures
+
+// New tiers take effect with the next pass
+void setLogRetention(uint16_t raw, uint16_t minute) {
+	raw = max(raw, (uint16_t)RETENTION_MIN_RAW_DAYS);
+	portENTER_CRITICAL(&retentionMux);
+	rawDays = raw;
+	minuteDays = max(minute, raw);
+	portEXIT_CRITICAL(&retentionMux);
+}
+
+// Look at every closed day once more. Called at boot and after each rollover,
+// from any task; the pass starts on the next compactLogSlice() call that
+// doesn't find one running.
+void startRetentionPass(uint32_t now) {
+	portENTER_CRITICAL(&retentionMux);
+	passRequested = true;
+	requestedNow = now;
+	portEXIT_CRITICAL(&retentionMux);
+}
+
+// Start the requested pass, if there is one
+static bool beginPass() {
+	portENTER_CRITICAL(&retentionMux);
+	bool requested = passRequested;
+	passRequested = false;
+	passNow = requestedNow;
+	passRawDays = rawDays;
+	passMinuteDays = minuteDays;
+	passActive = requested;
+	portEXIT_CRITICAL(&retentionMux);
+	passKey = 0;
+	passBytes = 0;
+	return requested;
+}
+
+// Interval a day should be stored at, 0 to keep its raw samples
+static uint16_t targetSeconds(const LogDirEntry &entry) {
+	uint32_t ageDays = passNow > entry.lastEpoch ? (passNow - entry.lastEpoch) / 86400UL : 0;
+	if (ageDays >= passMinuteDays) {
+		return 3600;
+	}
+	return ageDays >= passRawDays ? 60 : 0;
+}
+
+static void endPass() {
+	portENTER_CRITICAL(&retentionMux);
+	passActive = false;
+	stats.passes++;
+	stats.lastPassBytes = passBytes;
+	portEXIT_CRITICAL(&retentionMux);
+	if (passBytes > 0) {
+		Serial.printf("Retention pass done, %lu bytes reclaimed\n", (unsigned long)passBytes);
+	}
+}
+
+// Open the next day due for a coarser tier and its temporary copy
+static bool startCompaction(fs::FS &fs) {
+	while (passActive) {
+		LogDirEntry entry;
+		if (!nextLogDirEntry(passKey, entry)) {
+			endPass();
+			return false;
+		}
+		passKey = entry.dateKey;
+		if (entry.records == 0 || entry.lastEpoch == 0) {
+			continue;
+		}
+		uint16_t seconds = targetSeconds(entry);
+		if (seconds == 0) {
+			endPass();	// Every later day is younger
+			return false;
+		}
+		// Days already at that interval or sampled more slowly have nothing to gain
+		uint32_t interval = entry.records > 1 ? (entry.lastEpoch - entry.firstEpoch) / (entry.records - 1) : 86400;
+		if (entry.step >= seconds || interval >= seconds) {
+			continue;
+		}
+
+		String path = logDayPath(entry.name);
+		bool opened = false;
+		sdRun(SD_PRIORITY_BACKGROUND, [&]() {
+			compactIn = fs.open(path, FILE_READ);
+			if (!compactIn || !readLogHeader(compactIn, compactHeader)) {
+				compactIn.close();
+				return;
+			}
+			compactOut = fs.open(path + ".tmp", FILE_WRITE);
+			LogFileHeader header = compactHeader;
+			header.version = LOG_VERSION;
+			header.recordSize = sizeof(LogAggregateRecord);
+			header.headerSize = sizeof(LogFileHeader);
+			header.recordCount = 0;
+			if (!compactOut || compactOut.write((const uint8_t *)&header, sizeof(header)) != sizeof(header)) {
+				compactIn.close();
+				compactOut.close();
+				fs.remove(path + ".tmp");
+				return;
+			}
+			compactSize = compactIn.size();
+			opened = true;
+		});
+		if (!opened) {
+			Serial.printf("Failed to start compacting %s\n", path.c_str());
+			continue;
+		}
+		strlcpy(compactPath, path.c_str(), sizeof(compactPath));
+		compactSeconds = seconds;
+		haveBucket = false;
+		bucketsWritten = 0;
+		compacting = true;
+		return true;
+	}
+	return false;
+}
+
+// Write the finished bucket
+static bool flushBucket() {
+	haveBucket = false;
+	bucket.sample.centiPsi = bucketSum / (int64_t)bucketCount;
+	bucket.count = min(bucketCount, (uint32_t)UINT16_MAX);
+	bucketsWritten++;
+	return compactOut.write((const uint8_t *)&bucket, sizeof(bucket)) == sizeof(bucket);
+}
+
+// Add a raw sample or a finer aggregate to the buckets. A bucket is the
+// samples of one interval while one zone runs, so zone changes stay sharp.
+static bool addToBucket(const LogAggregateRecord &record) {
+	uint32_t start = record.sample.epoch - record.sample.epoch % compactSeconds;
+	bool written = true;
+	if (haveBucket && (start != bucketStart || record.sample.zone != bucket.sample.zone)) {
+		written = flushBucket();
+	}
+	if (!haveBucket) {
+		bucket = record;
+		bucket.sample.flags |= LOG_FLAG_AGGREGATE;
+		bucket.seconds = compactSeconds;
+		bucketStart = start;
+		bucketCount = record.count;
+		bucketSum = (int64_t)record.sample.centiPsi * record.count;
+		haveBucket = true;
+		return written;
+	}
+	bucket.sample.flags |= record.sample.flags;
+	bucket.minCentiPsi = min(bucket.minCentiPsi, record.minCentiPsi);
+	bucket.maxCentiPsi = max(bucket.maxCentiPsi, record.maxCentiPsi);
+	bucketCount += record.count;
+	bucketSum += (int64_t)record.sample.centiPsi * record.count;
+	return written;
+}
+
+// Do one slice of the retention pass: compact the next RETENTION_SLICE
+// records of the day being rewritten in one short SD job. The new file
+// replaces the log when it is complete; the day's index is rebuilt on its
+// next ranged read and its archive is dropped, the CSV is rendered from the
+// compacted log from then on. Returns true while there is more to do.
+bool compactLogSlice(fs::FS &fs) {
+	if (!compacting) {
+		return (passActive || beginPass()) && startCompaction(fs);
+	}
+
+	bool done = false;
+	bool ok = true;
+	uint32_t newSize = 0;
+	sdRun(SD_PRIORITY_BACKGROUND, [&]() {
+		String path = compactPath;
+		String tempPath = path + ".tmp";
+		LogAggregateRecord record;
+		uint16_t n = 0;
+		while (ok && n < RETENTION_SLICE && readLogAggregate(compactIn, compactHeader, record)) {
+			ok = addToBucket(record);
+			n++;
+		}
+		done = ok && n < RETENTION_SLICE;
+		if (done && haveBucket) {
+			ok = flushBucket();
+		}
+		if (done && ok) {
+			ok = compactOut.seek(offsetof(LogFileHeader, recordCount)) &&
+					 compactOut.write((const uint8_t *)&bucketsWritten, sizeof(bucketsWritten)) == sizeof(bucketsWritten);
+		}
+		if (done || !ok) {
+			newSize = compactOut.size();
+			compactIn.close();
+			compactOut.close();
+			// A reset between these two leaves the day in the .tmp file,
+			// recoverLogCompactions() finishes the swap at the next boot
+			bool removed = ok && fs.remove(path);
+			ok = removed && fs.rename(tempPath, path);
+			if (ok) {
+				fs.remove(logIndexPath(path));
+				fs.remove(logArchivePath(path));
+			} else if (!removed) {
+				fs.remove(tempPath);
+			}
+			updateLogDirectory(fs, compactPath);
+		}
+	});
+
+	if (done || !ok) {
+		compacting = false;
+		if (ok) {
+			uint32_t reclaimed = compactSize > newSize ? compactSize - newSize : 0;
+			passBytes += reclaimed;
+			portENTER_CRITICAL(&retentionMux);
+			stats.bytesReclaimed += reclaimed;
+			stats.daysCompacted++;
+			portEXIT_CRITICAL(&retentionMux);
+			Serial.printf("Compacted %s to %u s records, %lu -> %lu bytes\n", compactPath, compactSeconds,
+										(unsigned long)compactSize, (unsigned long)newSize);
+		} else {
+			Serial.printf("Failed to compact %s\n", compactPath);
+		}
+	}
+	return true;
+}
+
+static const char *baseName(const char *path) {
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+// Add the .bin.tmp files of a directory and of its subdirectories down to
+// depth more levels to temps
+static void findCompactionTemps(fs::FS &fs, const String &dirPath, uint8_t depth, std::vector<String> &temps) {
+	File dir = fs.open(dirPath);
+	File file = dir ? dir.openNextFile() : File();
+	while (file) {
+		String path = dirPath + "/" + baseName(file.name());
+		bool isDir = file.isDirectory();
+		// Close the entry first, only a few files can be open at a time
+		file.close();
+		if (isDir && depth > 0) {
+			findCompactionTemps(fs, path, depth - 1, temps);
+		} else if (!isDir && path.endsWith(LOG_EXTENSION ".tmp")) {
+			temps.push_back(path);
+		}
+		file = dir.openNextFile();
+	}
+}
+
+// Finish the compactions a reset cut short. The log is only removed once its
+// compacted copy is complete, so a YYYYMMDD.bin.tmp without its .bin is
+// renamed into place, and one whose .bin is still there is dropped. Call it
+// once at boot inside an SD job, before the log directory is built.
+void recoverLogCompactions(fs::FS &fs) {
+	std::vector<String> temps;
+	findCompactionTemps(fs, LOG_ROOT, 2, temps);	// YYYY/MM/
+	for (const String &tempPath : temps) {
+		String path = tempPath.substring(0, tempPath.length() - 4);
+		if (fs.exists(path)) {
+			fs.remove(tempPath);
+			Serial.printf("Dropped the unfinished compaction of %s\n", path.c_str());
+		} else if (fs.rename(tempPath, path)) {
+			fs.remove(logIndexPath(path));
+			fs.remove(logArchivePath(path));
+			Serial.printf("Finished the compaction of %s\n", path.c_str());
+		} else {
+			Serial.printf("Failed to restore %s from %s\n", path.c_str(), tempPath.c_str());
+		}
+	}
+}
+
+// {"rawDays","minuteDays","running","passes","daysCompacted","bytesReclaimed","lastPassBytes"}
+String retentionJson() {
+	portENTER_CRITICAL(&retentionMux);
+	uint16_t raw = rawDays;
+	uint16_t minute = minuteDays;
+	bool running = passActive || passRequested;
+	RetentionStats totals = stats;
+	portEXIT_CRITICAL(&retentionMux);
+
+	char json[192];
+	snprintf(json, sizeof(json),
+					 "{\"rawDays\":%u,\"minuteDays\":%u,\"running\":%s,\"passes\":%lu,\"daysCompacted\":%lu,"
+					 "\"bytesReclaimed\":%lu,\"lastPassBytes\":%lu}",
+					 raw, minute, running ? "true" : "false", (unsigned long)totals.passes,
+					 (unsigned long)totals.daysCompacted, (unsigned long)totals.bytesReclaimed, (unsigned long)totals.lastPassBytes);
+	return String(json);
+}
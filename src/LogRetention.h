@@ -0,0 +1,31 @@
+#ifndef LOG_RETENTION_H
+#define LOG_RETENTION_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define RETENTION_PATH "/retention.txt"
+#define RETENTION_RAW_DAYS 30				// Default days raw samples are kept
+#define RETENTION_MINUTE_DAYS 365		// Default days 1-minute aggregates are kept, hourly after that
+#define RETENTION_MIN_RAW_DAYS 2		// Yesterday is still being archived and rolled up
+#define RETENTION_SLICE 256					// Records compacted per SD job
+
+// Closed daily logs age through three tiers: raw samples, then one
+// LogAggregateRecord per minute (min, mean and max), then one per hour. A
+// pass walks the days from the oldest, rewriting each one that is due for a
+// coarser tier in short background SD jobs.
+struct RetentionStats {
+	uint32_t passes;						// Passes finished since boot
+	uint32_t daysCompacted;			// Days rewritten since boot
+	uint32_t bytesReclaimed;		// Bytes freed since boot
+	uint32_t lastPassBytes;			// Bytes freed by the last finished pass
+};
+
+// Function prototypes
+void setLogRetention(uint16_t rawDays, uint16_t minuteDays);
+void startRetentionPass(uint32_t now);
+bool compactLogSlice(fs::FS &fs);
+void recoverLogCompactions(fs::FS &fs);
+String retentionJson();
+
+#endif	// LOG_RETENTION_H
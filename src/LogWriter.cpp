@@ -0,0 +1,285 @@
+#include "LogWriter.h"
+#include <stddef.h>
+#include "LogIndex.h"
+#include "SdCardUtils.h"
+
+#define PENDING_MAGIC 0x57504C43	// "WPLC"
+
+// Records not yet on SD. Kept in RTC memory that is not cleared by a software,
+// watchdog or OTA reset, so they can be written after the restart.
+struct PendingLog {
+	uint32_t magic;
+	uint32_t checksum;
+	char path[32];						 // Daily log the records belong to
+	uint32_t dayStart;				 // For the header if the file is new
+	uint32_t firstReadingId;	 // readingID of records[0]
+	uint8_t count;
+	LogCheckedRecord records[LOG_BUFFER_RECORDS];
+};
+
+RTC_NOINIT_ATTR static PendingLog pending;
+
+static fs::FS *logFs = NULL;
+static SemaphoreHandle_t logMutex = NULL;
+static unsigned long oldestMillis = 0;
+static LogWriterStats stats;
+static LogRecord plainRecords[LOG_BUFFER_RECORDS];	// Records for a log of an older version
+
+static uint32_t pendingChecksum() {
+	const uint8_t *bytes = (const uint8_t *)&pending.path;
+	size_t len = offsetof(PendingLog, records) - offsetof(PendingLog, path) + pending.count * sizeof(LogCheckedRecord);
+	uint32_t sum = 0;
+	for (size_t i = 0; i < len; i++) {
+		sum = (sum << 1 | sum >> 31) ^ bytes[i];
+	}
+	return sum;
+}
+
+// Write the buffered records to their daily log. Caller holds logMutex, so
+// this must not be called from inside another SD job. If the SD task doesn't
+// take the job within wait the records stay buffered.
+static bool writePending(TickType_t wait = portMAX_DELAY) {
+	if (pending.count == 0) {
+		return true;
+	}
+	unsigned long startTime = micros();
+
+	bool written = false;
+	bool ran = sdRun(SD_PRIORITY_LOG, [&]() {
+		File file = logFs->open(pending.path, "r+");
+		if (!file) {
+			// No file was created for the day at rollover, start one without reserved space
+			createLogFile(*logFs, pending.path, pending.dayStart, pending.firstReadingId, 0);
+			file = logFs->open(pending.path, "r+");
+		}
+		LogFileHeader header;
+		bool opened = file && readLogHeader(file, header);
+		const uint8_t *records = (const uint8_t *)pending.records;
+		if (opened && header.recordSize == sizeof(LogRecord)) {
+			// A day started by older firmware keeps its record layout
+			for (uint8_t i = 0; i < pending.count; i++) {
+				plainRecords[i] = pending.records[i].record;
+			}
+			records = (const uint8_t *)plainRecords;
+		} else if (opened && header.recordSize != sizeof(LogCheckedRecord)) {
+			opened = false;
+		}
+		uint32_t firstRecord = 0;
+		if (opened) {
+			// Records go in place after the last one counted, inside the space
+			// reserved for the day, then the count is updated. Records written
+			// before a power cut but not counted are found by recoverLogTail().
+			firstRecord = logRecordCount(file, header);
+			size_t len = pending.count * header.recordSize;
+			written = file.seek(header.headerSize + firstRecord * header.recordSize) &&
+								file.write(records, len) == len &&
+								setLogRecordCount(file, header, firstRecord + pending.count);
+		}
+		file.close();
+
+		// The index only follows records that are on the card. If it can't be
+		// updated it is rebuilt when it is next read.
+		if (written) {
+			updateLogIndex(*logFs, pending.path, pending.dayStart, firstRecord, pending.records, pending.count);
+		}
+	}, wait);
+	if (!ran) {
+		return false;
+	}
+
+	uint32_t flushUs = micros() - startTime;
+	stats.lastFlushUs = flushUs;
+	stats.maxFlushUs = max(stats.maxFlushUs, flushUs);
+	stats.totalFlushUs += flushUs;
+	uint8_t bucket = 0;
+	for (uint32_t ms = flushUs / 1000; ms > 0 && bucket < LOG_FLUSH_BUCKETS - 1; ms >>= 1) {
+		bucket++;
+	}
+	stats.flushHistogram[bucket]++;
+	if (!written) {
+		stats.flushFailures++;
+		Serial.printf("Failed to flush %u records to %s\n", pending.count, pending.path);
+		return false;
+	}
+	stats.flushes++;
+	stats.recordsWritten += pending.count;
+
+	pending.count = 0;
+	pending.checksum = pendingChecksum();
+	return true;
+}
+
+// Create a daily log preallocated for reserveRecords records after its
+// header. The file is extended once, by seeking to its last byte, so the FAT
+// driver allocates the clusters of the day in one go and the flushes write
+// in place without touching the FAT. Where the clusters land is up to the
+// driver's allocator. Call it inside an SD job.
+bool createLogFile(fs::FS &fs, const char *path, uint32_t dayStart, uint32_t firstReadingId, uint32_t reserveRecords) {
+	File file = fs.open(path, FILE_WRITE);
+	if (!file) {
+		return false;
+	}
+	bool created = writeLogHeader(file, dayStart, firstReadingId);
+	if (created && reserveRecords > 0) {
+		uint8_t zero = 0;
+		if (!file.seek(sizeof(LogFileHeader) + reserveRecords * sizeof(LogCheckedRecord) - 1) || file.write(&zero, 1) != 1) {
+			Serial.printf("Failed to reserve space for %s\n", path);	// Flushes still grow the file
+		}
+	}
+	file.close();
+	return created;
+}
+
+// Give back the reserved space of a closed daily log. Call it inside an SD job.
+bool trimLogFile(fs::FS &fs, const char *path) {
+	File file = fs.open(path, FILE_READ);
+	LogFileHeader header;
+	if (!file || !readLogHeader(file, header)) {
+		return false;
+	}
+	uint32_t size = file.size();
+	uint32_t dataSize = logDataSize(file, header);
+	file.close();
+	return size <= dataSize || truncateSdFile(path, dataSize);
+}
+
+// True if the log at path is of a day before the one starting at dayStart
+// and was never closed, so its summary is still all zero. A reset across the
+// start of a log day leaves the previous day like that. Call it inside an
+// SD job.
+bool isLogLeftOpen(fs::FS &fs, const char *path, uint32_t dayStart) {
+	File file = fs.open(path, FILE_READ);
+	LogFileHeader header;
+	bool read = file && readLogHeader(file, header);
+	file.close();
+	LogDaySummary open;
+	memset(&open, 0, sizeof(open));
+	return read && header.dayStart < dayStart && memcmp(&header.summary, &open, sizeof(open)) == 0;
+}
+
+// Make the newest daily log consistent after a reset or power cut and find
+// the readingID to continue from. The count is corrected from the tail of
+// the file, see recoverLogRecordCount(), and a torn record at the end of a
+// file that has no reserved space is cut off. Call it inside an SD job.
+bool recoverLogTail(fs::FS &fs, const char *path, uint32_t &nextReadingId) {
+	File file = fs.open(path, "r+");
+	LogFileHeader header;
+	if (!file || !readLogHeader(file, header)) {
+		return false;
+	}
+	uint32_t size = file.size();
+	uint32_t count = logRecordCount(file, header);
+	bool checked = header.recordSize == sizeof(LogCheckedRecord);
+	LogCheckedRecord last;
+	bool haveLast = false;
+
+	if (checked) {
+		uint32_t recovered = recoverLogRecordCount(file, header, LOG_BUFFER_RECORDS, last, haveLast);
+		if (recovered != count) {
+			count = recovered;
+			Serial.printf("Recovered %s: %lu records\n", path, (unsigned long)count);
+			if (!setLogRecordCount(file, header, count)) {
+				Serial.printf("Failed to store the record count of %s\n", path);
+			}
+		}
+	}
+	file.close();
+
+	nextReadingId = haveLast ? last.sequence + 1 : header.firstReadingId + count;
+
+	// Whole records past the count are reserved space, anything else is torn
+	uint32_t dataSize = header.headerSize + count * header.recordSize;
+	if (size > dataSize && (size - header.headerSize) % header.recordSize != 0) {
+		Serial.printf("Cutting a torn record off %s\n", path);
+		return truncateSdFile(path, dataSize);
+	}
+	return true;
+}
+
+// Set up the write buffer and write any records that survived a reset
+void initLogWriter(fs::FS &fs) {
+	logFs = &fs;
+	logMutex = xSemaphoreCreateMutex();
+
+	bool valid = esp_reset_reason() != ESP_RST_POWERON && pending.magic == PENDING_MAGIC &&
+							 pending.count <= LOG_BUFFER_RECORDS && pending.checksum == pendingChecksum();
+	if (valid && pending.count > 0) {
+		stats.recordsRecovered = pending.count;
+		Serial.printf("Recovered %u unflushed records for %s\n", pending.count, pending.path);
+		writePending();
+	}
+	if (!valid || pending.count > 0) {
+		memset(&pending, 0, sizeof(pending));
+		pending.magic = PENDING_MAGIC;
+		pending.checksum = pendingChecksum();
+	}
+}
+
+// Buffer a record for the daily log at path
+bool logRecord(const String &path, const LogRecord &record, uint32_t dayStart, uint32_t readingId) {
+	xSemaphoreTake(logMutex, portMAX_DELAY);
+
+	// Records for another day go to a new file
+	if (pending.count > 0 && path != pending.path && !writePending()) {
+		stats.recordsDropped += pending.count;
+		pending.count = 0;
+	}
+	if (pending.count == LOG_BUFFER_RECORDS && !writePending()) {
+		stats.recordsDropped++;
+		xSemaphoreGive(logMutex);
+		return false;
+	}
+
+	if (pending.count == 0) {
+		strlcpy(pending.path, path.c_str(), sizeof(pending.path));
+		pending.dayStart = dayStart;
+		pending.firstReadingId = readingId;
+		oldestMillis = millis();
+	}
+	sealLogRecord(pending.records[pending.count++], record, readingId);
+	pending.checksum = pendingChecksum();
+
+	xSemaphoreGive(logMutex);
+	return true;
+}
+
+// True when the buffer is full enough or old enough to be written
+bool logFlushDue() {
+	return pending.count >= LOG_FLUSH_RECORDS ||
+				 (pending.count > 0 && millis() - oldestMillis >= LOG_FLUSH_AGE_MS);
+}
+
+// Write all buffered records now. A web request passes a wait so that a busy
+// card fails the flush instead of holding up the request.
+bool flushLog(TickType_t wait) {
+	if (logMutex == NULL || xSemaphoreTake(logMutex, wait) != pdTRUE) {
+		return false;
+	}
+	bool written = writePending(wait);
+	xSemaphoreGive(logMutex);
+	return written;
+}
+
+uint8_t logBufferDepth() {
+	return pending.count;
+}
+
+const LogWriterStats &logWriterStats() {
+	return stats;
+}
+
+String logWriterStatsJson() {
+	char json[400];
+	int len = snprintf(json, sizeof(json),
+					 "{\"depth\":%u,\"capacity\":%u,\"flushes\":%lu,\"flushFailures\":%lu,\"recordsWritten\":%lu,"
+					 "\"recordsDropped\":%lu,\"recordsRecovered\":%lu,\"lastFlushUs\":%lu,\"maxFlushUs\":%lu,\"avgFlushUs\":%lu",
+					 pending.count, LOG_BUFFER_RECORDS, (unsigned long)stats.flushes, (unsigned long)stats.flushFailures,
+					 (unsigned long)stats.recordsWritten, (unsigned long)stats.recordsDropped, (unsigned long)stats.recordsRecovered,
+					 (unsigned long)stats.lastFlushUs, (unsigned long)stats.maxFlushUs,
+					 (unsigned long)(stats.flushes ? stats.totalFlushUs / stats.flushes : 0));
+	for (uint8_t i = 0; i < LOG_FLUSH_BUCKETS; i++) {
+		len += snprintf(json + len, sizeof(json) - len, "%s%lu", i ? "," : ",\"flushMs\":[", (unsigned long)stats.flushHistogram[i]);
+	}
+	snprintf(json + len, sizeof(json) - len, "]}");
+	return String(json);
+}
@@ -0,0 +1,39 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "LogFormat.h"
+
+#define LOG_BUFFER_RECORDS 64			 // Records held in RAM between flushes
+#define LOG_FLUSH_RECORDS 32			 // Flush when this many records are waiting
+#define LOG_FLUSH_AGE_MS 300000		 // Flush when the oldest record is 5 min old
+#define LOG_FLUSH_BUCKETS 8				 // Flush time histogram: <1, <2, <4 ... <64 ms and longer
+
+// Write buffer statistics
+struct LogWriterStats {
+	uint32_t flushes;					// Successful flushes
+	uint32_t flushFailures;		// Flushes that couldn't write the file
+	uint32_t recordsWritten;	// Records written to SD
+	uint32_t recordsDropped;	// Records lost because the buffer was full
+	uint32_t recordsRecovered;// Records restored from RTC memory at boot
+	uint32_t lastFlushUs;			// Duration of the last flush
+	uint32_t maxFlushUs;			// Longest flush
+	uint64_t totalFlushUs;		// Sum of all flush durations
+	uint32_t flushHistogram[LOG_FLUSH_BUCKETS];	// Flushes by duration
+};
+
+// Function prototypes
+void initLogWriter(fs::FS &fs);
+bool createLogFile(fs::FS &fs, const char *path, uint32_t dayStart, uint32_t firstReadingId, uint32_t reserveRecords);
+bool trimLogFile(fs::FS &fs, const char *path);
+bool isLogLeftOpen(fs::FS &fs, const char *path, uint32_t dayStart);
+bool recoverLogTail(fs::FS &fs, const char *path, uint32_t &nextReadingId);
+bool logRecord(const String &path, const LogRecord &record, uint32_t dayStart, uint32_t readingId);
+bool logFlushDue();
+bool flushLog(TickType_t wait = portMAX_DELAY);
+uint8_t logBufferDepth();
+const LogWriterStats &logWriterStats();
+String logWriterStatsJson();
+
+#endif	// LOG_WRITER_H
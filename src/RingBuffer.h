@@ -0,0 +1,53 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring buffer. One task may push
+// and one other task may pop without any locking. Size must be a power of 2.
+template <typename T, size_t Size>
+class RingBuffer {
+	static_assert((Size & (Size - 1)) == 0, "RingBuffer size must be a power of 2");
+
+public:
+	// Producer side. Returns false (and counts a drop) when the buffer is full.
+	bool push(const T &item) {
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head - _tail.load(std::memory_order_acquire) == Size) {
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		_items[head & (Size - 1)] = item;
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Returns false when the buffer is empty.
+	bool pop(T &item) {
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail == _head.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = _items[tail & (Size - 1)];
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const {
+		return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const { return Size; }
+
+	uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+	T _items[Size];
+	std::atomic<size_t> _head{0};
+	std::atomic<size_t> _tail{0};
+	std::atomic<uint32_t> _dropped{0};
+};
+
+#endif	// RING_BUFFER_H
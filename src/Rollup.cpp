@@ -0,0 +1,309 @@
+#include "Rollup.h"
+
+// Record layout of a version 1 rollup file, before zoneRow
+struct RollupRecordV1 {
+	uint32_t dayStart;
+	uint8_t zone;
+	uint8_t avgPsi;
+	uint16_t outOfBandCount;
+	uint32_t count;
+	int16_t minCentiPsi;
+	int16_t maxCentiPsi;
+	int16_t meanCentiPsi;
+	uint16_t pumpCycles;
+	uint32_t firstEpoch;
+	uint32_t lastEpoch;
+} __attribute__((packed));
+
+// A rollup record being filled from the day's log records
+struct RollupTotals {
+	RollupRecord record;
+	int64_t sum;
+};
+
+// Whole day in [0], zones after it. Only used from the SD owner task.
+static RollupTotals totals[ROLLUP_MAX_ZONES + 1];
+static uint8_t totalsCount;
+
+static void startTotals(RollupTotals &t, uint32_t dayStart, uint8_t zone, uint8_t avgPsi, uint8_t zoneRow) {
+	memset(&t, 0, sizeof(t));
+	t.record.dayStart = dayStart;
+	t.record.zone = zone;
+	t.record.avgPsi = avgPsi;
+	t.record.zoneRow = zoneRow;
+	t.record.minCentiPsi = INT16_MAX;
+	t.record.maxCentiPsi = INT16_MIN;
+}
+
+static void addToTotals(RollupTotals &t, const LogRecord &record, bool pumpStarted) {
+	RollupRecord &r = t.record;
+	if (r.count == 0) {
+		r.firstEpoch = record.epoch;
+	}
+	r.lastEpoch = record.epoch;
+	r.count++;
+	r.minCentiPsi = min(r.minCentiPsi, record.centiPsi);
+	r.maxCentiPsi = max(r.maxCentiPsi, record.centiPsi);
+	if ((record.flags & LOG_FLAG_OUT_OF_BAND) && r.outOfBandCount < UINT16_MAX) {
+		r.outOfBandCount++;
+	}
+	if (pumpStarted && r.pumpCycles < UINT16_MAX) {
+		r.pumpCycles++;
+	}
+	t.sum += record.centiPsi;
+}
+
+// Totals of the zone a record was logged for. Controllers number their zones
+// independently, so a zone is told apart by its row of the zone table. Logs
+// from before the row was stored fall back to the zone number and pressure.
+static RollupTotals &zoneTotals(uint32_t dayStart, const LogRecord &record) {
+	for (uint8_t i = 1; i < totalsCount; i++) {
+		const RollupRecord &r = totals[i].record;
+		if (r.zoneRow == record.zoneRow && r.zone == record.zone && r.avgPsi == record.avgPsi) {
+			return totals[i];
+		}
+	}
+	if (totalsCount == ROLLUP_MAX_ZONES + 1) {
+		return totals[totalsCount - 1];	// Out of slots, share the last one
+	}
+	startTotals(totals[totalsCount], dayStart, record.zone, record.avgPsi, record.zoneRow);
+	return totals[totalsCount++];
+}
+
+// Check the rollup file header, creating the file if it doesn't exist. Leaves
+// lastDayStart at the day of the newest record, 0 if there is none.
+static bool openRollups(fs::FS &fs, const char *rollupPath, uint32_t &lastDayStart) {
+	lastDayStart = 0;
+	File file = fs.open(rollupPath, FILE_READ);
+	size_t size = file ? file.size() : 0;
+	if (size == 0) {
+		if (file) {
+			file.close();
+		}
+		file = fs.open(rollupPath, FILE_WRITE);
+		RollupFileHeader header;
+		memcpy(header.magic, ROLLUP_MAGIC, 4);
+		header.version = ROLLUP_VERSION;
+		header.recordSize = sizeof(RollupRecord);
+		header.headerSize = sizeof(RollupFileHeader);
+		bool written = file && file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+		if (file) {
+			file.close();
+		}
+		return written;
+	}
+
+	RollupFileHeader header;
+	bool valid = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+							 memcmp(header.magic, ROLLUP_MAGIC, 4) == 0 && header.version == ROLLUP_VERSION &&
+							 header.recordSize == sizeof(RollupRecord);
+	RollupRecord last;
+	if (valid && size >= header.headerSize + sizeof(RollupRecord) &&
+			file.seek(header.headerSize + ((size - header.headerSize) / sizeof(RollupRecord) - 1) * sizeof(RollupRecord)) &&
+			file.read((uint8_t *)&last, sizeof(last)) == sizeof(last)) {
+		lastDayStart = last.dayStart;
+	}
+	file.close();
+	return valid;
+}
+
+// Copy a version 1 rollup file to tempPath with the current record layout
+static bool copyRollupsV1(fs::FS &fs, File &in, const RollupFileHeader &old, const String &tempPath) {
+	File out = fs.open(tempPath, FILE_WRITE);
+	if (!out) {
+		return false;
+	}
+	RollupFileHeader header;
+	memcpy(header.magic, ROLLUP_MAGIC, 4);
+	header.version = ROLLUP_VERSION;
+	header.recordSize = sizeof(RollupRecord);
+	header.headerSize = sizeof(RollupFileHeader);
+	bool written = out.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) && in.seek(old.headerSize);
+	RollupRecordV1 v1;
+	while (written && in.read((uint8_t *)&v1, sizeof(v1)) == sizeof(v1)) {
+		RollupRecord r;
+		r.dayStart = v1.dayStart;
+		r.zone = v1.zone;
+		r.avgPsi = v1.avgPsi;
+		r.zoneRow = 0;
+		r.outOfBandCount = v1.outOfBandCount;
+		r.count = v1.count;
+		r.minCentiPsi = v1.minCentiPsi;
+		r.maxCentiPsi = v1.maxCentiPsi;
+		r.meanCentiPsi = v1.meanCentiPsi;
+		r.pumpCycles = v1.pumpCycles;
+		r.firstEpoch = v1.firstEpoch;
+		r.lastEpoch = v1.lastEpoch;
+		written = out.write((const uint8_t *)&r, sizeof(r)) == sizeof(r);
+	}
+	out.close();
+	return written;
+}
+
+// Bring the rollup file to the current version. A version 1 file is copied
+// to rollupPath.tmp and only removed once the copy is complete, so after a
+// reset a .tmp without the file is the finished copy and one next to the
+// file is dropped. Call it once at boot inside an SD job.
+void recoverRollups(fs::FS &fs, const char *rollupPath) {
+	String tempPath = String(rollupPath) + ".tmp";
+	if (fs.exists(tempPath)) {
+		if (fs.exists(rollupPath)) {
+			fs.remove(tempPath);
+		} else if (!fs.rename(tempPath, rollupPath)) {
+			Serial.printf("Failed to restore %s\n", rollupPath);
+			return;
+		}
+	}
+
+	File file = fs.open(rollupPath, FILE_READ);
+	RollupFileHeader header;
+	bool upgrade = file && file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+								 memcmp(header.magic, ROLLUP_MAGIC, 4) == 0 && header.version == 1 &&
+								 header.recordSize == sizeof(RollupRecordV1);
+	bool copied = upgrade && copyRollupsV1(fs, file, header, tempPath);
+	if (file) {
+		file.close();
+	}
+	if (!upgrade) {
+		return;
+	}
+	if (copied && fs.remove(rollupPath) && fs.rename(tempPath, rollupPath)) {
+		Serial.printf("Upgraded %s to version %u\n", rollupPath, ROLLUP_VERSION);
+	} else {
+		fs.remove(tempPath);
+		Serial.printf("Failed to upgrade %s\n", rollupPath);
+	}
+}
+
+// Summarize a closed daily log and append its records to the rollup file. A
+// day that is already in the file is not added again.
+bool appendDayRollup(fs::FS &fs, const char *logPath, const char *rollupPath, int16_t pumpCutInCentiPsi) {
+	File log = fs.open(logPath, FILE_READ);
+	if (!log) {
+		return false;
+	}
+	LogFileHeader header;
+	uint32_t lastDayStart;
+	if (!readLogHeader(log, header) || !openRollups(fs, rollupPath, lastDayStart)) {
+		log.close();
+		return false;
+	}
+	if (lastDayStart >= header.dayStart) {
+		log.close();
+		return true;
+	}
+
+	startTotals(totals[0], header.dayStart, ROLLUP_ALL_ZONES, 0, 0);
+	totalsCount = 1;
+	bool pumpAbove = true;
+	LogRecord record;
+	while (readLogRecord(log, header, record)) {
+		// A pump cycle starts when the pressure falls through the cut-in pressure
+		bool pumpStarted = false;
+		if (totals[0].record.count == 0) {
+			pumpAbove = record.centiPsi > pumpCutInCentiPsi;
+		} else if (pumpAbove && record.centiPsi < pumpCutInCentiPsi - ROLLUP_PUMP_HYSTERESIS) {
+			pumpAbove = false;
+			pumpStarted = true;
+		} else if (!pumpAbove && record.centiPsi > pumpCutInCentiPsi + ROLLUP_PUMP_HYSTERESIS) {
+			pumpAbove = true;
+		}
+
+		addToTotals(totals[0], record, pumpStarted);
+		addToTotals(zoneTotals(header.dayStart, record), record, pumpStarted);
+	}
+	log.close();
+	if (totals[0].record.count == 0) {
+		return true;	// Nothing was logged that day
+	}
+
+	File file = fs.open(rollupPath, FILE_APPEND);
+	if (!file) {
+		return false;
+	}
+	bool written = true;
+	for (uint8_t i = 0; i < totalsCount && written; i++) {
+		RollupRecord &r = totals[i].record;
+		r.meanCentiPsi = totals[i].sum / r.count;
+		written = file.write((const uint8_t *)&r, sizeof(r)) == sizeof(r);
+	}
+	file.close();
+	return written;
+}
+
+// Open the rollup file at the first record of the day at or after from
+bool beginRollupRead(RollupReadState &state, fs::FS &fs, const char *rollupPath, uint32_t from, uint32_t to, bool zones) {
+	state.file = fs.open(rollupPath, FILE_READ);
+	if (!state.file) {
+		return false;
+	}
+	RollupFileHeader header;
+	if (state.file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || memcmp(header.magic, ROLLUP_MAGIC, 4) != 0 ||
+			header.recordSize != sizeof(RollupRecord)) {
+		state.file.close();
+		return false;
+	}
+
+	// Records are in day order, binary search for the first day in the window
+	uint32_t low = 0;
+	uint32_t high = (state.file.size() - header.headerSize) / sizeof(RollupRecord);
+	while (low < high) {
+		uint32_t mid = (low + high) / 2;
+		RollupRecord record;
+		state.file.seek(header.headerSize + mid * sizeof(RollupRecord));
+		if (state.file.read((uint8_t *)&record, sizeof(record)) != sizeof(record)) {
+			break;
+		}
+		if (record.dayStart < from) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	state.file.seek(header.headerSize + low * sizeof(RollupRecord));
+
+	state.to = to;
+	state.zones = zones;
+	state.textLen = 0;
+	state.textPos = 0;
+	return true;
+}
+
+// Fill data with up to len bytes of rollup CSV lines:
+// date,zone,avg,count,min,max,mean,outOfBand,pumpCycles,firstEpoch,lastEpoch,row
+// zone is "day" for the whole-day record, row the zone table row (0 if not
+// known). Returns 0 when done.
+size_t renderRollups(RollupReadState &state, uint8_t *data, size_t len) {
+	size_t out = 0;
+	while (out < len) {
+		if (state.textPos < state.textLen) {
+			size_t n = min((size_t)(state.textLen - state.textPos), len - out);
+			memcpy(data + out, state.text + state.textPos, n);
+			state.textPos += n;
+			out += n;
+			continue;
+		}
+
+		RollupRecord r;
+		if (state.file.read((uint8_t *)&r, sizeof(r)) != sizeof(r) || r.dayStart > state.to) {
+			break;
+		}
+		if (!state.zones && r.zone != ROLLUP_ALL_ZONES) {
+			continue;
+		}
+
+		time_t day = r.dayStart;
+		struct tm timeinfo;
+		gmtime_r(&day, &timeinfo);
+		char zone[4];
+		snprintf(zone, sizeof(zone), "%u", r.zone);
+		int n = snprintf(state.text, sizeof(state.text), "%04d-%02d-%02d,%s,%u,%lu,%.2f,%.2f,%.2f,%u,%u,%lu,%lu,%u\r\n",
+										 timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+										 r.zone == ROLLUP_ALL_ZONES ? "day" : zone, r.avgPsi, (unsigned long)r.count,
+										 r.minCentiPsi / 100.0f, r.maxCentiPsi / 100.0f, r.meanCentiPsi / 100.0f, r.outOfBandCount,
+										 r.pumpCycles, (unsigned long)r.firstEpoch, (unsigned long)r.lastEpoch, r.zoneRow);
+		state.textLen = n < 0 ? 0 : min((size_t)n, sizeof(state.text) - 1);
+		state.textPos = 0;
+	}
+	return out;
+}
@@ -0,0 +1,56 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "LogFormat.h"
+
+#define ROLLUP_PATH "/rollups.dat"
+#define ROLLUP_MAGIC "WPRU"
+#define ROLLUP_VERSION 2					// 2: zoneRow added, a version 1 file is upgraded when it is opened
+#define ROLLUP_ALL_ZONES 0xFF		// zone of the whole-day record
+#define ROLLUP_MAX_ZONES 40			// Distinct zones summarized per day
+#define ROLLUP_PUMP_HYSTERESIS 50	// Centi-PSI either side of the cut-in pressure
+
+// Header at the start of the rollup file
+struct RollupFileHeader {
+	char magic[4];				// ROLLUP_MAGIC
+	uint8_t version;			// ROLLUP_VERSION
+	uint8_t recordSize;		// Bytes per record
+	uint16_t headerSize;	// Bytes before the first record
+} __attribute__((packed));
+
+// Summary of one log day, or of one zone on that day. Each closed day appends
+// its whole-day record followed by one record per zone seen that day.
+struct RollupRecord {
+	uint32_t dayStart;				// Local time of the first second of the log day
+	uint8_t zone;							// Zone number, 0 = all off, ROLLUP_ALL_ZONES = whole day
+	uint8_t avgPsi;						// Expected pressure of the zone
+	uint8_t zoneRow;					// Row of the zone table, 0 if the log doesn't say
+	uint16_t outOfBandCount;	// Records more than 2 PSI from avgPsi
+	uint32_t count;						// Records
+	int16_t minCentiPsi;
+	int16_t maxCentiPsi;
+	int16_t meanCentiPsi;
+	uint16_t pumpCycles;			// Times the pressure fell through the pump cut-in
+	uint32_t firstEpoch;			// First record
+	uint32_t lastEpoch;				// Last record
+} __attribute__((packed));
+
+// Progress of sending rollups for a chunked response
+struct RollupReadState {
+	File file;
+	uint32_t to;				// Last dayStart to send
+	bool zones;					// Send the per-zone records too
+	char text[112];			// Rendered line not yet sent
+	uint8_t textLen;
+	uint8_t textPos;
+};
+
+// Function prototypes
+void recoverRollups(fs::FS &fs, const char *rollupPath);
+bool appendDayRollup(fs::FS &fs, const char *logPath, const char *rollupPath, int16_t pumpCutInCentiPsi);
+bool beginRollupRead(RollupReadState &state, fs::FS &fs, const char *rollupPath, uint32_t from, uint32_t to, bool zones);
+size_t renderRollups(RollupReadState &state, uint8_t *data, size_t len);
+
+#endif	// ROLLUP_H
@@ -1,42 +1,271 @@
 #include "SdCardUtils.h"
+#include <atomic>
+#include <unistd.h>
 #define SD_CS     5 // Define CS pin for the SD card module
 
+// Progress of a job whose caller waits for it. A caller that gives up while
+// the job is still queued marks it cancelled, and the owner task drops it
+// without touching the caller's stack. Waiters live in a static pool because
+// the owner task may look at one after its caller has returned.
+enum SdWaiterState : uint8_t {
+	SD_WAITER_FREE,
+	SD_WAITER_QUEUED,
+	SD_WAITER_RUNNING,
+	SD_WAITER_DONE,
+	SD_WAITER_CANCELLED,
+};
+
+struct SdWaiter {
+	TaskHandle_t caller;
+	std::atomic<uint8_t> state;
+};
+
+// A job waiting for the owner task. A waited-for job refers to the caller's
+// stack and has a waiter; a posted job owns its work and has none.
+struct SdJob {
+	const std::function<void()> *work;
+	SdWaiter *waiter;
+	uint32_t queuedUs;
+};
+
+// A posted job that found its queue full. They are kept on a list the
+// owner task empties before it takes the next queued job, so posting never
+// blocks for long, which matters on the web server task.
+struct SdDeferredJob {
+	const std::function<void()> *work;
+	SdPriority priority;
+	uint32_t queuedUs;
+	SdDeferredJob *next;
+};
+
+static QueueHandle_t sdQueues[SD_PRIORITY_COUNT];
+static std::atomic<SdDeferredJob *> sdDeferred(nullptr);	// Newest first
+static SemaphoreHandle_t sdJobsWaiting = NULL;	// Counts jobs across all queues
+static TaskHandle_t sdOwner = NULL;
+static SdQueueStats sdStats[SD_PRIORITY_COUNT];
+static SdWaiter sdWaiters[SD_WAITER_COUNT];
+
+static void runJob(SdPriority priority, const std::function<void()> &work, uint32_t waitUs) {
+	uint32_t startTime = micros();
+	work();
+	uint32_t runUs = micros() - startTime;
+
+	SdQueueStats &stats = sdStats[priority];
+	stats.jobs++;
+	stats.maxWaitUs = max(stats.maxWaitUs, waitUs);
+	stats.totalWaitUs += waitUs;
+	stats.maxRunUs = max(stats.maxRunUs, runUs);
+	stats.totalRunUs += runUs;
+}
+
+// Run a job taken from a queue
+static void runQueuedJob(SdPriority priority, const SdJob &job) {
+	uint32_t waitUs = micros() - job.queuedUs;
+	if (!job.waiter) {
+		runJob(priority, *job.work, waitUs);
+		delete job.work;
+		return;
+	}
+	uint8_t queued = SD_WAITER_QUEUED;
+	if (!job.waiter->state.compare_exchange_strong(queued, SD_WAITER_RUNNING)) {
+		job.waiter->state = SD_WAITER_FREE;	// The caller gave up on it
+		sdStats[priority].cancelled++;
+		return;
+	}
+	runJob(priority, *job.work, waitUs);
+	job.waiter->state = SD_WAITER_DONE;
+	xTaskNotifyGive(job.waiter->caller);
+}
+
+// Run every job on the overflow list, oldest first
+static void runDeferredJobs() {
+	SdDeferredJob *job = sdDeferred.exchange(nullptr);
+	SdDeferredJob *oldest = nullptr;
+	while (job) {
+		SdDeferredJob *next = job->next;
+		job->next = oldest;
+		oldest = job;
+		job = next;
+	}
+	while (oldest) {
+		SdDeferredJob *next = oldest->next;
+		runJob(oldest->priority, *oldest->work, micros() - oldest->queuedUs);
+		delete oldest->work;
+		delete oldest;
+		oldest = next;
+	}
+}
+
+// The only task that touches the SD card once the scheduler is running
+static void sdOwnerTask(void *param) {
+	for (;;) {
+		xSemaphoreTake(sdJobsWaiting, portMAX_DELAY);
+
+		// Deferred jobs first, they already found their queue full
+		if (sdDeferred.load() != nullptr) {
+			runDeferredJobs();
+			continue;
+		}
+
+		// One job was queued per give, take the most urgent one
+		for (uint8_t priority = 0; priority < SD_PRIORITY_COUNT; priority++) {
+			SdJob job;
+			if (xQueueReceive(sdQueues[priority], &job, 0) == pdTRUE) {
+				runQueuedJob((SdPriority)priority, job);
+				break;
+			}
+		}
+	}
+}
+
+// Start the owner task. SD access before this runs on the calling task.
+void startSdScheduler() {
+	for (uint8_t priority = 0; priority < SD_PRIORITY_COUNT; priority++) {
+		sdQueues[priority] = xQueueCreate(SD_QUEUE_DEPTH, sizeof(SdJob));
+	}
+	sdJobsWaiting = xSemaphoreCreateCounting(SD_QUEUE_DEPTH * SD_PRIORITY_COUNT, 0);
+	xTaskCreatePinnedToCore(sdOwnerTask, "sdOwner", 8192, NULL, 4, &sdOwner, 0);
+}
+
+static SdWaiter *takeWaiter() {
+	for (SdWaiter &waiter : sdWaiters) {
+		uint8_t free = SD_WAITER_FREE;
+		if (waiter.state.compare_exchange_strong(free, SD_WAITER_QUEUED)) {
+			return &waiter;
+		}
+	}
+	return nullptr;
+}
+
+// Run job on the SD owner task and wait for it to finish. Waits at most
+// timeout for the job to start; returns false, with the job dropped, if it
+// didn't. A job that has started is always waited for.
+bool sdRun(SdPriority priority, const std::function<void()> &job, TickType_t timeout) {
+	TaskHandle_t self = xTaskGetCurrentTaskHandle();
+	if (sdOwner == NULL || self == sdOwner) {
+		// Not started yet, or a job that needs more SD access
+		runJob(priority, job, 0);
+		return true;
+	}
+
+	SdWaiter *waiter = takeWaiter();
+	if (!waiter) {
+		sdStats[priority].cancelled++;
+		return false;
+	}
+	waiter->caller = self;
+	SdJob queued = {&job, waiter, (uint32_t)micros()};
+	if (xQueueSend(sdQueues[priority], &queued, timeout) != pdTRUE) {
+		waiter->state = SD_WAITER_FREE;
+		sdStats[priority].cancelled++;
+		return false;
+	}
+	xSemaphoreGive(sdJobsWaiting);
+
+	// The time spent getting a queue slot counts against the timeout too,
+	// close enough for a bound that is only there to keep callers responsive
+	if (ulTaskNotifyTake(pdTRUE, timeout) == 0) {
+		uint8_t state = SD_WAITER_QUEUED;
+		if (waiter->state.compare_exchange_strong(state, SD_WAITER_CANCELLED)) {
+			return false;	// The owner task frees the waiter when it gets to the job
+		}
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);	// Already running
+	}
+	waiter->state = SD_WAITER_FREE;
+	return true;
+}
+
+// Run job on the SD owner task without waiting for it. The job is copied,
+// so it must not refer to the caller's stack. A full queue is waited for at
+// most SD_POST_WAIT, then the job goes on the overflow list instead, so
+// posting from the web server task (see sdShared()) never stalls it.
+void sdPost(SdPriority priority, const std::function<void()> &job) {
+	TaskHandle_t self = xTaskGetCurrentTaskHandle();
+	if (sdOwner == NULL || self == sdOwner) {
+		runJob(priority, job, 0);
+		return;
+	}
+	SdJob queued = {new std::function<void()>(job), nullptr, (uint32_t)micros()};
+	if (xQueueSend(sdQueues[priority], &queued, SD_POST_WAIT) != pdTRUE) {
+		SdDeferredJob *deferred = new SdDeferredJob{queued.work, priority, queued.queuedUs, sdDeferred.load()};
+		while (!sdDeferred.compare_exchange_weak(deferred->next, deferred)) {
+		}
+		sdStats[priority].deferred++;
+	}
+	// With the count already at its limit the owner task is awake for a
+	// while yet and finds the list on one of those turns
+	xSemaphoreGive(sdJobsWaiting);
+}
+
+const SdQueueStats &sdQueueStats(SdPriority priority) {
+	return sdStats[priority];
+}
+
+String sdStatsJson() {
+	static const char *names[SD_PRIORITY_COUNT] = {"log", "write", "read", "background"};
+	String json = "{";
+	for (uint8_t priority = 0; priority < SD_PRIORITY_COUNT; priority++) {
+		const SdQueueStats &stats = sdStats[priority];
+		char entry[256];
+		snprintf(entry, sizeof(entry),
+						 "%s\"%s\":{\"queued\":%u,\"jobs\":%lu,\"cancelled\":%lu,\"deferred\":%lu,\"avgWaitUs\":%lu,\"maxWaitUs\":%lu,\"avgRunUs\":%lu,\"maxRunUs\":%lu}",
+						 priority ? "," : "", names[priority], sdOwner ? (unsigned)uxQueueMessagesWaiting(sdQueues[priority]) : 0,
+						 (unsigned long)stats.jobs, (unsigned long)stats.cancelled, (unsigned long)stats.deferred, (unsigned long)(stats.jobs ? stats.totalWaitUs / stats.jobs : 0),
+						 (unsigned long)stats.maxWaitUs, (unsigned long)(stats.jobs ? stats.totalRunUs / stats.jobs : 0),
+						 (unsigned long)stats.maxRunUs);
+		json += entry;
+	}
+	json += "}";
+	return json;
+}
+
+// Cut a file on SD down to size. File has no truncate, so this goes through
+// the VFS path of the card. Call it inside an SD job with the file closed.
+bool truncateSdFile(const char *path, uint32_t size) {
+	return truncate((String(SD_MOUNT_POINT) + path).c_str(), size) == 0;
+}
 
 String readFile(fs::FS &fs, const char * path){
   Serial.printf("Reading file: %s\r\n", path);
-  File file = fs.open(path, "r");
-  if(!file || file.isDirectory()){
-    Serial.println("- empty file or failed to open file");
-    return String();
-  }
-  Serial.print("- read from file:");
   String fileContent;
-  while(file.available()){
-    fileContent+=String((char)file.read());
-  }
-  file.close();
+  sdRun(SD_PRIORITY_READ, [&]() {
+    File file = fs.open(path, "r");
+    if(!file || file.isDirectory()){
+      Serial.println("- empty file or failed to open file");
+      return;
+    }
+    Serial.print("- read from file:");
+    while(file.available()){
+      fileContent+=String((char)file.read());
+    }
+    file.close();
+  });
   Serial.println(fileContent);
   return fileContent;
 }
 
 void writeFile(fs::FS &fs, const char * path, const char * message){
   Serial.printf("Writing file: %s\r\n", path);
-  File file = fs.open(path, "w");
-  if(!file){
-    Serial.println("- failed to open file for writing");
-    return;
-  }
-  if(file.print(message)){
-    Serial.println("- file written");
-  } else {
-    Serial.println("- write failed");
-  }
-  file.close();
+  sdRun(SD_PRIORITY_WRITE, [&]() {
+    File file = fs.open(path, "w");
+    if(!file){
+      Serial.println("- failed to open file for writing");
+      return;
+    }
+    if(file.print(message)){
+      Serial.println("- file written");
+    } else {
+      Serial.println("- write failed");
+    }
+    file.close();
+  });
 }
 
 void deleteFile(fs::FS &fs, const char * path){
   Serial.printf("Deleting file: %s\n", path);
-  if(fs.remove(path)){
+  bool removed = false;
+  sdRun(SD_PRIORITY_WRITE, [&]() { removed = fs.remove(path); });
+  if(removed){
     Serial.println("File deleted");
   } else {
     Serial.println("Delete failed");
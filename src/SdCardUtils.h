@@ -1,13 +1,60 @@
 #ifndef SD_CARD_UTILS_H
 #define SD_CARD_UTILS_H
 
+#include <Arduino.h>
+#include <functional>
+#include <memory>
 #include "FS.h"
 #include "SD.h"
 
+#define SD_QUEUE_DEPTH 8	// Jobs waiting per priority
+#define SD_WAITER_COUNT (SD_QUEUE_DEPTH * SD_PRIORITY_COUNT + 4)	// Callers that can wait for a job at once
+#define SD_WEB_WAIT pdMS_TO_TICKS(2000)	// Longest a web request waits for its SD job to start
+#define SD_POST_WAIT pdMS_TO_TICKS(10)	// Longest sdPost() waits for a queue slot before it defers the job
+#define SD_MOUNT_POINT "/sd"	// Where SD.begin() mounts the card in the VFS
+
+// SD jobs run on one owner task, highest priority first. Jobs of the same
+// priority run in the order they were queued, so chunked reads from several
+// clients take turns.
+enum SdPriority : uint8_t {
+	SD_PRIORITY_LOG,		// Daily log writes
+	SD_PRIORITY_WRITE,	// Captures, settings and other small writes
+	SD_PRIORITY_READ,		// Downloads, listings and settings reads
+	SD_PRIORITY_BACKGROUND,	// Slices of long jobs such as log archiving
+	SD_PRIORITY_COUNT
+};
+
+// Queue statistics for one priority
+struct SdQueueStats {
+	uint32_t jobs;				// Jobs run
+	uint32_t cancelled;		// Jobs dropped because the caller stopped waiting
+	uint32_t deferred;		// Posted jobs that found the queue full and went on the overflow list
+	uint32_t maxWaitUs;		// Longest time a job waited in the queue
+	uint64_t totalWaitUs;	// Sum of all queue waits
+	uint32_t maxRunUs;		// Longest job
+	uint64_t totalRunUs;	// Sum of all job durations
+};
+
 // Function prototypes
 void initSdCard();
+void startSdScheduler();
+bool sdRun(SdPriority priority, const std::function<void()> &job, TickType_t timeout = portMAX_DELAY);
+void sdPost(SdPriority priority, const std::function<void()> &job);
+const SdQueueStats &sdQueueStats(SdPriority priority);
+String sdStatsJson();
+bool truncateSdFile(const char *path, uint32_t size);
+
+// Share an object that holds SD files, such as the state of a streamed
+// response. The last reference may go on the web server task when a client
+// aborts, so the object is deleted in an SD job and its files are closed by
+// the SD owner task.
+template <typename T>
+std::shared_ptr<T> sdShared(T *object) {
+	return std::shared_ptr<T>(object, [](T *held) { sdPost(SD_PRIORITY_READ, [held]() { delete held; }); });
+}
+
 String readFile(fs::FS &fs, const char * path);
-void appendFile(fs::FS &fs, const char * path, const char * message);
+void appendFile(fs::FS &fs, const char * path, const char * message);	// Not an SD job itself, call it inside one
 void writeFile(fs::FS &fs, const char * path, const char * message);
 void deleteFile(fs::FS &fs, const char * path);
 
@@ -0,0 +1,44 @@
+#include "StaticAssets.h"
+#include "HttpCache.h"
+
+// Hash of the web assets in the file system image, sent as their ETag.
+// Empty when the image has no version file, then nothing is cached.
+static String assetETag;
+
+void loadAssetVersion(fs::FS &fs) {
+	File file = fs.open(ASSET_VERSION_PATH, FILE_READ);
+	if (!file) {
+		Serial.println("No web asset version, assets will not be cached");
+		return;
+	}
+	String version = file.readString();
+	file.close();
+	version.trim();
+	assetETag = "\"" + version + "\"";
+	Serial.println("Web asset version " + version);
+}
+
+// Send a web asset, or return false if there is no such file. The build
+// stores the HTML, JS and CSS only as <path>.gz, which the web server sends
+// with Content-Encoding: gzip when <path> itself is missing.
+bool sendStaticAsset(AsyncWebServerRequest *request, fs::FS &fs, String path) {
+	if (path.endsWith("/")) {
+		path += "index.html";
+	}
+	if (path.indexOf("..") != -1 || (!fs.exists(path) && !fs.exists(path + ".gz"))) {
+		return false;
+	}
+
+	// The browser already has this version
+	if (etagMatches(request, assetETag)) {
+		sendNotModified(request, assetETag, ASSET_CACHE_CONTROL);
+		return true;
+	}
+
+	AsyncWebServerResponse *response = request->beginResponse(fs, path);
+	if (assetETag.length()) {
+		addCacheHeaders(response, assetETag, ASSET_CACHE_CONTROL);
+	}
+	request->send(response);
+	return true;
+}
@@ -0,0 +1,15 @@
+#ifndef STATIC_ASSETS_H
+#define STATIC_ASSETS_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "FS.h"
+
+#define ASSET_VERSION_PATH "/assets.ver"		// Written by tools/gzip_assets.py
+#define ASSET_CACHE_CONTROL "no-cache"				// Cache, but revalidate with the ETag on every load
+
+// Function prototypes
+void loadAssetVersion(fs::FS &fs);
+bool sendStaticAsset(AsyncWebServerRequest *request, fs::FS &fs, String path);
+
+#endif	// STATIC_ASSETS_H
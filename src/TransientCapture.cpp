@@ -0,0 +1,138 @@
+#include "TransientCapture.h"
+#include <atomic>
+
+#define HISTORY_MASK (CAPTURE_PRE_SAMPLES - 1)
+#define SLOPE_SAMPLES 25				 // Slope is measured over this many samples, 50 ms at 500 Hz
+#define HYSTERESIS_CENTI_PSI 50	 // Noise band around each threshold
+#define CAPTURE_HOLDOFF_MS 10000 // Quiet time after a capture is written
+
+static_assert((CAPTURE_PRE_SAMPLES & HISTORY_MASK) == 0, "CAPTURE_PRE_SAMPLES must be a power of 2");
+
+enum CaptureState : uint8_t {
+	CAPTURE_ARMED,			// Watching for a trigger
+	CAPTURE_RECORDING,	// Collecting post-trigger samples
+	CAPTURE_FROZEN,			// Window complete, waiting to be written
+};
+
+// A pressure level that triggers when crossed in either direction
+struct Threshold {
+	int16_t level;
+	bool above;
+};
+
+static int16_t history[CAPTURE_PRE_SAMPLES];
+static int16_t window[CAPTURE_PRE_SAMPLES + CAPTURE_POST_SAMPLES];
+static uint32_t historyCount = 0;
+static uint16_t postCount = 0;
+// captureSample() and writeCapture() run on different tasks. Only the task
+// that owns the current state touches window[], and ownership changes hands
+// through this atomic.
+static std::atomic<uint8_t> state{CAPTURE_ARMED};
+static uint8_t triggerReason = CAPTURE_NONE;
+static unsigned long triggerMillis = 0;
+static unsigned long holdoffUntil = 0;
+
+static Threshold allOffThreshold;
+static Threshold pumpThreshold;
+static int16_t slopeLimit;
+static uint16_t captureSampleHz;
+
+void initTransientCapture(float allOffPsi, float pumpCutInPsi, float slopePsi, uint16_t sampleHz) {
+	allOffThreshold = {(int16_t)(allOffPsi * 100), false};
+	pumpThreshold = {(int16_t)(pumpCutInPsi * 100), false};
+	slopeLimit = slopePsi * 100;
+	captureSampleHz = sampleHz;
+}
+
+// Returns true when the sample crosses the threshold, outside its noise band
+static inline bool crossed(Threshold &threshold, int16_t centiPsi) {
+	if (threshold.above && centiPsi < threshold.level - HYSTERESIS_CENTI_PSI) {
+		threshold.above = false;
+		return true;
+	}
+	if (!threshold.above && centiPsi > threshold.level + HYSTERESIS_CENTI_PSI) {
+		threshold.above = true;
+		return true;
+	}
+	return false;
+}
+
+// Feed one raw sample. Runs for every sample, so it only does a few compares
+// unless a trigger fires.
+void captureSample(int16_t centiPsi) {
+	int16_t earlier = history[(historyCount - SLOPE_SAMPLES) & HISTORY_MASK];
+	history[historyCount & HISTORY_MASK] = centiPsi;
+	historyCount++;
+
+	if (historyCount == 1) {
+		// Start the thresholds on the right side without triggering
+		allOffThreshold.above = centiPsi > allOffThreshold.level;
+		pumpThreshold.above = centiPsi > pumpThreshold.level;
+		return;
+	}
+
+	if (state == CAPTURE_RECORDING) {
+		window[CAPTURE_PRE_SAMPLES + postCount++] = centiPsi;
+		if (postCount == CAPTURE_POST_SAMPLES) {
+			state = CAPTURE_FROZEN;
+		}
+		return;
+	}
+
+	// Keep the threshold sides current even while a capture waits to be written
+	uint8_t reason = CAPTURE_NONE;
+	if (crossed(allOffThreshold, centiPsi)) reason |= CAPTURE_ALL_OFF;
+	if (crossed(pumpThreshold, centiPsi)) reason |= CAPTURE_PUMP;
+	if (historyCount > SLOPE_SAMPLES && abs(centiPsi - earlier) > slopeLimit) reason |= CAPTURE_SLOPE;
+
+	if (reason == CAPTURE_NONE || state != CAPTURE_ARMED || historyCount < CAPTURE_PRE_SAMPLES ||
+			(long)(millis() - holdoffUntil) < 0) {
+		return;
+	}
+
+	// Freeze the pre-trigger history, oldest sample first
+	for (uint16_t i = 0; i < CAPTURE_PRE_SAMPLES; i++) {
+		window[i] = history[(historyCount + i) & HISTORY_MASK];
+	}
+	postCount = 0;
+	triggerReason = reason;
+	triggerMillis = millis();
+	state = CAPTURE_RECORDING;
+}
+
+bool captureReady() {
+	return state == CAPTURE_FROZEN;
+}
+
+// Write a completed capture to CAPTURE_DIR/<epoch>.cap and re-arm the trigger
+bool writeCapture(fs::FS &fs, unsigned long epochNow) {
+	if (state != CAPTURE_FROZEN) {
+		return false;
+	}
+
+	CaptureHeader header;
+	memcpy(header.magic, "WPTC", 4);
+	header.version = 1;
+	header.reason = triggerReason;
+	header.sampleHz = captureSampleHz;
+	header.triggerEpoch = epochNow - (millis() - triggerMillis) / 1000;
+	header.preSamples = CAPTURE_PRE_SAMPLES;
+	header.postSamples = CAPTURE_POST_SAMPLES;
+
+	char path[32];
+	snprintf(path, sizeof(path), CAPTURE_DIR "/%lu.cap", (unsigned long)header.triggerEpoch);
+
+	bool written = false;
+	File file = fs.open(path, FILE_WRITE);
+	if (file) {
+		written = file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+							file.write((const uint8_t *)window, sizeof(window)) == sizeof(window);
+		file.close();
+	}
+	Serial.printf("Transient capture %s %s\n", path, written ? "written" : "failed");
+
+	// Re-arm even on failure so a bad card can't stop future captures
+	state = CAPTURE_ARMED;
+	holdoffUntil = millis() + CAPTURE_HOLDOFF_MS;
+	return written;
+}
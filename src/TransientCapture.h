@@ -0,0 +1,36 @@
+#ifndef TRANSIENT_CAPTURE_H
+#define TRANSIENT_CAPTURE_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define CAPTURE_PRE_SAMPLES 1024	 // Raw samples kept before the trigger, about 2 sec at 500 Hz
+#define CAPTURE_POST_SAMPLES 1024	 // Raw samples recorded after the trigger
+#define CAPTURE_DIR "/captures"
+
+// Why a capture was triggered
+enum CaptureReason : uint8_t {
+	CAPTURE_NONE = 0,
+	CAPTURE_ALL_OFF = 1,	 // Crossed the all zones off pressure
+	CAPTURE_PUMP = 2,			 // Crossed the pump cut-in pressure
+	CAPTURE_SLOPE = 4,		 // Pressure changed faster than the slope limit
+};
+
+// Header of a capture file, followed by the samples as little-endian int16 centi-PSI
+struct CaptureHeader {
+	char magic[4];					// "WPTC"
+	uint8_t version;				// 1
+	uint8_t reason;					// CaptureReason bits
+	uint16_t sampleHz;			// Raw sample rate
+	uint32_t triggerEpoch;	// Local time of the trigger sample
+	uint16_t preSamples;		// Samples up to and including the trigger sample
+	uint16_t postSamples;		// Samples after the trigger sample
+} __attribute__((packed));
+
+// Function prototypes
+void initTransientCapture(float allOffPsi, float pumpCutInPsi, float slopePsi, uint16_t sampleHz);
+void captureSample(int16_t centiPsi);
+bool captureReady();
+bool writeCapture(fs::FS &fs, unsigned long epochNow);
+
+#endif	// TRANSIENT_CAPTURE_H
@@ -0,0 +1,242 @@
+#include "ZoneSchedule.h"
+#include <Arduino_JSON.h>
+#include <algorithm>
+
+// Compiled zone table and its weekly timeline of zone runs (sorted by start
+// and non-overlapping). A new schedule is built in the spare buffer and then
+// published by swapping the pointer under scheduleMux, so the sampling task
+// never sees a half-built table. Readers hold scheduleMux while they use it.
+struct CompiledSchedule {
+	Zone zones[MAX_ZONES];
+	ZoneLabel labels[MAX_ZONES];
+	uint8_t zoneCount;
+	ZoneInterval timeline[MAX_ZONE_INTERVALS];
+	uint16_t timelineCount;
+};
+
+static CompiledSchedule scheduleBuffers[2];
+static CompiledSchedule *activeSchedule = &scheduleBuffers[0];
+static portMUX_TYPE scheduleMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Make schedule the one readers see. Compiles only run on one task at a time
+// (setup(), then the web server task), so the spare buffer has no readers.
+static void publishSchedule(CompiledSchedule *schedule) {
+	portENTER_CRITICAL(&scheduleMux);
+	activeSchedule = schedule;
+	portEXIT_CRITICAL(&scheduleMux);
+}
+
+static CompiledSchedule *spareSchedule() {
+	return activeSchedule == &scheduleBuffers[0] ? &scheduleBuffers[1] : &scheduleBuffers[0];
+}
+
+// Zone table fields are stored as strings by the Config page
+static const char *fieldText(JSONVar zone, const char *key) {
+	const char *text = (const char *)zone[key];
+	return text ? text : "";
+}
+
+// "246" -> bits 2, 4 and 6
+static uint8_t parseDayMask(const char *days) {
+	uint8_t mask = 0;
+	for (; *days; days++) {
+		if (*days >= '0' && *days <= '6') {
+			mask |= 1 << (*days - '0');
+		}
+	}
+	return mask;
+}
+
+// "HH:MM" -> minutes after midnight, "00:00" means chained to the previous zone
+static uint16_t parseStartMinute(const char *start) {
+	if (strlen(start) < 5) {
+		return ZONE_CHAINED;
+	}
+	uint16_t minute = atoi(start) * 60 + atoi(start + 3);
+	return minute == 0 ? ZONE_CHAINED : minute;
+}
+
+// Add a zone run to the timeline, splitting it if it runs past the end of the week
+static void addInterval(CompiledSchedule &schedule, uint32_t start, uint16_t runMinutes, uint8_t zone) {
+	start %= MINUTES_PER_WEEK;
+	uint32_t end = start + runMinutes;
+	if (runMinutes == 0 || schedule.timelineCount + 2 > MAX_ZONE_INTERVALS) {
+		return;
+	}
+	if (end > MINUTES_PER_WEEK) {
+		schedule.timeline[schedule.timelineCount++] = {(uint16_t)start, MINUTES_PER_WEEK, zone};
+		start = 0;
+		end -= MINUTES_PER_WEEK;
+	}
+	schedule.timeline[schedule.timelineCount++] = {(uint16_t)start, (uint16_t)end, zone};
+}
+
+// Expand the zone table into the weekly timeline. A zone with a start time
+// runs on each of its days, and the "00:00" zones that follow it in the table
+// run back to back after it regardless of their own days.
+static void buildZoneTimeline(CompiledSchedule &schedule) {
+	const Zone *zones = schedule.zones;
+	ZoneInterval *timeline = schedule.timeline;
+	schedule.timelineCount = 0;
+	for (uint8_t i = 0; i < schedule.zoneCount; i++) {
+		const Zone &zone = zones[i];
+		if (zone.startMinute == ZONE_CHAINED) {
+			continue;
+		}
+		for (uint8_t day = 0; day < 7; day++) {
+			if (!(zone.dayMask & (1 << day))) {
+				continue;
+			}
+			uint32_t start = day * 1440 + zone.startMinute;
+			addInterval(schedule, start, zone.runMinutes, i);
+			start += zone.runMinutes;
+			for (uint8_t j = i + 1; j < schedule.zoneCount && zones[j].startMinute == ZONE_CHAINED; j++) {
+				addInterval(schedule, start, zones[j].runMinutes, j);
+				start += zones[j].runMinutes;
+			}
+		}
+	}
+
+	std::sort(timeline, timeline + schedule.timelineCount, [](const ZoneInterval &a, const ZoneInterval &b) {
+		return a.start < b.start;
+	});
+
+	// A zone that is already running keeps the water, so clip any run that
+	// overlaps it to start when it ends
+	uint16_t kept = 0;
+	uint16_t lastEnd = 0;
+	for (uint16_t i = 0; i < schedule.timelineCount; i++) {
+		ZoneInterval interval = timeline[i];
+		if (interval.start < lastEnd) {
+			interval.start = lastEnd;
+		}
+		if (interval.start >= interval.end) {
+			continue;
+		}
+		timeline[kept++] = interval;
+		lastEnd = interval.end;
+	}
+	schedule.timelineCount = kept;
+}
+
+// Compile the JSON zone table and publish it. The previous table is kept if
+// the JSON can't be parsed.
+bool compileZoneTable(const String &zoneData) {
+	JSONVar zones = JSON.parse(zoneData);
+	if (JSON.typeof(zones) != "array") {
+		Serial.println("Zone table is not a JSON array, keeping previous table");
+		return false;
+	}
+
+	int count = zones.length();
+	if (count > MAX_ZONES) {
+		Serial.printf("Zone table has %d rows, only the first %d are used\n", count, MAX_ZONES);
+		count = MAX_ZONES;
+	}
+
+	CompiledSchedule &schedule = *spareSchedule();
+	for (int i = 0; i < count; i++) {
+		JSONVar zone = zones[i];
+		schedule.zones[i].znumber = atoi(fieldText(zone, "znumber"));
+		schedule.zones[i].dayMask = parseDayMask(fieldText(zone, "days"));
+		schedule.zones[i].startMinute = parseStartMinute(fieldText(zone, "start"));
+		schedule.zones[i].runMinutes = atoi(fieldText(zone, "run"));
+		schedule.zones[i].avgPsi = atoi(fieldText(zone, "avgpsi"));
+		strlcpy(schedule.labels[i].zname, fieldText(zone, "zname"), ZONE_NAME_LEN);
+		strlcpy(schedule.labels[i].controller, fieldText(zone, "controller"), ZONE_CTRL_LEN);
+	}
+	schedule.zoneCount = count;
+	buildZoneTimeline(schedule);
+	publishSchedule(&schedule);
+
+	Serial.printf("Zone table compiled: %d zones, %d runs per week\n", schedule.zoneCount, schedule.timelineCount);
+	return true;
+}
+
+bool loadZoneSchedule(fs::FS &fs, const char *path) {
+	File file = fs.open(path, FILE_READ);
+	if (!file) {
+		Serial.printf("Failed to open zone data file %s for reading\n", path);
+		CompiledSchedule &schedule = *spareSchedule();
+		schedule.zoneCount = 0;
+		schedule.timelineCount = 0;
+		publishSchedule(&schedule);
+		return false;
+	}
+	String zoneData = file.readString();
+	file.close();
+
+	return compileZoneTable(zoneData);
+}
+
+// Row of the zone running at a minute of the week (0 = Sunday 00:00),
+// row 0 (the OFF row) when no zone is running. The row is copied to zone
+// from the same table the lookup used.
+uint8_t findActiveZone(uint16_t minuteOfWeek, Zone *zone) {
+	portENTER_CRITICAL(&scheduleMux);
+	const ZoneInterval *timeline = activeSchedule->timeline;
+	// Last interval starting at or before minuteOfWeek
+	const ZoneInterval *next = std::upper_bound(timeline, timeline + activeSchedule->timelineCount, minuteOfWeek,
+																							[](uint16_t minute, const ZoneInterval &interval) {
+																								return minute < interval.start;
+																							});
+	uint8_t index = next == timeline || minuteOfWeek >= (next - 1)->end ? 0 : (next - 1)->zone;
+	if (zone) {
+		if (index < activeSchedule->zoneCount) {
+			*zone = activeSchedule->zones[index];
+		} else {
+			memset(zone, 0, sizeof(*zone));
+		}
+	}
+	portEXIT_CRITICAL(&scheduleMux);
+	return index;
+}
+
+// Copy a row of the published zone table. Returns false past the last row.
+bool getZone(uint8_t index, Zone &zone, ZoneLabel *label) {
+	portENTER_CRITICAL(&scheduleMux);
+	bool found = index < activeSchedule->zoneCount;
+	if (found) {
+		zone = activeSchedule->zones[index];
+		if (label) {
+			*label = activeSchedule->labels[index];
+		}
+	}
+	portEXIT_CRITICAL(&scheduleMux);
+	return found;
+}
+
+// Render a compiled zone in the same JSON shape as a zone_data.json row
+String zoneToJson(uint8_t index) {
+	Zone zone;
+	ZoneLabel label;
+	if (!getZone(index, zone, &label)) {
+		return "{}";
+	}
+
+	char days[8];
+	uint8_t n = 0;
+	for (uint8_t day = 0; day < 7; day++) {
+		if (zone.dayMask & (1 << day)) {
+			days[n++] = '0' + day;
+		}
+	}
+	days[n] = '\0';
+
+	uint16_t start = zone.startMinute == ZONE_CHAINED ? 0 : zone.startMinute;
+
+	JSONVar json;
+	json["znumber"] = String(zone.znumber);
+	json["zname"] = label.zname;
+	json["controller"] = label.controller;
+	json["days"] = days;
+	json["avgpsi"] = String(zone.avgPsi);
+	char startText[8];	// Sized for any uint16_t minute, not just those of one day
+	snprintf(startText, sizeof(startText), "%02u:%02u", start / 60, start % 60);
+	json["start"] = startText;
+	char runText[11];	// Any unsigned int, as %u sees runMinutes
+	snprintf(runText, sizeof(runText), "%02u", zone.runMinutes);
+	json["run"] = runText;
+
+	return JSON.stringify(json);
+}
@@ -0,0 +1,43 @@
+#ifndef ZONE_SCHEDULE_H
+#define ZONE_SCHEDULE_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define MAX_ZONES 32			// Zone table rows kept in RAM
+#define ZONE_NAME_LEN 24		// Max zone name length incl. terminator
+#define ZONE_CTRL_LEN 12		// Max controller name length incl. terminator
+#define ZONE_CHAINED 0xFFFF		// startMinute of a zone with a "00:00" start (runs after the previous zone)
+#define MINUTES_PER_WEEK 10080
+#define MAX_ZONE_INTERVALS (MAX_ZONES * 7 + 8)	// Every zone on every day, plus splits at the week wrap
+
+// Compiled zone table entry, one per row of zone_data.json
+struct Zone {
+	uint8_t znumber;		// Zone number on the controller
+	uint8_t dayMask;		// Bit n set = zone runs on day n (0 = Sunday)
+	uint16_t startMinute;	// Minutes after midnight or ZONE_CHAINED
+	uint16_t runMinutes;	// Run time in minutes
+	uint8_t avgPsi;			// Expected pressure while the zone runs
+} __attribute__((packed));
+
+// Text fields of a zone, only needed when the zone is shown to a client
+struct ZoneLabel {
+	char zname[ZONE_NAME_LEN];
+	char controller[ZONE_CTRL_LEN];
+};
+
+// One run of a zone on the weekly timeline, in minutes after Sunday 00:00
+struct ZoneInterval {
+	uint16_t start;	 // First minute the zone runs
+	uint16_t end;		 // First minute after the zone stops
+	uint8_t zone;		 // Row of the zone table
+} __attribute__((packed));
+
+// Function prototypes
+bool compileZoneTable(const String &zoneData);
+bool loadZoneSchedule(fs::FS &fs, const char *path);
+uint8_t findActiveZone(uint16_t minuteOfWeek, Zone *zone = nullptr);
+bool getZone(uint8_t index, Zone &zone, ZoneLabel *label = nullptr);
+String zoneToJson(uint8_t index);
+
+#endif	// ZONE_SCHEDULE_H
@@ -66,19 +66,40 @@ THE SOFTWARE.
 #include <Wire.h>
 #include <time.h>
 #include <cmath>	// For fabs()
+#include <memory>
 #include <vector>
+#include "AdcSampler.h"
+#include "AdcToPsi.h"
+#include "Clock.h"
+#include "Decimator.h"
 #include "FS.h"
+#include "FileStream.h"
+#include "HttpCache.h"
+#include "LogArchive.h"
+#include "LogDirectory.h"
+#include "LogPath.h"
+#include "LogRetention.h"
+#include "LogFormat.h"
+#include "LogIndex.h"
+#include "LogRange.h"
+#include "LogWriter.h"
 #include "OledDisplay.h"
+#include "RingBuffer.h"
+#include "Rollup.h"
 #include "SD.h"
 #include "SPIFFS.h"
+#include "SdCardUtils.h"
+#include "StaticAssets.h"
+#include "TransientCapture.h"
+#include "ZoneSchedule.h"
 
 #define SD_CS 5					// Define CS pin for the SD card module
-#define ADC_SAMPLES 10			// number of sensor ADC samples to average
 #define SAMPLE_RATE 30000		// PSI sample rate 30 sec in msec
 #define ZONES_ALL_OFF_PSI 59	// All Zones off if above this value
+#define PUMP_CUT_IN_PSI 41		// Pump turns on below this value
+#define CAPTURE_SLOPE_PSI 3		// Capture a transient if pressure moves this much in 50 ms
 #define SENSOR_PIN 36	 		// Water Pressure sensor on pin GPIO36, ADC0, pin 3
 #define TIME_ZONE -3600 * 6		// Mountain Time
-#define BUFFER_SIZE 256			// Buffer size for streaming file contents to client in chunks
 
 // Since this pressure sensor is designed to run on 5.0 volts but is running
 // on 3.3v here, then scale: Pressure Sensor specification:
@@ -99,7 +120,6 @@ AsyncWebServer server(80);
 AsyncEventSource events("/events");
 
 // Timer variables
-unsigned long lastTime = 0;
 unsigned long timerDelay = SAMPLE_RATE;
 
 // ============ constants ================
@@ -126,32 +146,38 @@ float calibOffset = 0.0;
 float calibFloat = 0.0;
 int sensorRateSec = 30; 
 
-int lastActiveZoneIndex = 0;	// To track the last active zone
-int zoneStartHour = 0;
-int zoneStartMinute = 0;
-int runTime = 0;
 bool connected = false;
 
-bool sdCardLock = false;
+Decimator pressureDecimator;	// Raw samples since the last reading
 
-uint8_t activeZoneNumber = 0;	 // 0 = all off
-uint32_t adcReading = 0;
+// One sample interval's reading, passed from the sampling stage to the SD
+// writer and to loop()
+struct Reading {
+	LogRecord record;
+	uint32_t readingId;
+	int16_t minCentiPsi;	// Trough of the interval
+	int16_t maxCentiPsi;	// Peak of the interval
+	uint8_t zoneIndex;		// Row of the zone table running, 0 = all off
+	char fileName[32];		// Path of the daily log the record belongs to
+};
+
+RingBuffer<Reading, 16> logQueue;			// Sampling stage -> SD writer task
+RingBuffer<Reading, 8> displayQueue;	// Sampling stage -> loop() for SSE and OLED
 
 // Define NTP Client to get time
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, "pool.ntp.org", TIME_ZONE, 60000);	 // Synchronize time every minute
 
-// Variables to save date and time
-String formattedDate = "";
-String currentDayStamp = "";
-String currentTimeStamp = "";
+// Daily log file name
 String currentDailyFilename = "";
+SemaphoreHandle_t filenameMutex = NULL;	// Guards currentDailyFilename across tasks
+uint32_t nextRolloverEpoch = 0;					// Start of the next log day, 0 = recheck on the next tick
 
 IPAddress IPmessage;
 size_t fileSize = 0;
 
-// Save reading number on RTC memory
-RTC_DATA_ATTR int readingID = 0;
+// Number of the next reading, continued from the newest log at boot
+uint32_t readingID = 0;
 
 /***********************************************/
 // Function to send log messages to the client
@@ -163,32 +189,17 @@ void logMsg(const char *logMessage) {
 	events.send(logMessage, "server-log", millis());
 }
 
-// Map floating point numbers
-// mapFLoat is from https://github.com/radishlogic/MapFloat
-float mapFloat(float value, float fromLow, float fromHigh, float toLow, float toHigh) {
-	return (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
-}
-
-void getTimeStamp(String &day, String &time) {
-	timeClient.update();
-
-	// Get the epoch time adjusted for the timezone offset
-	unsigned long epochTime = timeClient.getEpochTime();
-
-	// Convert epoch time to local time
-	struct tm *ptm = gmtime((time_t *)&epochTime);
-
-	// Extract date and time components
-	char dateBuffer[11];
-	char timeBuffer[9];
-	strftime(dateBuffer, sizeof(dateBuffer), "%Y-%m-%d", ptm);
-	strftime(timeBuffer, sizeof(timeBuffer), "%H:%M:%S", ptm);
-
-	day = String(dateBuffer);
-	time = String(timeBuffer);
-
-	// Serial.println("DayStamp: " + day);
-	// Serial.println("TimeStamp: " + time);
+// Run an SD job for a web request. The web server task only waits
+// SD_WEB_WAIT for the job to start; if the card stays busy with other jobs,
+// the request is answered 503 and false is returned.
+bool sdRunForRequest(AsyncWebServerRequest *request, SdPriority priority, const std::function<void()> &job) {
+	if (sdRun(priority, job, SD_WEB_WAIT)) {
+		return true;
+	}
+	AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "SD card busy, try again");
+	response->addHeader("Retry-After", "1");
+	request->send(response);
+	return false;
 }
 
 String loadZoneTable(fs::FS &fs, const char *filePath) {
@@ -209,179 +220,11 @@ String loadZoneTable(fs::FS &fs, const char *filePath) {
 	return zoneData;
 }
 
-int calculateDayOfWeek(int year, int month, int day) {
-	// Adjust months for Zeller's Congruence (March = 3, ..., December = 12, January = 13, February = 14)
-	if (month < 3) {
-		month += 12;
-		year -= 1;
-	}
-
-	int k = year % 100;	 // The year within the century
-	int j = year / 100;	 // The zero-based century
-
-	// Zeller's formula to calculate the day of the week
-	int dayOfWeek = (day + ((13 * (month + 1)) / 5) + k + (k / 4) + (j / 4) + (5 * j)) % 7;
-
-	// Zeller's Congruence gives 0 = Saturday, adjust to match 0 = Sunday
-	dayOfWeek = (dayOfWeek + 6) % 7;
-
-	return dayOfWeek;
-}
-
-bool isDayMatching(String days, int currentDay) {
-	// Convert currentDay to a string
-	String currentDayStr = String(currentDay);
-	// logMsg(("Checking days: " + days).c_str());
-	// logMsg(("Current day: " + currentDayStr).c_str());
-
-	// Iterate through each character in the days string
-	for (int i = 0; i < days.length(); i++) {
-		// logMsg(("Checking against day: " + String(days.charAt(i))).c_str());
-		//   If any character in the days string matches the current day, return true
-		if (days.charAt(i) == currentDayStr.charAt(0)) {
-			// logMsg("Matched day");
-			return true;
-		}
-	}
-	// If no match was found, return false
-	// logMsg("No day matched");
-	return false;
-}
-
-bool programRunning = false;
-String checkActiveZone() {
-	// Extract the date part from currentTimeStamp (assumed format: "HH:MM:SS")
-	// CurrentDayStamp: "YYYY-MM-DD"
-	// Not using Seconds
-	int year = currentDayStamp.substring(0, 4).toInt();
-	int month = currentDayStamp.substring(5, 7).toInt();
-	int day = currentDayStamp.substring(8, 10).toInt();
-	int currentHourInt = currentTimeStamp.substring(0, 2).toInt();
-	int currentMinuteInt = currentTimeStamp.substring(3, 5).toInt();
-	// logMsg(("Current Year: " + String(year)).c_str());
-	// logMsg(("Current Month: " + String(month)).c_str());
-	// logMsg(("Current Day: " + String(day)).c_str());
-	// logMsg(("Current Hour: " + String(currentHourInt)).c_str());
-	// logMsg(("Current Minute: " + String(currentMinuteInt)).c_str());
-
-	// Calculate the day of the week based on the date (0 = Sunday, 1 = Monday, ..., 6 = Saturday)
-	int currentDay = calculateDayOfWeek(year, month, day);
-
-	// Load zone data from the file system
-	String zoneData = loadZoneTable(SD, "/zone_data.json");
-
-	// Parse the JSON data
-	JSONVar zones = JSON.parse(zoneData);
-	if (JSON.typeof(zones) == "undefined") {
-		logMsg("Failed to parse JSON");
-		return "{}";	// Return empty JSON if parsing fails
-	}
-
-	// Check if there are zones available
-	if (zones.length() == 0) {
-		logMsg("No zones available");
-		return "{}";	// Return empty JSON if no zones are available
-	}
-
-	JSONVar activeZone;
-
-	if (programRunning) {
-		// If zone has no specific start time and is already selected, consider the runtime
-		logMsg(("Cur Min: " + String(currentMinuteInt)).c_str());
-		logMsg(("Cur Hour: " + String(currentHourInt)).c_str());
-		logMsg(("St Min: " + String(zoneStartMinute)).c_str());
-		logMsg(("St Hour: " + String(zoneStartHour)).c_str());
-		int elapsedMinutes = (currentHourInt * 60 + currentMinuteInt) - (zoneStartHour * 60 + zoneStartMinute);
-		logMsg(("Elapsed Minutes: " + String(elapsedMinutes)).c_str());
-
-		// If the current zone has finished running
-		if (elapsedMinutes >= runTime) {
-			// Move to the next zone
-			lastActiveZoneIndex += 1;
-
-			// Check if the next zone exists
-			if (lastActiveZoneIndex >= zones.length()) {
-				logMsg("No more zones, resetting to zone 0");
-				lastActiveZoneIndex = 0;
-				programRunning = false;
-				return JSON.stringify(zones[0]);
-			}
-
-			// Load the next zone
-			String startTime = String((const char *)zones[lastActiveZoneIndex]["start"]);
-			int runMinutes = String((const char *)zones[lastActiveZoneIndex]["run"]).toInt();
-
-			// If the next zone has an empty start time ("") and programRunning is true, start it immediately
-			if (startTime == "00:00" && programRunning) {
-				logMsg("Next zone has no start time, starting immediately");
-				activeZone = zones[lastActiveZoneIndex];
-				programRunning = true;
-				runTime = runMinutes;
-				zoneStartHour = currentHourInt;	 // Set current time as the start time
-				zoneStartMinute = currentMinuteInt;
-			} else if (startTime != "00:00") {
-				// If the next zone has a valid start time, check if it matches
-				zoneStartHour = startTime.substring(0, 2).toInt();
-				zoneStartMinute = startTime.substring(3, 5).toInt();
-
-				if (currentHourInt == zoneStartHour && currentMinuteInt == zoneStartMinute) {
-					logMsg("Next zone start time matches, starting");
-					activeZone = zones[lastActiveZoneIndex];
-					programRunning = true;
-					runTime = runMinutes;
-				} else {
-					// If the start time does not match, end the program and return to zone 0
-					logMsg("Next zone start time does not match, returning to zone 0");
-					lastActiveZoneIndex = 0;
-					programRunning = false;
-					return JSON.stringify(zones[0]);
-				}
-			}
-		}
-	} else {
-		// Iterate through zones to find a match
-		for (int i = lastActiveZoneIndex; i < zones.length(); i++) {
-			String znumber = String((const char *)zones[i]["znumber"]);
-			String zname = String((const char *)zones[i]["zname"]);
-			String controller = String((const char *)zones[i]["controller"]);
-			String days = String((const char *)zones[i]["days"]);
-			String startTime = String((const char *)zones[i]["start"]);
-			int runMinutes = String((const char *)zones[i]["run"]).toInt();
-
-			// Check if the current day is in the zone's days
-			if (isDayMatching(days, currentDay)) {
-				//logMsg("Day Matches");
-				// Check if the start time matches if it's provided
-				if (startTime != "00:00") {
-					// If start time is provided, check if it matches the current time
-					zoneStartHour = startTime.substring(0, 2).toInt();
-					zoneStartMinute = startTime.substring(3, 5).toInt();
-
-					if (currentHourInt == zoneStartHour && currentMinuteInt == zoneStartMinute) {
-						logMsg("Matched start time, starting zone");
-						activeZone = zones[i];
-						lastActiveZoneIndex = i;
-						programRunning = true;
-						runTime = runMinutes;
-						break;
-					}
-				}
-			}
-		}
-	}
-
-	// If no zone matches, reset to zone 0
-	if (!programRunning) {
-		logMsg("No zone matched, returning to zone 0");
-		lastActiveZoneIndex = 0;
-		return JSON.stringify(zones[0]);
-	}
-
-	// Return the active zone
-	return JSON.stringify(activeZone);
-}
-
+// Requests that match no endpoint are for the web assets in SPIFFS
 void notFound(AsyncWebServerRequest *request) {
+	if (request->method() == HTTP_GET && sendStaticAsset(request, SPIFFS, request->url())) {
+		return;
+	}
 	request->send(404, "text/plain", "Not found");
 }
 
@@ -409,34 +252,51 @@ void initWiFi() {
 
 // Function to read the stored calibration offset value from SD
 String loadCalibOffset() {
-	File file = SD.open("/caliboffset.txt", FILE_READ);
-	if (!file) {
-		Serial.println("Failed to open calibration file for reading");
-		return "";
-	}
+	String calibOffsetValue = "";
+	sdRun(SD_PRIORITY_READ, [&]() {
+		File file = SD.open("/caliboffset.txt", FILE_READ);
+		if (!file) {
+			Serial.println("Failed to open calibration file for reading");
+			return;
+		}
 
-	fileSize = file.size();
-	String calibOffsetValue = file.readStringUntil('\n');
-	file.close();
+		fileSize = file.size();
+		calibOffsetValue = file.readStringUntil('\n');
+		file.close();
+	});
 	return calibOffsetValue;
 }
 
 // Function to store the calibration offset value in SD
 bool saveCalibOffset(float calibOffsetValue) {
-	File file = SD.open("/caliboffset.txt", FILE_WRITE);
-	if (!file) {
+	bool saved = false;
+	// Called by the calibration handler after it has replied, so a busy card
+	// fails the save instead of holding up the web server task
+	sdRun(SD_PRIORITY_WRITE, [&]() {
+		File file = SD.open("/caliboffset.txt", FILE_WRITE);
+		if (file) {
+			file.printf("%.1f", calibOffsetValue);	// Save the value with up to 1 decimal places
+			file.close();
+			saved = true;
+			updateLogDirectory(SD, "/caliboffset.txt");
+		}
+	}, SD_WEB_WAIT);
+	if (!saved) {
 		logMsg("Failed to open calibration file for writing");
 		Serial.println("Failed to open calibration file for writing");
 		return false;
 	}
 
-	file.printf("%.1f", calibOffsetValue);	// Save the value with up to 1 decimal places
-	file.close();
 	logMsg("Calibration value saved");
 	Serial.println("Calibration value saved: " + String(calibOffsetValue));
 	return true;
 }
 
+// Recompute the ADC to PSI table with the current calibration offset
+void rebuildPsiTable() {
+	buildPsiTable(sensorMinVoltage, sensorMaxVoltage, sensorMinPressure, sensorMaxPressure, calibOffset);
+}
+
 void handleSetCalibration(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
 	String body = "";
 	for (size_t i = 0; i < len; i++) {
@@ -447,6 +307,7 @@ void handleSetCalibration(AsyncWebServerRequest *request, uint8_t *data, size_t
 	if (body.toFloat() == 0.0) {
 		// Don't set calibFloat if value is 0.0
 		calibOffset = 0.0;	// reset calibOffset
+		rebuildPsiTable();
 		request->send(200, "text/plain", "0.0");
 		saveCalibOffset(calibOffset);
 	} else {
@@ -456,6 +317,7 @@ void handleSetCalibration(AsyncWebServerRequest *request, uint8_t *data, size_t
 		if (prevCalib != calibFloat) {
 			calibOffset = currentPressure - calibFloat;
 			prevCalib = calibFloat;
+			rebuildPsiTable();
 		}
 
 		String currentPressureStr = JSON.stringify(currentPressure - calibOffset);
@@ -467,29 +329,39 @@ void handleSetCalibration(AsyncWebServerRequest *request, uint8_t *data, size_t
 
 // Function to read the stored location from SD
 String loadLocation() {
-	File file = SD.open("/location.txt", FILE_READ);
-	if (!file) {
-		Serial.println("Failed to open location file for reading");
-		return "";
-	}
+	String locationValue = "";
+	sdRun(SD_PRIORITY_READ, [&]() {
+		File file = SD.open("/location.txt", FILE_READ);
+		if (!file) {
+			Serial.println("Failed to open location file for reading");
+			return;
+		}
 
-	fileSize = file.size();
-	String locationValue = file.readStringUntil('\n');
-	file.close();
+		fileSize = file.size();
+		locationValue = file.readStringUntil('\n');
+		file.close();
+	});
 	return locationValue;
 }
 
 // Function to store the Location in SD
 bool saveLocation(String locationValue) {
-	File file = SD.open("/location.txt", FILE_WRITE);
-	if (!file) {
+	bool saved = false;
+	sdRun(SD_PRIORITY_WRITE, [&]() {
+		File file = SD.open("/location.txt", FILE_WRITE);
+		if (file) {
+			file.printf("%s", locationValue);
+			file.close();
+			saved = true;
+			updateLogDirectory(SD, "/location.txt");
+		}
+	});
+	if (!saved) {
 		logMsg("Failed to open location file for writing");
 		Serial.println("Failed to open location file for writing");
 		return false;
 	}
 
-	file.printf("%s", locationValue);
-	file.close();
 	logMsg("Location value saved");
 	Serial.println("Location value saved: " + String(locationValue));
 	return true;
@@ -502,7 +374,11 @@ void handleSetLocation(AsyncWebServerRequest *request, uint8_t *data, size_t len
 		body += (char)data[i];
 	}
 
-	if (saveLocation(body)) {
+	bool saved = false;
+	if (!sdRunForRequest(request, SD_PRIORITY_WRITE, [&]() { saved = saveLocation(body); })) {
+		return;
+	}
+	if (saved) {
 		request->send(200, "text/plain", body);
 	} else {
 		request->send(500, "text/plain", "Failed to save location value");
@@ -511,29 +387,39 @@ void handleSetLocation(AsyncWebServerRequest *request, uint8_t *data, size_t len
 
 // Function to read the stored Sensor Sample Rate from SD
 String loadSensorRate() {
-	File file = SD.open("/sensor_rate.txt", FILE_READ);
-	if (!file) {
-		Serial.println("Failed to open Senssor Rate file for reading");
-		return "";
-	}
+	String sensorRateValue = "";
+	sdRun(SD_PRIORITY_READ, [&]() {
+		File file = SD.open("/sensor_rate.txt", FILE_READ);
+		if (!file) {
+			Serial.println("Failed to open Senssor Rate file for reading");
+			return;
+		}
 
-	fileSize = file.size();
-	String sensorRateValue = file.readStringUntil('\n');
-	file.close();
+		fileSize = file.size();
+		sensorRateValue = file.readStringUntil('\n');
+		file.close();
+	});
 	return sensorRateValue;
 }
 
 // Function to store the Sensor Sample Rate in SD
 bool saveSensorRate(String sensorRateValue) {
-	File file = SD.open("/sensor_rate.txt", FILE_WRITE);
-	if (!file) {
+	bool saved = false;
+	sdRun(SD_PRIORITY_WRITE, [&]() {
+		File file = SD.open("/sensor_rate.txt", FILE_WRITE);
+		if (file) {
+			file.printf("%s", sensorRateValue);
+			file.close();
+			saved = true;
+			updateLogDirectory(SD, "/sensor_rate.txt");
+		}
+	});
+	if (!saved) {
 		logMsg("Failed to open location file for writing");
 		Serial.println("Failed to open sensor rate file for writing");
 		return false;
 	}
 
-	file.printf("%s", sensorRateValue);
-	file.close();
 	logMsg("Sensor rate value saved");
 	Serial.println("Sensor rate value saved: " + String(sensorRateValue));
 	return true;
@@ -548,7 +434,11 @@ void handleSetSensorRate(AsyncWebServerRequest *request, uint8_t *data, size_t l
 
 	sensorRateSec = (unsigned long)body.toInt();
 
-	if (saveSensorRate(body)) {
+	bool saved = false;
+	if (!sdRunForRequest(request, SD_PRIORITY_WRITE, [&]() { saved = saveSensorRate(body); })) {
+		return;
+	}
+	if (saved) {
 		request->send(200, "text/plain", body);
 	} else {
 		request->send(500, "text/plain", "Failed to save sensor rate");
@@ -556,142 +446,356 @@ void handleSetSensorRate(AsyncWebServerRequest *request, uint8_t *data, size_t l
 	timerDelay = sensorRateSec * 1000; // convert to msec
 }
 
-String generateDailyFilename() {
-	getTimeStamp(currentDayStamp, currentTimeStamp);
+// Read the retention tiers ("rawDays,minuteDays") from SD, the defaults are
+// kept if there are none
+void loadRetention() {
+	String retentionValue = "";
+	sdRun(SD_PRIORITY_READ, [&]() {
+		File file = SD.open(RETENTION_PATH, FILE_READ);
+		if (file) {
+			retentionValue = file.readStringUntil('\n');
+			file.close();
+		}
+	});
+	int comma = retentionValue.indexOf(',');
+	if (comma > 0) {
+		setLogRetention(retentionValue.substring(0, comma).toInt(), retentionValue.substring(comma + 1).toInt());
+	}
+}
 
-	// Get the current epoch time
-	unsigned long epochTime = timeClient.getEpochTime();
+// Function to handle the POST request for setting the retention tiers
+void handleSetRetention(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+	String body = "";
+	for (size_t i = 0; i < len; i++) {
+		body += (char)data[i];
+	}
+
+	int comma = body.indexOf(',');
+	if (comma <= 0) {
+		request->send(400, "text/plain", "Expected rawDays,minuteDays");
+		return;
+	}
+	setLogRetention(body.substring(0, comma).toInt(), body.substring(comma + 1).toInt());
+
+	bool saved = false;
+	auto save = [&]() {
+		File file = SD.open(RETENTION_PATH, FILE_WRITE);
+		if (file) {
+			file.print(body);
+			file.close();
+			saved = true;
+			updateLogDirectory(SD, RETENTION_PATH);
+		}
+	};
+	if (!sdRunForRequest(request, SD_PRIORITY_WRITE, save)) {
+		return;
+	}
+	if (!saved) {
+		logMsg("Failed to open retention file for writing");
+		request->send(500, "text/plain", "Failed to save retention");
+		return;
+	}
+	logMsg("Retention saved");
+	startRetentionPass(clockEpoch());
+	request->send(200, "application/json", retentionJson());
+}
 
-	// Extract the hour from the time string
-	int currentHour = currentTimeStamp.substring(0, 2).toInt();
+// Daily log name, YYYYMMDD.bin, of the log day now falls in
+String generateDailyFilename(const ClockTime &now) {
+	return logDayName(logDayKey(now), LOG_EXTENSION);
+}
 
-	// Extract the day, month, and year from the date string
-	int year = currentDayStamp.substring(2, 4).toInt();	 // last two digits of the year
-	int month = currentDayStamp.substring(5, 7).toInt();
-	int dayOfMonth = currentDayStamp.substring(8, 10).toInt();
+// Thread-safe copy of currentDailyFilename
+String getDailyFilename() {
+	xSemaphoreTake(filenameMutex, portMAX_DELAY);
+	String fileName = currentDailyFilename;
+	xSemaphoreGive(filenameMutex);
+	return fileName;
+}
 
-	// If the time is before 6:00 AM, use the previous day's date for the filename
-	if (currentHour < 6) {
-		time_t previousDayEpoch = epochTime - 86400;	// subtract one day (86400 seconds)
-		struct tm *ptm = gmtime(&previousDayEpoch);
+// Path of the current daily log, /log/YYYY/MM/YYYYMMDD.bin
+String getDailyPath() {
+	return logDayPath(getDailyFilename());
+}
 
-		year = ptm->tm_year % 100;
-		month = ptm->tm_mon + 1;
-		dayOfMonth = ptm->tm_mday;
+void setDailyFilename(const String &fileName) {
+	xSemaphoreTake(filenameMutex, portMAX_DELAY);
+	currentDailyFilename = fileName;
+	xSemaphoreGive(filenameMutex);
+}
+
+// Switch to the next daily log once the clock reaches the start of the next
+// log day. Until then this is a single compare per tick.
+void checkDailyRollover(const ClockTime &now) {
+	if (now.epoch < nextRolloverEpoch) {
+		return;
 	}
+	nextRolloverEpoch = logDayStart(now.epoch) + 86400UL;
+
+	String fileName = generateDailyFilename(now);
+	if (fileName != getDailyFilename()) {
+		setDailyFilename(fileName);
+		Serial.println("Daily filename updated: " + fileName);
+	}
+}
 
-	// Format the filename as DDMMYY.txt
-	char filename[12];
-	snprintf(filename, sizeof(filename), "%02d%02d%02d.txt", dayOfMonth, month, year);
+// Create a daily log with its header, unless it already exists. The file is
+// created at its worst case size, a record every sample interval for the
+// whole day, and trimmed when the day is closed.
+void startDailyLog(const String &fileName, uint32_t dayStart, uint32_t firstReadingId) {
+	uint32_t reserveRecords = 86400000UL / max(timerDelay, 1000UL) + 1;
+	sdRun(SD_PRIORITY_WRITE, [&]() {
+		// A day started by older firmware is moved to its new place first
+		migrateLogDay(SD, fileName);
+		if (SD.exists(fileName.c_str())) {
+			return;
+		}
+		if (!makeLogDayDir(SD, fileName) || !createLogFile(SD, fileName.c_str(), dayStart, firstReadingId, reserveRecords)) {
+			logMsg("Failed to create the daily log file");
+		} else {
+			Serial.println("Created new daily log file");
+			logMsg("Created new daily log file");
+			updateLogDirectory(SD, fileName.c_str());
+		}
+	});
+}
 
-	return String(filename);
+// Find the readingID to continue from in the newest daily log, cutting off a
+// record torn by a power cut. RTC memory doesn't survive one.
+void recoverNewestLog() {
+	LogDirEntry entry;
+	if (!lastLogDirEntry(entry)) {
+		return;
+	}
+	sdRun(SD_PRIORITY_WRITE, [&]() {
+		String path = resolveLogPath(SD, entry.name);
+		uint32_t nextReadingId;
+		if (recoverLogTail(SD, path.c_str(), nextReadingId)) {
+			readingID = max(readingID, nextReadingId);
+			updateLogDirectory(SD, path.c_str());
+		} else {
+			Serial.printf("Failed to recover %s\n", path.c_str());
+		}
+	});
+	Serial.printf("Continuing from reading %lu\n", (unsigned long)readingID);
 }
 
-void updateDailyFilename() {
-	// Get the current time from NTP
-	timeClient.update();
-	time_t now = timeClient.getEpochTime();
-	struct tm *timeinfo = localtime(&now);
-
-	// Check if it is 6:00 AM
-	if (timeinfo->tm_hour == 6 && timeinfo->tm_min == 0) {
-		// Update the daily filename
-		currentDailyFilename = generateDailyFilename();
-		Serial.println("Daily filename updated: " + currentDailyFilename);
+// Move the raw samples from the sampler task into the decimator
+void drainAdcSamples() {
+	uint16_t adcCode;
+	while (adcRing.pop(adcCode)) {
+		// ADC correction, pressure mapping and calibration offset are folded into psiTable
+		int16_t centiPsi = adcToCentiPsi(adcCode);
+		pressureDecimator.add(centiPsi);
+		captureSample(centiPsi);
 	}
 }
 
-// Declare readingsJson as a global variable
-JSONVar readingsJson;
+// Save a completed transient capture
+void saveTransientCapture() {
+	if (!captureReady()) {
+		return;
+	}
+	unsigned long epochTime = clockEpoch();
+	sdRun(SD_PRIORITY_WRITE, [epochTime]() { writeCapture(SD, epochTime); });
+	logMsg("Pressure transient captured");
+}
 
-String getSensorReading() {
-	adcReading = analogRead(SENSOR_PIN);
+// Take the reading for one sample interval
+void getSensorReading(Reading &reading, const ClockTime &now) {
+	// Average, peak and trough of every raw sample since the last reading
+	drainAdcSamples();
+	DecimatedSample sample = pressureDecimator.take();
+	if (sample.count == 0) {
+		// Sampler hasn't delivered anything, fall back to a single read
+		int16_t centiPsi = adcToCentiPsi(analogRead(SENSOR_PIN));
+		sample = {centiPsi, centiPsi, centiPsi, 1};
+	}
 
-	// Get an average of XX samples from ADC
-	for (unsigned int i = 0U; i < ADC_SAMPLES; ++i) {
-		adcReading = adcReading + analogRead(SENSOR_PIN);
+	// Find the running zone on the compiled weekly zone timeline
+	Zone zone;
+	reading.zoneIndex = findActiveZone(now.minuteOfWeek, &zone);
+	reading.minCentiPsi = sample.min;
+	reading.maxCentiPsi = sample.max;
+	reading.readingId = readingID++;
+	strlcpy(reading.fileName, getDailyPath().c_str(), sizeof(reading.fileName));
+
+	// Create the record to be logged
+	LogRecord &record = reading.record;
+	memset(&record, 0, sizeof(record));
+	record.epoch = now.epoch;
+	record.centiPsi = sample.mean;
+	record.zone = zone.znumber;
+	record.avgPsi = zone.avgPsi;
+	record.zoneRow = reading.zoneIndex;
+	if (record.zone != 0 && abs(record.centiPsi - record.avgPsi * 100) > 200) {
+		record.flags |= LOG_FLAG_OUT_OF_BAND;
 	}
-	adcReading = adcReading / ADC_SAMPLES;
+}
 
-	// Apply ADC correction and calculate voltage and pressure
-	double voltage = -0.000000000000016 * pow(adcReading, 4) +
-									 0.000000000118171 * pow(adcReading, 3) -
-									 0.000000301211691 * pow(adcReading, 2) +
-									 0.001109019271794 * adcReading + 0.034143524634089;
+// Create the JSON string with current pressure and active zone details
+String readingToJson(const Reading &reading) {
+	return "{\"Current Pressure\":\"" + String(reading.record.centiPsi / 100) +
+				 "\",\"Min Pressure\":\"" + String(reading.minCentiPsi / 100.0f, 1) +
+				 "\",\"Max Pressure\":\"" + String(reading.maxCentiPsi / 100.0f, 1) +
+				 "\",\"Active Zone\":" + zoneToJson(reading.zoneIndex) + "}";
+}
+
+void logData(const Reading &reading) {
+	char dataMessage[64];
+	formatLogRecordCsv(reading.record, reading.readingId, dataMessage, sizeof(dataMessage));
+	Serial.print("Saved data: ");
+	Serial.println(dataMessage);
 
-	currentPressure = mapFloat(voltage, sensorMinVoltage, sensorMaxVoltage, sensorMinPressure, sensorMaxPressure);
+	// Buffer the record, it is written to the daily log file in batches
+	if (!logRecord(reading.fileName, reading.record, logDayStart(reading.record.epoch), reading.readingId)) {
+		logMsg("Log buffer full, record dropped");
+	}
+}
 
-	// Update calibration offset if necessary
-	if (prevCalib != calibFloat) {
-		calibOffset = currentPressure - calibFloat;
-		prevCalib = calibFloat;
+// Write the buffered log records when they are due
+void flushLogIfDue() {
+	if (logFlushDue() && !flushLog()) {
+		logMsg("Failed to write log records");
 	}
-	currentPressure = currentPressure - calibOffset;	// currentPressure is global variable
+}
 
-	// Create the JSON object with current pressure and active zone details
-	// Call checkActiveZone to get the active zone details
-	String activeZoneJsonString = checkActiveZone();
+// Close a finished log day: put the day summary in its header, give back its
+// reserved space, add it to the rollups, queue its archive and age the older
+// days. closedAt is the local time the day was closed.
+void closeDailyLog(const char *closedFile, uint32_t closedAt) {
+	bool summarized = false;
+	sdRun(SD_PRIORITY_WRITE, [&]() {
+		summarized = writeLogSummary(SD, closedFile, closedAt);
+		// The space reserved for records that never came goes back to the card
+		if (!trimLogFile(SD, closedFile)) {
+			Serial.printf("Failed to trim %s\n", closedFile);
+		}
+		updateLogDirectory(SD, closedFile);
+	});
+	if (!summarized) {
+		Serial.printf("Failed to write the day summary of %s\n", closedFile);
+	}
 
-	// Parse the activeZoneJsonString into JSONVar
-	JSONVar activeZoneJson = JSON.parse(activeZoneJsonString);
-	readingsJson["Current Pressure"] = String((int)currentPressure);
-	readingsJson["Active Zone"] = activeZoneJson;	 // Add the active zone details to the JSON
+	// Add the day and its zones to the rollups used by the month and year views
+	bool rolledUp = false;
+	sdRun(SD_PRIORITY_WRITE, [&]() {
+		rolledUp = appendDayRollup(SD, closedFile, ROLLUP_PATH, PUMP_CUT_IN_PSI * 100);
+		updateLogDirectory(SD, ROLLUP_PATH);
+	});
+	if (!rolledUp) {
+		Serial.printf("Failed to add %s to the rollups\n", closedFile);
+	}
 
-	// Convert to a JSON string and return
-	return JSON.stringify(readingsJson);
+	// Compress the closed day for downloads, in slices from sdWriterTask
+	if (!queueLogArchive(closedFile)) {
+		Serial.printf("Archive queue full, %s stays uncompressed\n", closedFile);
+	}
+
+	// Move the days that have aged into a coarser tier
+	startRetentionPass(closedAt);
 }
 
-void logData() {
-	if (sdCardLock) {
-		Serial.println("SD card is busy");
+// End of a log day: write the day's last records, close the day and start
+// the next day's file
+void rolloverDailyLog(const char *closedFile, const Reading &firstReading) {
+	if (!flushLog()) {
+		logMsg("Failed to write log records");
+	}
+	closeDailyLog(closedFile, firstReading.record.epoch);
+	startDailyLog(firstReading.fileName, logDayStart(firstReading.record.epoch), firstReading.readingId);
+}
+
+// sdWriterTask only closes the day it was filling, so a reset across the
+// start of a log day leaves the previous day open. Close it at boot. Before
+// the clock is set the day looks current and is left alone.
+void closeStaleLog() {
+	LogDirEntry entry;
+	if (!lastLogDirEntry(entry)) {
 		return;
 	}
+	uint32_t now = clockEpoch();
+	String path;
+	bool stale = false;
+	sdRun(SD_PRIORITY_READ, [&]() {
+		path = resolveLogPath(SD, entry.name);
+		stale = isLogLeftOpen(SD, path.c_str(), logDayStart(now));
+	});
+	if (stale) {
+		Serial.printf("Closing %s, left open by a reset\n", path.c_str());
+		closeDailyLog(path.c_str(), now);
+	}
+}
 
-	// Lock the SD card
-	sdCardLock = true;
+// Sampling stage: decimates the raw samples, finds the active zone and hands
+// one reading per sample interval to the SD writer and to loop()
+void analyticsTask(void *param) {
+	unsigned long lastTime = millis();
 
-	// Get the current timestamp
-	getTimeStamp(currentDayStamp, currentTimeStamp);
-	//int currentHourInt = currentTimeStamp.substring(0, 2).toInt();
-	//int currentMinuteInt = currentTimeStamp.substring(3, 5).toInt();
+	for (;;) {
+		drainAdcSamples();
 
-	// Extract the znumber field from the JSON
-	String activeZoneNum = String((const char *)readingsJson["Active Zone"]["znumber"]);
-	String activeZoneAvg = String((const char *)readingsJson["Active Zone"]["avgpsi"]);
+		// Pick up an NTP reply as soon as it arrives
+		if (timeClient.updateAsync() == NTP_UPDATE_DONE) {
+			clockSync(timeClient.getEpochTime());
+			nextRolloverEpoch = 0;	// Recheck the log day against the corrected time
+		}
 
-	// Create the data message to be logged
-	String dataMessage = String(readingID) + "," + 
-								currentDayStamp + "," +
-								currentTimeStamp + "," + 
-								String(currentPressure) + "," +
-								activeZoneNum + "," +
-								activeZoneAvg + "\r\n";
+		if ((millis() - lastTime) >= timerDelay) {
+			// Keep a fixed cadence, only resync after falling a whole period behind
+			lastTime += timerDelay;
+			if (millis() - lastTime >= timerDelay) {
+				lastTime = millis();
+			}
 
-	Serial.print("Saved data: ");
-	Serial.println(dataMessage);
+			// One time base for everything done this tick
+			ClockTime now = clockNow();
 
-	// Open or create the daily log file in append mode
-	String fileName = "/" + currentDailyFilename;
-	File file = SD.open(fileName.c_str(), FILE_APPEND);
+			// Check if it's time to start the next daily log
+			checkDailyRollover(now);
 
-	if (!file) {
-		logMsg("Failed to open file for appending");
-		sdCardLock = false;
-		return;
+			Reading reading;
+			getSensorReading(reading, now);
+			if (!logQueue.push(reading)) {
+				Serial.println("Log queue full, reading dropped");
+			}
+			displayQueue.push(reading);
+		}
+		vTaskDelay(pdMS_TO_TICKS(20));
 	}
+}
 
-	// Append the data to the file
-	if (!file.print(dataMessage)) {
-		logMsg("Failed to append data");
+// SD writer stage: buffers readings into the daily log and writes captures,
+// so a slow SD card never holds up sampling
+void sdWriterTask(void *param) {
+	char currentFile[sizeof(Reading::fileName)] = "";	// Daily log being filled
+
+	for (;;) {
+		Reading reading;
+		while (logQueue.pop(reading)) {
+			// The first reading of a new log day closes the previous one
+			if (strcmp(reading.fileName, currentFile) != 0) {
+				if (currentFile[0] != '\0') {
+					rolloverDailyLog(currentFile, reading);
+				}
+				strlcpy(currentFile, reading.fileName, sizeof(currentFile));
+			}
+			logData(reading);
+		}
+		flushLogIfDue();
+		saveTransientCapture();
+		// One background job at a time, a slice per loop
+		if (!archiveLogSlice(SD) && !migrateLogSlice(SD)) {
+			compactLogSlice(SD);
+		}
+		vTaskDelay(pdMS_TO_TICKS(50));
 	}
+}
 
-	file.close();
-
-	// Increment the reading ID
-	readingID++;
-
-	// Unlock the SD card
-	sdCardLock = false;
+// Replace a file name from a client by its SD path, see resolveLogPath().
+// Returns false after answering 503 if the card is busy.
+bool resolveSdPath(AsyncWebServerRequest *request, String &fileName) {
+	return sdRunForRequest(request, SD_PRIORITY_READ, [&]() { fileName = resolveLogPath(SD, fileName); });
 }
 
 void deleteFileHandler(AsyncWebServerRequest *request) {
@@ -713,11 +817,31 @@ void deleteFileHandler(AsyncWebServerRequest *request) {
 			success = SPIFFS.remove(filename);
 		}
 		// Check if the file exists on SD card and try to delete it
-		else if (SD.exists(filename)) {
-			Serial.println("File found on SD card. Attempting to delete...");
-			success = SD.remove(filename);
-		} else {
-			Serial.println("File not found on either SPIFFS or SD card.");
+		else {
+			bool found = false;
+			auto remove = [&]() {
+				String path = resolveLogPath(SD, filename);
+				found = SD.exists(path);
+				if (found) {
+					success = SD.remove(path);
+				}
+				// A daily log's index and archive go with it
+				if (success && isBinaryLog(path)) {
+					SD.remove(logIndexPath(path));
+					SD.remove(logArchivePath(path));
+				}
+				if (success) {
+					removeFromLogDirectory(path.c_str());
+				}
+			};
+			if (!sdRunForRequest(request, SD_PRIORITY_WRITE, remove)) {
+				return;
+			}
+			if (found) {
+				Serial.println("File found on SD card. Deleted: " + String(success ? "yes" : "no"));
+			} else {
+				Serial.println("File not found on either SPIFFS or SD card.");
+			}
 		}
 
 		// Log the result of the deletion attempt
@@ -738,6 +862,7 @@ void deleteFileHandler(AsyncWebServerRequest *request) {
 // -------------------- SETUP ----------------------
 void setup() {
 	Serial.begin(9600);
+	filenameMutex = xSemaphoreCreateMutex();
 	initOledDisplay();
 
 	// Set up the WiFi
@@ -751,6 +876,7 @@ void setup() {
 		Serial.println("An Error occurred while mounting SPIFFS");
 		return;
 	}
+	loadAssetVersion(SPIFFS);
 
 	if (!SD.begin(SD_CS)) {
 		Serial.println("Card Mount Failed");
@@ -763,43 +889,68 @@ void setup() {
 	}
 	Serial.println("SD Card initialized.");
 
+	// From here on every SD access goes through the SD owner task
+	startSdScheduler();
+
 	// Initialize a NTPClient to get time
 	timeClient.begin();
-	timeClient.update();
+	if (timeClient.update()) {	// Blocks for up to 1 s, only at boot
+		clockSync(timeClient.getEpochTime());
+	}
+
+	// Set the daily filename and the time of the next rollover
+	checkDailyRollover(clockNow());
+
+	// Finish any compaction a reset interrupted, so the directory sees every day
+	sdRun(SD_PRIORITY_WRITE, []() { recoverLogCompactions(SD); });
+
+	// Rollups written by older firmware are brought to the current record layout
+	sdRun(SD_PRIORITY_WRITE, []() { recoverRollups(SD, ROLLUP_PATH); });
 
-	currentDailyFilename = generateDailyFilename();	 // Initialize global variable
+	// Index the SD root once, it is kept up to date as files are written and deleted
+	sdRun(SD_PRIORITY_READ, []() { Serial.printf("%u files on SD\n", buildLogDirectory(SD)); });
+
+	// Write any log records that were still buffered when the ESP32 reset
+	initLogWriter(SD);
+
+	// Repair the end of the newest log after a power cut and carry on from its last reading
+	recoverNewestLog();
+
+	// Close the previous day if a reset came between its last reading and the rollover
+	closeStaleLog();
 
 	// Only open or create the daily log file if it doesn't exist (avoid
 	// overwriting)
-	String fileName = "/" + currentDailyFilename;
-	if (!SD.exists(fileName.c_str())) {
-		// Open in write mode only if it doesn't exist
-		File file = SD.open(fileName.c_str(), FILE_WRITE);
-		if (!file) {
-			logMsg("Failed to create the daily log file");
-		} else {
-			Serial.println("Created new daily log file");
-			logMsg("Created new daily log file");
-			file.close();
-		}
-	}
+	startDailyLog(getDailyPath(), logDayStart(clockEpoch()), readingID);
+
+	// Archive the closed days whose archive was still queued when the ESP32 reset
+	startArchiveScan(logDateKey(getDailyFilename().c_str()));
 
 	saveSensorRate(String(timerDelay/1000));
 
+	// Precompute the ADC to PSI conversion and start sampling the sensor
+	rebuildPsiTable();
+	sdRun(SD_PRIORITY_WRITE, []() { SD.mkdir(CAPTURE_DIR); });
+	initTransientCapture(ZONES_ALL_OFF_PSI, PUMP_CUT_IN_PSI, CAPTURE_SLOPE_PSI, ADC_SAMPLE_HZ);
+	startAdcSampler(SENSOR_PIN);
+
+	// Compile the zone table once, it is recompiled when a new table is submitted
+	sdRun(SD_PRIORITY_READ, []() { loadZoneSchedule(SD, "/zone_data.json"); });
+
+	// Old days are compacted in the background, see LogRetention.h
+	loadRetention();
+	startRetentionPass(clockEpoch());
+
 	////// Server Endpoints //////
 	// Web Server Root URL
 	server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-		if (SPIFFS.exists("/index.html")) {
-			request->send(SPIFFS, "/index.html", "text/html");
-		} else {
+		if (!sendStaticAsset(request, SPIFFS, "/index.html")) {
 			request->send(404, "text/plain", "File not found");
 		}
 	});
 
-	server.serveStatic("/", SPIFFS, "/");
-
 	server.on("/get-daily-filename", HTTP_GET, [](AsyncWebServerRequest *request) {
-		String fileName = currentDailyFilename;
+		String fileName = getDailyFilename();
 		request->send(200, "text/plain", fileName);
 	});
 
@@ -814,69 +965,366 @@ void setup() {
 				return;
 			}
 
-			if (!fileName.startsWith("/")) {
-				fileName = "/" + fileName;
-			}
-
-			// Check if the SD card is locked
-			if (sdCardLock) {
-				request->send(500, "text/plain", "SD card is busy");
-				logMsg("SD card is busy");
+			// Daily logs are found under /log in either name form, others in the root
+			if (!resolveSdPath(request, fileName)) {
 				return;
 			}
 
-			// Lock the SD card
-			sdCardLock = true;
+			// Make the current day's file complete before it is read. This
+			// queues its own SD job, so it must run before the file is opened.
+			bool currentDay = fileName == getDailyPath();
+			if (currentDay) {
+				flushLog(SD_WEB_WAIT);
+			}
 
-			File file = SD.open(fileName.c_str(), FILE_READ);
-			if (!file) {
-				String errorMessage = "Failed to open file or file does not exist. Filename: " + fileName;
-				logMsg(errorMessage.c_str());
-				request->send(500, "text/plain", errorMessage);
-			} else {
-				fileSize = file.size();
-				char buffer[BUFFER_SIZE];	 // Create a buffer for reading the file
-
-				// Create a custom response to stream the file content
-				AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain", [file, buffer](uint8_t *data, size_t len, size_t index) mutable -> size_t {
-					if (file.available()) {
-						memset(buffer, 0, BUFFER_SIZE);													 // Clear the buffer to avoid leftover data
-						size_t bytesRead = file.readBytes(buffer, BUFFER_SIZE);	 // Read a chunk of the file
-						memcpy(data, buffer, bytesRead);												 // Copy the exact chunk into the response data buffer
-						return bytesRead;																				 // Return the exact number of bytes read
+			// Each chunk is read in its own SD job so logging can run between
+			// chunks and downloads from several clients take turns
+			if (isBinaryLog(fileName)) {
+				// Binary logs are converted to the requested form while streaming
+				LogFormat format = parseLogFormat(request->hasParam("format") ? request->getParam("format")->value() : String());
+				// Optional time window (local epoch seconds) of the records to send as CSV or JSON
+				bool ranged = format != LOG_FORMAT_BIN && (request->hasParam("from") || request->hasParam("to"));
+				uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+				uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : UINT32_MAX;
+				bool acceptsGzip = request->hasHeader("Accept-Encoding") && request->getHeader("Accept-Encoding")->value().indexOf("gzip") != -1;
+
+				std::shared_ptr<LogRenderState> state = sdShared(new LogRenderState());
+				std::shared_ptr<File> archive = sdShared(new File());
+				bool opened = false;
+				bool valid = false;
+				uint32_t lastEpoch = 0;	// Time of the last record of a closed day
+				String etag;
+				uint32_t logSize = 0;
+				uint32_t first = 0;
+				uint32_t last = 0;
+				ByteRangeResult byteRange = BYTE_RANGE_NONE;
+				bool ready = sdRunForRequest(request, SD_PRIORITY_READ, [&]() {
+					File file = SD.open(fileName.c_str(), FILE_READ);
+					opened = file;
+					valid = opened && beginLogRender(*state, file, format);
+					if (opened && !valid) {
+						file.close();
+					}
+					// A day with a summary is closed and never changes again, so its
+					// responses are cached for good, tagged by size and last record
+					LogRecord lastRecord;
+					if (valid && state->header.summary.closedAt != 0 && readLastLogRecord(state->file, state->header, lastRecord)) {
+						lastEpoch = lastRecord.epoch;
+					}
+					// A closed day's CSV is sent as its archive, compressed as stored, to
+					// clients that accept gzip. Others get it rendered from the log.
+					if (lastEpoch && format == LOG_FORMAT_CSV && !ranged && acceptsGzip) {
+						String archivePath = logArchivePath(fileName);
+						if (SD.exists(archivePath)) {
+							*archive = SD.open(archivePath, FILE_READ);
+						}
+					}
+					if (lastEpoch) {
+						char tag[40];
+						snprintf(tag, sizeof(tag), "\"%lx-%lx-%u%s\"", (unsigned long)logDataSize(state->file, state->header), (unsigned long)lastEpoch,
+										 format, *archive ? "-gz" : "");
+						etag = tag;
+					}
+					// The raw file can be fetched in parts, to resume a download or to
+					// get only the records added since the last fetch
+					if (valid && format == LOG_FORMAT_BIN) {
+						logSize = logDataSize(state->file, state->header);
+						byteRange = parseByteRange(request, logSize, first, last);
+						if (byteRange == BYTE_RANGE_OK) {
+							state->file.seek(first);
+						}
+					}
+					if (valid && ranged) {
+						// Seek straight to the window with the index sidecar
+						state->index = findLogRecord(SD, fileName.c_str(), state->file, state->header, from);
+						state->toEpoch = to;
+					}
+				});
+				// The files are closed by the SD owner task when state and archive are released
+				if (!ready) {
+					return;
+				} else if (!opened) {
+					String errorMessage = "Failed to open file or file does not exist. Filename: " + fileName;
+					logMsg(errorMessage.c_str());
+					request->send(500, "text/plain", errorMessage);
+				} else if (!valid) {
+					request->send(500, "text/plain", "Invalid log file: " + fileName);
+				} else if (etagMatches(request, etag)) {
+					sendNotModified(request, etag, HTTP_CACHE_IMMUTABLE);
+				} else if (byteRange == BYTE_RANGE_UNSATISFIABLE) {
+					sendRangeNotSatisfiable(request, logSize);
+				} else {
+					AsyncWebServerResponse *response;
+					if (*archive) {
+						response = beginFileStream(request, archive, "text/plain");
+						response->addHeader("Content-Encoding", "gzip");
+					} else if (format == LOG_FORMAT_BIN) {
+						// The file as stored, read straight into the send buffer
+						std::shared_ptr<File> file(state, &state->file);
+						if (byteRange == BYTE_RANGE_OK) {
+							response = beginFileStream(request, file, "application/octet-stream", last - first + 1);
+							response->setCode(206);
+							response->addHeader("Content-Range", contentRange(first, last, logSize));
+						} else {
+							response = beginFileStream(request, file, "application/octet-stream", logSize);
+						}
 					} else {
-						file.close();	 // Close the file when done
-						return 0;			 // Indicate that we're done sending data
+						const char *contentType = format == LOG_FORMAT_JSON ? "application/json" : "text/plain";
+						response = request->beginChunkedResponse(contentType, [state](uint8_t *data, size_t len, size_t index) -> size_t {
+							size_t bytesWritten = 0;
+							bool rendered = sdRun(SD_PRIORITY_READ, [&]() {
+								bytesWritten = renderLogRecords(*state, data, len);
+								if (bytesWritten == 0) {
+									state->file.close();	// Close the file when done
+								}
+							}, SD_WEB_WAIT);
+							return rendered ? bytesWritten : RESPONSE_TRY_AGAIN;
+						});
+					}
+					if (format == LOG_FORMAT_BIN) {
+						response->addHeader("Accept-Ranges", "bytes");
+					}
+					if (lastEpoch) {
+						addCacheHeaders(response, etag, HTTP_CACHE_IMMUTABLE);
+						response->addHeader("Last-Modified", httpDate(lastEpoch - (TIME_ZONE)));
+						response->addHeader("Vary", "Accept-Encoding");
+					}
+					request->send(response);
+				}
+			} else {
+				std::shared_ptr<File> file = sdShared(new File());
+				uint32_t size = 0;
+				uint32_t first = 0;
+				uint32_t last = 0;
+				ByteRangeResult byteRange = BYTE_RANGE_NONE;
+				bool ready = sdRunForRequest(request, SD_PRIORITY_READ, [&]() {
+					*file = SD.open(fileName.c_str(), FILE_READ);
+					size = *file ? file->size() : 0;
+					if (*file) {
+						byteRange = parseByteRange(request, size, first, last);
+						if (byteRange == BYTE_RANGE_OK) {
+							file->seek(first);
+						}
 					}
 				});
+				if (!ready) {
+					return;
+				}
+				if (!*file) {
+					String errorMessage = "Failed to open file or file does not exist. Filename: " + fileName;
+					logMsg(errorMessage.c_str());
+					request->send(500, "text/plain", errorMessage);
+					return;
+				}
+
+				// Older text logs are no longer written, so only the current day's
+				// can change. There is no record time to go by, the size tags them.
+				String etag = currentDay ? String() : "\"" + String(size, HEX) + "-txt\"";
+				if (etagMatches(request, etag)) {
+					sendNotModified(request, etag, HTTP_CACHE_IMMUTABLE);
+					return;
+				}
+				if (byteRange == BYTE_RANGE_UNSATISFIABLE) {
+					sendRangeNotSatisfiable(request, size);
+					return;
+				}
+
+				AsyncWebServerResponse *response;
+				if (byteRange == BYTE_RANGE_OK) {
+					response = beginFileStream(request, file, "text/plain", last - first + 1);
+					response->setCode(206);
+					response->addHeader("Content-Range", contentRange(first, last, size));
+				} else {
+					response = beginFileStream(request, file, "text/plain", size);
+				}
+				response->addHeader("Accept-Ranges", "bytes");
+				if (etag.length()) {
+					addCacheHeaders(response, etag, HTTP_CACHE_IMMUTABLE);
+				}
 				request->send(response);
 			}
-
-			// Unlock the SD card
-			sdCardLock = false;
 		} else {
 			logMsg("Filename not specified.");
 			request->send(400, "text/plain", "Filename not specified.");
 		}
 	});
 
+	// Downsampled time window of a daily log for the history chart:
+	// /get-data-range?file=YYYYMMDD.bin&from=&to=&points=
+	// from and to are local epoch seconds and default to the whole file. At most
+	// points CSV lines are returned, the low and high record of each time bucket.
+	server.on("/get-data-range", HTTP_GET, [](AsyncWebServerRequest *request) {
+		if (!request->hasParam("file")) {
+			request->send(400, "text/plain", "File not specified.");
+			return;
+		}
+		String fileName = request->getParam("file")->value();
+		if (fileName.indexOf("..") != -1 || !isBinaryLog(fileName)) {
+			request->send(400, "text/plain", "Invalid filename.");
+			return;
+		}
+		if (!resolveSdPath(request, fileName)) {
+			return;
+		}
+		uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+		uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : UINT32_MAX;
+		uint16_t points = request->hasParam("points") ? request->getParam("points")->value().toInt() : RANGE_DEFAULT_POINTS;
+
+		if (fileName == getDailyPath()) {
+			flushLog(SD_WEB_WAIT);
+		}
+
+		std::shared_ptr<RangeQueryState> state = sdShared(new RangeQueryState());
+		bool opened = false;
+		uint32_t lastEpoch = 0;	// Time of the last record of a closed day
+		String etag;
+		bool ready = sdRunForRequest(request, SD_PRIORITY_READ, [&]() {
+			opened = beginRangeQuery(*state, SD, fileName.c_str(), from, to, points);
+			// A closed day's answer never changes, the URL holds the rest of the query
+			LogRecord last;
+			if (opened && state->header.summary.closedAt != 0 && readLastLogRecord(state->file, state->header, last)) {
+				lastEpoch = last.epoch;
+				char tag[32];
+				snprintf(tag, sizeof(tag), "\"%lx-%lx-range\"", (unsigned long)logDataSize(state->file, state->header), (unsigned long)lastEpoch);
+				etag = tag;
+			}
+		});
+		if (!ready) {
+			return;
+		}
+		if (!opened) {
+			request->send(404, "text/plain", "Log not found or invalid: " + fileName);
+			return;
+		}
+		if (etagMatches(request, etag)) {
+			sendNotModified(request, etag, HTTP_CACHE_IMMUTABLE);
+			return;
+		}
+
+		AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain", [state](uint8_t *data, size_t len, size_t index) -> size_t {
+			size_t bytesWritten = 0;
+			bool rendered = sdRun(SD_PRIORITY_READ, [&]() {
+				bytesWritten = renderRangeQuery(*state, data, len);
+				if (bytesWritten == 0) {
+					state->file.close();
+				}
+			}, SD_WEB_WAIT);
+			return rendered ? bytesWritten : RESPONSE_TRY_AGAIN;
+		});
+		if (lastEpoch) {
+			addCacheHeaders(response, etag, HTTP_CACHE_IMMUTABLE);
+			response->addHeader("Last-Modified", httpDate(lastEpoch - (TIME_ZONE)));
+		}
+		request->send(response);
+	});
+
+	// Daily summaries for month and year views: /get-rollups?from=&to=&zones=1
+	// from and to are local epoch seconds matched against the start of each log
+	// day. zones=1 adds a line per zone table row after each whole-day line.
+	server.on("/get-rollups", HTTP_GET, [](AsyncWebServerRequest *request) {
+		uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+		uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : UINT32_MAX;
+		bool zones = request->hasParam("zones") && request->getParam("zones")->value() == "1";
+
+		std::shared_ptr<RollupReadState> state = sdShared(new RollupReadState());
+		bool opened = false;
+		if (!sdRunForRequest(request, SD_PRIORITY_READ, [&]() { opened = beginRollupRead(*state, SD, ROLLUP_PATH, from, to, zones); })) {
+			return;
+		}
+		if (!opened) {
+			request->send(200, "text/plain", "");	// No day has been closed yet
+			return;
+		}
+
+		AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain", [state](uint8_t *data, size_t len, size_t index) -> size_t {
+			size_t bytesWritten = 0;
+			bool rendered = sdRun(SD_PRIORITY_READ, [&]() {
+				bytesWritten = renderRollups(*state, data, len);
+				if (bytesWritten == 0) {
+					state->file.close();
+				}
+			}, SD_WEB_WAIT);
+			return rendered ? bytesWritten : RESPONSE_TRY_AGAIN;
+		});
+		request->send(response);
+	});
+
+	// Files of the SD root from the in-RAM directory index, daily files in date
+	// order. Without parameters this is a JSON array of names. Any of
+	// offset, limit, from, to (YYYYMMDD), logs=1 or detail=1 returns a page of
+	// {"total","offset","files":[{name,size,date,records,first,last,step}]} instead.
 	server.on("/list-sd-card-files", HTTP_GET, [](AsyncWebServerRequest *request) {
+		LogDirQuery query = {0, 0, false, false, 0, UINT16_MAX};
+		query.detail = request->hasParam("detail") || request->hasParam("offset") || request->hasParam("limit") ||
+									 request->hasParam("from") || request->hasParam("to") || request->hasParam("logs");
+		if (query.detail) {
+			query.fromKey = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+			query.toKey = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : 0;
+			query.logsOnly = request->hasParam("logs") && request->getParam("logs")->value() == "1";
+			query.offset = request->hasParam("offset") ? request->getParam("offset")->value().toInt() : 0;
+			query.limit = request->hasParam("limit") ? constrain(request->getParam("limit")->value().toInt(), 1, LOG_DIR_PAGE_MAX)
+																							 : LOG_DIR_PAGE_MAX;
+
+			// The current day's log grows all the time, refresh its size and last
+			// record. A busy card only means the listing shows it a little stale.
+			String current = getDailyPath();
+			sdRun(SD_PRIORITY_READ, [&]() { updateLogDirectory(SD, current.c_str()); }, SD_WEB_WAIT);
+		}
+
+		std::shared_ptr<LogDirListState> state = std::make_shared<LogDirListState>();
+		beginLogDirList(*state, query);
+		AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", [state](uint8_t *data, size_t len, size_t index) -> size_t {
+			return renderLogDirList(*state, data, len);
+		});
+		request->send(response);
+	});
+
+	// List the transient capture files
+	server.on("/list-captures", HTTP_GET, [](AsyncWebServerRequest *request) {
 		String fileList = "[";
-		File root = SD.open("/");
-		File file = root.openNextFile();
-		bool first = true;
-		while (file) {
-			if (!first) {
-				fileList += ",";
+		bool ready = sdRunForRequest(request, SD_PRIORITY_READ, [&]() {
+			File root = SD.open(CAPTURE_DIR);
+			File file = root ? root.openNextFile() : File();
+			bool first = true;
+			while (file) {
+				if (!first) {
+					fileList += ",";
+				}
+				fileList += "\"" + String(file.name()) + "\"";
+				first = false;
+				file = root.openNextFile();
 			}
-			fileList += "\"" + String(file.name()) + "\"";
-			first = false;
-			file = root.openNextFile();
+		});
+		if (!ready) {
+			return;
 		}
 		fileList += "]";
 		request->send(200, "application/json", fileList);
 	});
 
+	// Stream a transient capture file (CaptureHeader followed by int16 samples)
+	server.on("/get-capture", HTTP_GET, [](AsyncWebServerRequest *request) {
+		if (!request->hasParam("filename")) {
+			request->send(400, "text/plain", "Filename not specified.");
+			return;
+		}
+		String fileName = request->getParam("filename")->value();
+		if (fileName.indexOf("..") != -1 || fileName.indexOf('/') != -1) {
+			request->send(400, "text/plain", "Invalid filename.");
+			return;
+		}
+		String path = String(CAPTURE_DIR "/") + fileName;
+		std::shared_ptr<File> file = sdShared(new File());
+		if (!sdRunForRequest(request, SD_PRIORITY_READ, [&]() { *file = SD.open(path, FILE_READ); })) {
+			return;
+		}
+		if (!*file) {
+			request->send(404, "text/plain", "Capture not found");
+			return;
+		}
+		request->send(beginFileStream(request, file, "application/octet-stream"));
+	});
+
 	server.on("/list-spiffs-files", HTTP_GET, [](AsyncWebServerRequest *request) {
 		String fileList = "[";
 		File root = SPIFFS.open("/");
@@ -939,42 +1387,73 @@ void setup() {
         }
 
         // Write to SD
-        File file = SD.open("/zone_data.json", FILE_WRITE);
-        if (!file) {
+        bool opened = false;
+        bool written = false;
+        auto save = [&]() {
+            File file = SD.open("/zone_data.json", FILE_WRITE);
+            opened = file;
+            if (opened) {
+                written = file.print(JSON.stringify(jsonData));
+                file.close();
+                updateLogDirectory(SD, "/zone_data.json");
+            }
+        };
+        if (!sdRunForRequest(request, SD_PRIORITY_WRITE, save)) {
+            return;
+        }
+        if (!opened) {
             request->send(500, "text/plain", "Failed to open file for writing");
             return;
         }
 
-        if (file.print(JSON.stringify(jsonData))) {
+        if (written) {
             request->send(200, "text/plain", "Data stored successfully");
         } else {
             request->send(500, "text/plain", "Failed to write data to file");
         }
 
-        file.close();
+        // Recompile the in-RAM zone table from the new data
+        compileZoneTable(body);
     } });
 
 	// Endpoint to serve the sensor sample rate data
 	server.on("/get-sensor-rate", HTTP_GET, [](AsyncWebServerRequest *request) {
-		String sampleRateData = loadSensorRate();
+		String sampleRateData;
+		if (!sdRunForRequest(request, SD_PRIORITY_READ, [&]() { sampleRateData = loadSensorRate(); })) {
+			return;
+		}
 		request->send(200, "text/plain", sampleRateData);
 	});
 
+	// Retention tiers and what compaction has reclaimed
+	server.on("/get-retention", HTTP_GET, [](AsyncWebServerRequest *request) {
+		request->send(200, "application/json", retentionJson());
+	});
+
 	// Endpoint to serve the location data
 	server.on("/get-location", HTTP_GET, [](AsyncWebServerRequest *request) {
-		String locationData = loadLocation();
+		String locationData;
+		if (!sdRunForRequest(request, SD_PRIORITY_READ, [&]() { locationData = loadLocation(); })) {
+			return;
+		}
 		request->send(200, "text/plain", locationData);
 	});
 
 	// Endpoint to serve the calibration offset data
 	server.on("/get-calib-offset", HTTP_GET, [](AsyncWebServerRequest *request) {
-		String calibOffsetData = loadCalibOffset();
+		String calibOffsetData;
+		if (!sdRunForRequest(request, SD_PRIORITY_READ, [&]() { calibOffsetData = loadCalibOffset(); })) {
+			return;
+		}
 		request->send(200, "text/plain", calibOffsetData);
 	});
 
 	// Endpoint to serve the SD zone table data
 	server.on("/load-sd-zone-table", HTTP_GET, [](AsyncWebServerRequest *request) {
-		String zoneData = loadZoneTable(SD, "/zone_data.json");
+		String zoneData;
+		if (!sdRunForRequest(request, SD_PRIORITY_READ, [&]() { zoneData = loadZoneTable(SD, "/zone_data.json"); })) {
+			return;
+		}
 		request->send(200, "application/json", zoneData);
 	});
 
@@ -1013,9 +1492,38 @@ void setup() {
 
 	server.on("/delete-file", HTTP_GET, deleteFileHandler);
 
+	// Endpoint to serve the log write buffer statistics
+	server.on("/log-stats", HTTP_GET, [](AsyncWebServerRequest *request) {
+		request->send(200, "application/json", logWriterStatsJson());
+	});
+
+	// Endpoint to serve the SD queue wait and run times
+	server.on("/sd-stats", HTTP_GET, [](AsyncWebServerRequest *request) {
+		request->send(200, "application/json", sdStatsJson());
+	});
+
+	// SD read throughput of a file for the read sizes used by the file streams:
+	// /sd-read-bench?filename=YYYYMMDD.bin (at most 256 KB of it per timing)
+	server.on("/sd-read-bench", HTTP_GET, [](AsyncWebServerRequest *request) {
+		if (!request->hasParam("filename")) {
+			request->send(400, "text/plain", "Filename not specified.");
+			return;
+		}
+		String fileName = request->getParam("filename")->value();
+		if (fileName.indexOf("..") != -1) {
+			request->send(400, "text/plain", "Invalid filename.");
+			return;
+		}
+		if (!resolveSdPath(request, fileName)) {
+			return;
+		}
+		request->send(200, "application/json", sdReadBenchmarkJson(fileName.c_str()));
+	});
+
 	// Endpoint to trigger reset
 	server.on("/reset", HTTP_GET, [](AsyncWebServerRequest *request) {
 		request->send(200, "text/plain", "Resetting ESP32...");
+		flushLog();			// Don't leave log records in RAM
 		delay(1000);		// Allow time for the response to be sent
 		ESP.restart();	// Reset the ESP32
 	});
@@ -1025,6 +1533,7 @@ void setup() {
 
 	// Route to handle the POST request to set the sensor sample rate
 	server.on("/sensor-rate-input", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, handleSetSensorRate);
+	server.on("/retention-input", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, handleSetRetention);
 
 	// Route to handle the POST request to set the calibration value
 	server.on("/calib-input", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, handleSetCalibration);
@@ -1036,26 +1545,26 @@ void setup() {
 	// To access, use <IPaddress/update> then send the firmware.bin compiled image
 	// file To upload data directory use spiffs.bin
 	ElegantOTA.begin(&server);
+	ElegantOTA.onStart([]() { flushLog(); });	// Write buffered log records before updating
 
 	// Start server
 	server.begin();
+
+	// Start the sampling and SD writer stages, loop() only serves the display
+	xTaskCreatePinnedToCore(analyticsTask, "analytics", 6144, NULL, 3, NULL, 1);
+	xTaskCreatePinnedToCore(sdWriterTask, "sdWriter", 6144, NULL, 2, NULL, 0);
 }
 
 // ----------------- LOOP ----------------------
 void loop() {
 	ElegantOTA.loop();
 
-	if ((millis() - lastTime) > timerDelay) {
-		lastTime = millis();
-
-		// Check if it's time to update the daily filename
-		updateDailyFilename();
-
-		// Send Events to the client with the Sensor Readings Every 30 seconds
-		// events.send("ping", NULL, millis());
-		events.send(getSensorReading().c_str(), "new-readings", millis());
+	// Send Events to the client with the Sensor Readings every sample interval
+	Reading reading;
+	while (displayQueue.pop(reading)) {
+		currentPressure = reading.record.centiPsi / 100.0f;	// currentPressure is global variable
+		events.send(readingToJson(reading).c_str(), "new-readings", millis());
 		updateOledDisplay(currentPressure, IPmessage);
-		logData();
 	}
 	delay(100);
-}
\ No newline at end of file
+}
@@ -0,0 +1,268 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino core and of FreeRTOS for the host ([env:native])
+// tests to build the firmware modules that don't touch hardware. millis() and
+// micros() run from a fake clock the tests set and advance, so time dependent
+// code can be replayed exactly.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define IRAM_ATTR
+
+inline uint16_t word(uint8_t high, uint8_t low) {
+	return (uint16_t)(high << 8 | low);
+}
+
+// glibc only has strlcpy from 2.38 on
+inline size_t hostStrlcpy(char *dst, const char *src, size_t size) {
+	size_t len = strlen(src);
+	if (size > 0) {
+		size_t n = len < size - 1 ? len : size - 1;
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+#define strlcpy hostStrlcpy
+
+// Fake clock
+inline uint64_t hostMicros = 0;
+
+inline void hostSetMillis(uint32_t ms) {
+	hostMicros = (uint64_t)ms * 1000;
+}
+
+inline void hostAdvanceMillis(uint32_t ms) {
+	hostMicros += (uint64_t)ms * 1000;
+}
+
+inline unsigned long millis() {
+	return (uint32_t)(hostMicros / 1000);
+}
+
+inline unsigned long micros() {
+	return (uint32_t)hostMicros;
+}
+
+inline void delay(uint32_t ms) {
+	hostAdvanceMillis(ms);
+}
+
+class String {
+public:
+	String() {}
+	String(const char *text) : _s(text ? text : "") {}
+	String(const std::string &text) : _s(text) {}
+	explicit String(char c) : _s(1, c) {}
+	String(int value, unsigned char base = DEC) : _s(format((long)value, base)) {}
+	String(unsigned int value, unsigned char base = DEC) : _s(format((unsigned long)value, base)) {}
+	String(long value, unsigned char base = DEC) : _s(format(value, base)) {}
+	String(unsigned long value, unsigned char base = DEC) : _s(format(value, base)) {}
+	String(float value, unsigned char decimals = 2) : _s(formatFloat(value, decimals)) {}
+	String(double value, unsigned char decimals = 2) : _s(formatFloat(value, decimals)) {}
+
+	const char *c_str() const { return _s.c_str(); }
+	unsigned int length() const { return _s.length(); }
+	bool reserve(unsigned int size) {
+		_s.reserve(size);
+		return true;
+	}
+
+	char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+	char operator[](unsigned int index) const { return charAt(index); }
+
+	String &operator+=(const String &other) {
+		_s += other._s;
+		return *this;
+	}
+	String &operator+=(const char *other) {
+		_s += other ? other : "";
+		return *this;
+	}
+	String &operator+=(char c) {
+		_s += c;
+		return *this;
+	}
+	bool concat(const String &other) {
+		_s += other._s;
+		return true;
+	}
+
+	friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+	friend String operator+(const String &a, const char *b) { return String(a._s + (b ? b : "")); }
+	friend String operator+(const char *a, const String &b) { return String((a ? a : "") + b._s); }
+	friend String operator+(const String &a, char b) { return String(a._s + b); }
+
+	bool operator==(const String &other) const { return _s == other._s; }
+	bool operator==(const char *other) const { return _s == (other ? other : ""); }
+	bool operator!=(const String &other) const { return !(*this == other); }
+	bool operator!=(const char *other) const { return !(*this == other); }
+	bool operator<(const String &other) const { return _s < other._s; }
+	bool equals(const String &other) const { return *this == other; }
+
+	bool startsWith(const String &prefix) const { return _s.compare(0, prefix._s.length(), prefix._s) == 0; }
+	bool endsWith(const String &suffix) const {
+		return _s.length() >= suffix._s.length() &&
+					 _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0;
+	}
+
+	int indexOf(char c, unsigned int from = 0) const { return position(_s.find(c, from)); }
+	int indexOf(const String &text, unsigned int from = 0) const { return position(_s.find(text._s, from)); }
+	int lastIndexOf(char c) const { return position(_s.rfind(c)); }
+	int lastIndexOf(const String &text) const { return position(_s.rfind(text._s)); }
+
+	String substring(unsigned int from) const { return from < _s.length() ? String(_s.substr(from)) : String(); }
+	String substring(unsigned int from, unsigned int to) const {
+		if (from > to) {
+			std::swap(from, to);
+		}
+		return from < _s.length() ? String(_s.substr(from, to - from)) : String();
+	}
+
+	void trim() {
+		size_t first = _s.find_first_not_of(" \t\r\n");
+		size_t last = _s.find_last_not_of(" \t\r\n");
+		_s = first == std::string::npos ? std::string() : _s.substr(first, last - first + 1);
+	}
+
+	long toInt() const { return atol(_s.c_str()); }
+	float toFloat() const { return atof(_s.c_str()); }
+
+private:
+	static int position(size_t found) { return found == std::string::npos ? -1 : (int)found; }
+
+	static std::string format(long value, unsigned char base) {
+		if (value < 0 && base == DEC) {
+			return "-" + format((unsigned long)-value, base);
+		}
+		return format((unsigned long)value, base);
+	}
+
+	static std::string format(unsigned long value, unsigned char base) {
+		char text[24];
+		snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", value);
+		return text;
+	}
+
+	static std::string formatFloat(double value, unsigned char decimals) {
+		char text[48];
+		snprintf(text, sizeof(text), "%.*f", decimals, value);
+		return text;
+	}
+
+	std::string _s;
+};
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size) {
+		size_t n = 0;
+		while (n < size && write(buffer[n])) {
+			n++;
+		}
+		return n;
+	}
+
+	size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+	size_t print(const String &text) { return print(text.c_str()); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(long value) { return print(String(value)); }
+	size_t print(unsigned long value) { return print(String(value)); }
+	size_t print(int value) { return print(String(value)); }
+	size_t print(unsigned int value) { return print(String(value)); }
+	size_t print(double value, int decimals = 2) { return print(String(value, (unsigned char)decimals)); }
+
+	template <typename T>
+	size_t println(const T &value) {
+		return print(value) + print("\r\n");
+	}
+	size_t println() { return print("\r\n"); }
+
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+		char text[512];
+		va_list args;
+		va_start(args, format);
+		int len = vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		return len < 0 ? 0 : write((const uint8_t *)text, min((size_t)len, sizeof(text) - 1));
+	}
+};
+
+class Printable {
+public:
+	virtual ~Printable() {}
+	virtual size_t printTo(Print &p) const = 0;
+};
+
+// Serial goes to stdout so the firmware's messages show up in a verbose test run
+class HostSerial : public Print {
+public:
+	void begin(unsigned long baud) {}
+	size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+	size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+};
+
+inline HostSerial Serial;
+
+// FreeRTOS critical sections become a mutex
+typedef std::recursive_mutex portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->lock()
+#define portEXIT_CRITICAL(mux) (mux)->unlock()
+
+// FreeRTOS mutexes too. Waits are not timed, a take always succeeds.
+typedef uint32_t TickType_t;
+#define portMAX_DELAY 0xffffffffUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTRUE 1
+#define pdFALSE 0
+typedef std::recursive_mutex *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+	return new std::recursive_mutex();
+}
+
+inline int xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait) {
+	mutex->lock();
+	return pdTRUE;
+}
+
+inline int xSemaphoreGive(SemaphoreHandle_t mutex) {
+	mutex->unlock();
+	return pdTRUE;
+}
+
+// RTC memory is ordinary memory, and the reset reason is set by the test
+#define RTC_NOINIT_ATTR
+
+enum esp_reset_reason_t { ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_INT_WDT, ESP_RST_TASK_WDT };
+
+inline esp_reset_reason_t hostResetReason = ESP_RST_POWERON;
+
+inline esp_reset_reason_t esp_reset_reason() {
+	return hostResetReason;
+}
+
+#endif	// HOST_ARDUINO_H
@@ -0,0 +1,299 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+// In-memory stand-in for the Arduino FS and File classes, with the semantics
+// the firmware relies on from the SD library: "w" truncates, "a" writes at
+// the end, "r+" opens an existing file for update, and seeking past the end
+// then writing fills the gap with zeros.
+//
+// Writes can also be charged to the fake clock as a card would take them,
+// see HostCard. Nothing is charged unless a test sets costs.
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+typedef std::vector<uint8_t> HostFileData;
+
+#define HOST_SECTOR_SIZE 512
+#define HOST_FAT_ENTRIES 128	// FAT32 entries per FAT sector
+
+// Time a card takes for each kind of write
+struct HostCardCosts {
+	uint32_t clusterSize = 32768;
+	uint32_t sectorUs = 0;				// Per data sector written
+	uint32_t directoryUs = 0;			// Per directory entry update, when a changed file is closed
+	uint32_t fatSectorUs = 0;			// Per FAT sector written, each of the two FAT copies counts
+	uint32_t fatStallEvery = 0;		// Every nth FAT sector write also stalls, 0 = never
+	uint32_t fatStallUs = 0;			// As the card erases a block for it
+};
+
+// Writes the card was asked for
+struct HostCardCounts {
+	uint32_t sectorWrites;
+	uint32_t directoryWrites;
+	uint32_t fatWrites;
+	uint32_t fatStalls;
+	uint32_t clustersAllocated;
+	uint32_t clustersFreed;
+};
+
+// Cost model of the card behind an FS. Clusters are numbered per file from
+// the start of a FAT sector, as if every file were contiguous, so a file
+// that grows into a new cluster costs one FAT sector per copy, or two when
+// its chain crosses into the next FAT sector.
+class HostCard {
+public:
+	HostCardCosts costs;
+	HostCardCounts counts = {};
+
+	void writeSectors(size_t position, size_t size) {
+		if (size == 0) {
+			return;
+		}
+		uint32_t sectors = (position + size - 1) / HOST_SECTOR_SIZE - position / HOST_SECTOR_SIZE + 1;
+		counts.sectorWrites += sectors;
+		hostMicros += (uint64_t)sectors * costs.sectorUs;
+	}
+
+	void writeDirectory() {
+		counts.directoryWrites++;
+		hostMicros += costs.directoryUs;
+	}
+
+	// Allocate or free the clusters between two sizes of a file
+	void resize(size_t oldSize, size_t newSize) {
+		uint32_t from = clusters(oldSize);
+		uint32_t to = clusters(newSize);
+		if (from == to) {
+			return;
+		}
+		if (to > from) {
+			counts.clustersAllocated += to - from;
+		} else {
+			counts.clustersFreed += from - to;
+		}
+		// The old last cluster is relinked too
+		uint32_t low = min(from, to);
+		uint32_t first = low > 0 ? low - 1 : 0;
+		uint32_t last = max(from, to) - 1;
+		uint32_t sectors = last / HOST_FAT_ENTRIES - first / HOST_FAT_ENTRIES + 1;
+		for (uint32_t i = 0; i < sectors * 2; i++) {
+			writeFatSector();
+		}
+	}
+
+private:
+	uint32_t clusters(size_t size) const { return (size + costs.clusterSize - 1) / costs.clusterSize; }
+
+	void writeFatSector() {
+		counts.fatWrites++;
+		hostMicros += costs.fatSectorUs;
+		if (costs.fatStallEvery > 0 && counts.fatWrites % costs.fatStallEvery == 0) {
+			counts.fatStalls++;
+			hostMicros += costs.fatStallUs;
+		}
+	}
+};
+
+// Copies of a File share one handle and its position, as they do on the target
+class File {
+public:
+	File() {}
+	File(const String &path, std::shared_ptr<HostFileData> data, bool writable, bool append, HostCard *card = nullptr)
+			: _handle(std::make_shared<Handle>()) {
+		_handle->path = path;
+		_handle->data = data;
+		_handle->writable = writable;
+		_handle->append = append;
+		_handle->card = card;
+		_handle->position = append ? data->size() : 0;
+	}
+
+	explicit operator bool() const { return _handle && _handle->data; }
+
+	size_t write(const uint8_t *buffer, size_t size) {
+		if (!*this || !_handle->writable || _handle->failWrites) {
+			return 0;
+		}
+		HostFileData &data = *_handle->data;
+		size_t &position = _handle->position;
+		if (_handle->append) {
+			position = data.size();
+		}
+		if (_handle->card) {
+			_handle->card->resize(data.size(), max(data.size(), position + size));
+			_handle->card->writeSectors(position, size);
+		}
+		if (data.size() < position + size) {
+			data.resize(position + size);
+		}
+		memcpy(data.data() + position, buffer, size);
+		_handle->changed = true;
+		position += size;
+		return size;
+	}
+	size_t write(uint8_t c) { return write(&c, 1); }
+	size_t print(const String &text) { return write((const uint8_t *)text.c_str(), text.length()); }
+	size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+
+	size_t read(uint8_t *buffer, size_t size) {
+		if (!*this || _handle->position >= _handle->data->size()) {
+			return 0;
+		}
+		size_t n = min(size, _handle->data->size() - _handle->position);
+		memcpy(buffer, _handle->data->data() + _handle->position, n);
+		_handle->position += n;
+		return n;
+	}
+	int read() {
+		uint8_t c;
+		return read(&c, 1) == 1 ? c : -1;
+	}
+	int available() { return *this && _handle->position < size() ? (int)(size() - _handle->position) : 0; }
+	String readString() {
+		std::string text;
+		for (int c = read(); c >= 0; c = read()) {
+			text += (char)c;
+		}
+		return String(text);
+	}
+
+	bool seek(uint32_t position) {
+		if (!*this) {
+			return false;
+		}
+		_handle->position = position;
+		return true;
+	}
+	size_t position() const { return *this ? _handle->position : 0; }
+	size_t size() const { return *this ? _handle->data->size() : 0; }
+	const char *name() const { return _handle ? _handle->path.c_str() : ""; }
+	const char *path() const { return name(); }
+	bool isDirectory() const { return false; }
+	File openNextFile() { return File(); }
+	void flush() {}
+	void close() {
+		if (_handle && _handle->data && _handle->changed && _handle->card) {
+			_handle->card->writeDirectory();
+		}
+		if (_handle) {
+			_handle->data = nullptr;
+		}
+		_handle = nullptr;
+	}
+
+	// Make every later write of this handle fail, as a full or pulled card does
+	void failWrites() {
+		if (_handle) {
+			_handle->failWrites = true;
+		}
+	}
+
+	// Mark a file created or truncated by its open, its directory entry is written on close
+	void markChanged() {
+		if (_handle) {
+			_handle->changed = true;
+		}
+	}
+
+private:
+	struct Handle {
+		String path;
+		std::shared_ptr<HostFileData> data;
+		bool writable = false;
+		bool append = false;
+		bool failWrites = false;
+		bool changed = false;
+		HostCard *card = nullptr;
+		size_t position = 0;
+	};
+	std::shared_ptr<Handle> _handle;
+};
+
+class FS {
+public:
+	File open(const String &path, const char *mode = FILE_READ) {
+		auto it = _files.find(path.c_str());
+		if (strcmp(mode, FILE_WRITE) == 0) {
+			if (it != _files.end()) {
+				_card.resize(it->second->size(), 0);
+			}
+			std::shared_ptr<HostFileData> data = std::make_shared<HostFileData>();
+			_files[path.c_str()] = data;
+			File file(path, data, true, false, &_card);
+			file.markChanged();
+			return file;
+		}
+		if (strcmp(mode, FILE_APPEND) == 0) {
+			if (it == _files.end()) {
+				it = _files.emplace(path.c_str(), std::make_shared<HostFileData>()).first;
+			}
+			return File(path, it->second, true, true, &_card);
+		}
+		if (it == _files.end()) {
+			return File();
+		}
+		return File(path, it->second, strcmp(mode, "r+") == 0, false, &_card);
+	}
+	File open(const char *path, const char *mode = FILE_READ) { return open(String(path), mode); }
+
+	bool exists(const String &path) const { return _files.count(path.c_str()) > 0; }
+	bool remove(const String &path) {
+		auto it = _files.find(path.c_str());
+		if (it == _files.end()) {
+			return false;
+		}
+		_card.resize(it->second->size(), 0);
+		_card.writeDirectory();
+		_files.erase(it);
+		return true;
+	}
+	bool rename(const String &from, const String &to) {
+		auto it = _files.find(from.c_str());
+		if (it == _files.end()) {
+			return false;
+		}
+		std::shared_ptr<HostFileData> data = it->second;
+		_files.erase(it);
+		_files[to.c_str()] = data;
+		_card.writeDirectory();
+		return true;
+	}
+	bool mkdir(const String &path) { return true; }
+
+	// Test access to the stored bytes and the card model
+	HostFileData &data(const String &path) { return *_files.at(path.c_str()); }
+	void clear() { _files.clear(); }
+	HostCard &card() { return _card; }
+
+	// Cut a file to size, as truncate() through the VFS does on the target
+	bool truncate(const String &path, size_t size) {
+		auto it = _files.find(path.c_str());
+		if (it == _files.end() || it->second->size() < size) {
+			return false;
+		}
+		_card.resize(it->second->size(), size);
+		_card.writeDirectory();
+		it->second->resize(size);
+		return true;
+	}
+
+private:
+	std::map<std::string, std::shared_ptr<HostFileData>> _files;
+	HostCard _card;
+};
+
+}	// namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif	// HOST_FS_H
@@ -0,0 +1,23 @@
+#ifndef HOST_SD_H
+#define HOST_SD_H
+
+// The SD library's card as an in-memory FS, see FS.h
+
+#include "FS.h"
+
+typedef enum { CARD_NONE, CARD_MMC, CARD_SD, CARD_SDHC, CARD_UNKNOWN } sdcard_type_t;
+
+namespace fs {
+
+class SDFS : public FS {
+public:
+	bool begin(uint8_t ssPin = 5) { return true; }
+	void end() {}
+	sdcard_type_t cardType() { return CARD_SDHC; }
+};
+
+}	// namespace fs
+
+inline fs::SDFS SD;
+
+#endif	// HOST_SD_H
@@ -0,0 +1,125 @@
+#include <unity.h>
+#include <chrono>
+#include "AdcToPsi.h"
+
+// Sensor constants of main.cpp
+#define MIN_VOLTAGE 0.8f
+#define MAX_VOLTAGE 3.1f
+#define MIN_PRESSURE 0.8f
+#define MAX_PRESSURE 63.0f
+
+// The conversion the firmware did on every sample before the table: the
+// linearisation polynomial on the sum of 11 reads divided by 10, then the
+// voltage to pressure mapping in float, then the calibration offset
+static float formulaPsi(uint16_t code, float calibOffset) {
+	double adcReading = code * 11 / 10.0;
+	double voltage = -0.000000000000016 * pow(adcReading, 4) +
+									 0.000000000118171 * pow(adcReading, 3) -
+									 0.000000301211691 * pow(adcReading, 2) +
+									 0.001109019271794 * adcReading + 0.034143524634089;
+	float pressure = ((float)voltage - MIN_VOLTAGE) * (MAX_PRESSURE - MIN_PRESSURE) / (MAX_VOLTAGE - MIN_VOLTAGE) + MIN_PRESSURE;
+	return pressure - calibOffset;
+}
+
+// Every code of the table against the formula, to within the rounding to
+// hundredths of a PSI
+static void checkTable(float calibOffset) {
+	buildPsiTable(MIN_VOLTAGE, MAX_VOLTAGE, MIN_PRESSURE, MAX_PRESSURE, calibOffset);
+	for (uint16_t code = 0; code < ADC_LEVELS; code++) {
+		char message[48];
+		snprintf(message, sizeof(message), "code %u", code);
+		TEST_ASSERT_INT_WITHIN_MESSAGE(1, lroundf(formulaPsi(code, calibOffset) * 100.0f), adcToCentiPsi(code), message);
+	}
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_table_matches_formula() {
+	checkTable(0.0f);
+}
+
+void test_table_matches_formula_with_offset() {
+	checkTable(2.4f);
+	checkTable(-1.7f);
+}
+
+void test_offset_shifts_every_code() {
+	buildPsiTable(MIN_VOLTAGE, MAX_VOLTAGE, MIN_PRESSURE, MAX_PRESSURE, 0.0f);
+	int16_t plain[ADC_LEVELS];
+	for (uint16_t code = 0; code < ADC_LEVELS; code++) {
+		plain[code] = adcToCentiPsi(code);
+	}
+	buildPsiTable(MIN_VOLTAGE, MAX_VOLTAGE, MIN_PRESSURE, MAX_PRESSURE, 1.5f);
+	for (uint16_t code = 0; code < ADC_LEVELS; code++) {
+		TEST_ASSERT_INT_WITHIN(1, plain[code] - 150, adcToCentiPsi(code));
+	}
+}
+
+void test_codes_past_the_table_clamp() {
+	buildPsiTable(MIN_VOLTAGE, MAX_VOLTAGE, MIN_PRESSURE, MAX_PRESSURE, 0.0f);
+	TEST_ASSERT_EQUAL_INT16(adcToCentiPsi(ADC_LEVELS - 1), adcToCentiPsi(ADC_LEVELS));
+	TEST_ASSERT_EQUAL_INT16(adcToCentiPsi(ADC_LEVELS - 1), adcToCentiPsi(UINT16_MAX));
+}
+
+// A rebuild fills the spare table and leaves the one readers hold alone
+void test_rebuild_does_not_touch_the_live_table() {
+	buildPsiTable(MIN_VOLTAGE, MAX_VOLTAGE, MIN_PRESSURE, MAX_PRESSURE, 0.0f);
+	const int16_t *live = psiTable.load();
+	int16_t before[ADC_LEVELS];
+	memcpy(before, live, sizeof(before));
+	buildPsiTable(MIN_VOLTAGE, MAX_VOLTAGE, MIN_PRESSURE, MAX_PRESSURE, 3.0f);
+	TEST_ASSERT_TRUE(psiTable.load() != live);
+	TEST_ASSERT_EQUAL_MEMORY(before, live, sizeof(before));
+	TEST_ASSERT_INT_WITHIN(1, before[2000] - 300, adcToCentiPsi(2000));
+}
+
+// Per-sample cost of the old float path against the table lookup, over
+// every code. Times are printed for comparison and depend on the host: it
+// has a double FPU, the ESP32 does pow() and the polynomial in software.
+void test_benchmark_formula_against_table() {
+	const int rounds = 200;
+	auto start = std::chrono::steady_clock::now();
+	buildPsiTable(MIN_VOLTAGE, MAX_VOLTAGE, MIN_PRESSURE, MAX_PRESSURE, 0.0f);
+	double buildUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+	volatile float calibOffset = 0.0f;	// Keeps the formula from being folded into a table by the compiler
+	double formulaSum = 0;
+	start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++) {
+		for (uint16_t code = 0; code < ADC_LEVELS; code++) {
+			formulaSum += formulaPsi(code, calibOffset);
+		}
+	}
+	double formulaNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+										 (rounds * ADC_LEVELS);
+
+	volatile uint16_t offset = 0;	// As above, for the lookups
+	int64_t tableSum = 0;
+	start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++) {
+		for (uint16_t code = 0; code < ADC_LEVELS; code++) {
+			tableSum += adcToCentiPsi(code + offset);
+		}
+	}
+	double tableNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+									 (rounds * ADC_LEVELS);
+
+	char message[128];
+	snprintf(message, sizeof(message), "per sample: formula %.1f ns, table %.2f ns; table build %.0f us", formulaNs,
+					 tableNs, buildUs);
+	TEST_MESSAGE(message);
+	TEST_ASSERT_TRUE(fabs(formulaSum * 100 - tableSum) <= rounds * ADC_LEVELS);	// Same sums to the rounding
+	TEST_ASSERT_TRUE(tableNs < formulaNs);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_table_matches_formula);
+	RUN_TEST(test_table_matches_formula_with_offset);
+	RUN_TEST(test_offset_shifts_every_code);
+	RUN_TEST(test_codes_past_the_table_clamp);
+	RUN_TEST(test_rebuild_does_not_touch_the_live_table);
+	RUN_TEST(test_benchmark_formula_against_table);
+	return UNITY_END();
+}
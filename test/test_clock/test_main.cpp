@@ -0,0 +1,199 @@
+#include <unity.h>
+#include "Clock.h"
+
+// Local epoch of a calendar date and time, with the C library as reference
+static uint32_t localEpoch(int year, int month, int day, int hour = 0, int minute = 0, int second = 0) {
+	struct tm tm = {};
+	tm.tm_year = year - 1900;
+	tm.tm_mon = month - 1;
+	tm.tm_mday = day;
+	tm.tm_hour = hour;
+	tm.tm_min = minute;
+	tm.tm_sec = second;
+	return (uint32_t)timegm(&tm);
+}
+
+void setUp() {
+	hostSetMillis(1000);
+	clockSync(0);	// A large backward step, so no hold is carried over from the test before
+}
+
+void tearDown() {}
+
+// Every day the 32 bit epoch reaches, at a time of day that moves through
+// the whole day, against gmtime_r()
+void test_breakdown_matches_gmtime() {
+	for (uint32_t day = 0; day < UINT32_MAX / 86400; day++) {
+		uint32_t epoch = day * 86400 + (day * 7919) % 86400;
+		time_t t = epoch;
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		ClockTime time;
+		clockBreakdown(epoch, time);
+		if (time.year != tm.tm_year + 1900 || time.month != tm.tm_mon + 1 || time.day != tm.tm_mday ||
+				time.hour != tm.tm_hour || time.minute != tm.tm_min || time.second != tm.tm_sec || time.weekday != tm.tm_wday) {
+			char message[64];
+			snprintf(message, sizeof(message), "epoch %u", epoch);
+			TEST_FAIL_MESSAGE(message);
+		}
+		TEST_ASSERT_EQUAL_UINT16(tm.tm_wday * 1440 + tm.tm_hour * 60 + tm.tm_min, time.minuteOfWeek);
+	}
+}
+
+void test_leap_and_century_days() {
+	ClockTime time;
+	clockBreakdown(localEpoch(2024, 2, 29, 12), time);
+	TEST_ASSERT_EQUAL(2024, time.year);
+	TEST_ASSERT_EQUAL(2, time.month);
+	TEST_ASSERT_EQUAL(29, time.day);
+	TEST_ASSERT_EQUAL(4, time.weekday);	// Thursday
+
+	clockBreakdown(localEpoch(2000, 2, 28) + 86400, time);	// 2000 is a leap year
+	TEST_ASSERT_EQUAL(2, time.month);
+	TEST_ASSERT_EQUAL(29, time.day);
+
+	clockBreakdown(localEpoch(2100, 2, 28) + 86400, time);	// 2100 is not
+	TEST_ASSERT_EQUAL(3, time.month);
+	TEST_ASSERT_EQUAL(1, time.day);
+
+	clockBreakdown(localEpoch(2023, 12, 31, 23, 59, 59), time);
+	TEST_ASSERT_EQUAL(2023, time.year);
+	TEST_ASSERT_EQUAL(0, time.weekday);	// Sunday
+	TEST_ASSERT_EQUAL(23 * 60 + 59, time.minuteOfWeek);
+	clockBreakdown(localEpoch(2024, 1, 1), time);
+	TEST_ASSERT_EQUAL(2024, time.year);
+	TEST_ASSERT_EQUAL(1, time.month);
+	TEST_ASSERT_EQUAL(1, time.day);
+	TEST_ASSERT_EQUAL(1440, time.minuteOfWeek);
+}
+
+void test_clock_runs_from_millis() {
+	uint32_t epoch = localEpoch(2024, 6, 10, 8);
+	clockSync(epoch);
+	TEST_ASSERT_EQUAL_UINT32(epoch, clockEpoch());
+	hostAdvanceMillis(999);
+	TEST_ASSERT_EQUAL_UINT32(epoch, clockEpoch());
+	hostAdvanceMillis(1);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 1, clockEpoch());
+	hostAdvanceMillis(3600 * 1000);
+	ClockTime now = clockNow();
+	TEST_ASSERT_EQUAL(9, now.hour);
+	TEST_ASSERT_EQUAL(0, now.minute);
+	TEST_ASSERT_EQUAL(1, now.second);
+}
+
+// A small backward correction holds the clock at the last value it gave
+// until the corrected time catches up, it never runs backwards
+void test_small_backward_correction_holds() {
+	uint32_t epoch = localEpoch(2024, 6, 10, 8);
+	clockSync(epoch);
+	hostAdvanceMillis(20000);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 20, clockEpoch());
+
+	clockSync(epoch + 5);	// 15 s slow
+	for (int i = 0; i < 15; i++) {
+		TEST_ASSERT_EQUAL_UINT32(epoch + 20, clockEpoch());
+		hostAdvanceMillis(1000);
+	}
+	TEST_ASSERT_EQUAL_UINT32(epoch + 20, clockEpoch());
+	hostAdvanceMillis(1000);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 21, clockEpoch());
+}
+
+void test_large_backward_correction_steps() {
+	uint32_t epoch = localEpoch(2024, 6, 10, 8);
+	clockSync(epoch);
+	hostAdvanceMillis(600000);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 600, clockEpoch());
+
+	clockSync(epoch + 600 - CLOCK_MAX_HOLD_SEC - 1);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 600 - CLOCK_MAX_HOLD_SEC - 1, clockEpoch());
+}
+
+void test_forward_correction_is_taken() {
+	uint32_t epoch = localEpoch(2024, 6, 10, 8);
+	clockSync(epoch);
+	clockSync(epoch + 3600);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 3600, clockEpoch());
+}
+
+void test_millis_wrap() {
+	uint32_t epoch = localEpoch(2024, 6, 10, 8);
+	hostSetMillis(UINT32_MAX - 1500);
+	clockSync(epoch);
+	hostAdvanceMillis(1500);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 1, clockEpoch());
+	hostAdvanceMillis(1000);	// millis() has wrapped
+	TEST_ASSERT_EQUAL_UINT32(0, millis() / 1000);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 2, clockEpoch());
+	hostAdvanceMillis(86400000);
+	TEST_ASSERT_EQUAL_UINT32(epoch + 86402, clockEpoch());
+}
+
+// The log day turns over at DAY_START_HOUR, including across the end of a
+// month, of a year, and of February in leap and common years
+void test_log_day_boundaries() {
+	struct {
+		int year, month, day;
+		uint32_t before, after;
+	} boundaries[] = {
+			{2024, 6, 11, 20240610, 20240611},
+			{2024, 7, 1, 20240630, 20240701},
+			{2025, 1, 1, 20241231, 20250101},
+			{2024, 2, 29, 20240228, 20240229},
+			{2024, 3, 1, 20240229, 20240301},
+			{2023, 3, 1, 20230228, 20230301},
+			{2100, 3, 1, 21000228, 21000301},
+	};
+	for (auto &b : boundaries) {
+		uint32_t start = localEpoch(b.year, b.month, b.day, DAY_START_HOUR);
+		ClockTime time;
+		clockBreakdown(start - 1, time);	// 05:59:59
+		TEST_ASSERT_EQUAL_UINT32(b.before, logDayKey(time));
+		TEST_ASSERT_EQUAL_UINT32(start - 86400, logDayStart(start - 1));
+		clockBreakdown(start, time);	// 06:00:00
+		TEST_ASSERT_EQUAL_UINT32(b.after, logDayKey(time));
+		TEST_ASSERT_EQUAL_UINT32(start, logDayStart(start));
+		TEST_ASSERT_EQUAL_UINT32(start, logDayStart(start + 86399));
+	}
+}
+
+// Sampled every 30 s over a leap year, the log day name changes exactly when
+// the epoch reaches the precomputed start of the next log day, as the
+// rollover check in main.cpp relies on
+void test_log_day_changes_only_at_the_precomputed_boundary() {
+	uint32_t epoch = localEpoch(2024, 1, 1);
+	uint32_t end = localEpoch(2025, 1, 2);
+	ClockTime time;
+	clockBreakdown(epoch, time);
+	uint32_t key = logDayKey(time);
+	uint32_t nextRollover = logDayStart(epoch) + 86400;
+	uint32_t rollovers = 0;
+	for (; epoch < end; epoch += 30) {
+		clockBreakdown(epoch, time);
+		uint32_t now = logDayKey(time);
+		if (epoch >= nextRollover) {
+			TEST_ASSERT_TRUE(now != key);
+			nextRollover = logDayStart(epoch) + 86400;
+			key = now;
+			rollovers++;
+		} else {
+			TEST_ASSERT_EQUAL_UINT32(key, now);
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT32(367, rollovers);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_breakdown_matches_gmtime);
+	RUN_TEST(test_leap_and_century_days);
+	RUN_TEST(test_clock_runs_from_millis);
+	RUN_TEST(test_small_backward_correction_holds);
+	RUN_TEST(test_large_backward_correction_steps);
+	RUN_TEST(test_forward_correction_is_taken);
+	RUN_TEST(test_millis_wrap);
+	RUN_TEST(test_log_day_boundaries);
+	RUN_TEST(test_log_day_changes_only_at_the_precomputed_boundary);
+	return UNITY_END();
+}
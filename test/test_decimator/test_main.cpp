@@ -0,0 +1,83 @@
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "Decimator.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_interval() {
+	Decimator decimator;
+	DecimatedSample sample = decimator.take();
+	TEST_ASSERT_EQUAL_UINT32(0, sample.count);
+	TEST_ASSERT_EQUAL_INT16(0, sample.mean);
+	TEST_ASSERT_EQUAL_INT16(0, sample.min);
+	TEST_ASSERT_EQUAL_INT16(0, sample.max);
+}
+
+void test_mean_rounds_half_away_from_zero() {
+	Decimator decimator;
+	decimator.add(1);
+	decimator.add(2);
+	TEST_ASSERT_EQUAL_INT16(2, decimator.take().mean);
+	decimator.add(-1);
+	decimator.add(-2);
+	TEST_ASSERT_EQUAL_INT16(-2, decimator.take().mean);
+	decimator.add(-1);
+	decimator.add(2);
+	TEST_ASSERT_EQUAL_INT16(1, decimator.take().mean);
+}
+
+void test_take_starts_a_new_interval() {
+	Decimator decimator;
+	decimator.add(500);
+	decimator.add(-300);
+	DecimatedSample first = decimator.take();
+	TEST_ASSERT_EQUAL_UINT32(2, first.count);
+	TEST_ASSERT_EQUAL_INT16(-300, first.min);
+	TEST_ASSERT_EQUAL_INT16(500, first.max);
+
+	decimator.add(7);
+	DecimatedSample second = decimator.take();
+	TEST_ASSERT_EQUAL_UINT32(1, second.count);
+	TEST_ASSERT_EQUAL_INT16(7, second.mean);
+	TEST_ASSERT_EQUAL_INT16(7, second.min);
+	TEST_ASSERT_EQUAL_INT16(7, second.max);
+}
+
+// Intervals of random length and content against a plain reference. The
+// longest ones hold more samples than the sampler delivers in a slow
+// reading interval, with values at both ends of int16_t.
+void test_random_intervals_match_reference() {
+	std::mt19937 random(12345);
+	Decimator decimator;
+	for (int interval = 0; interval < 2000; interval++) {
+		uint32_t count = 1 + random() % (interval % 10 == 0 ? 200000 : 500);
+		int64_t sum = 0;
+		int16_t low = INT16_MAX;
+		int16_t high = INT16_MIN;
+		for (uint32_t i = 0; i < count; i++) {
+			int16_t value = interval % 7 == 0 ? (random() & 1 ? INT16_MAX : INT16_MIN) : (int16_t)(random() % 20001 - 10000);
+			decimator.add(value);
+			sum += value;
+			low = std::min(low, value);
+			high = std::max(high, value);
+		}
+		TEST_ASSERT_EQUAL_UINT32(count, decimator.count());
+		DecimatedSample sample = decimator.take();
+		TEST_ASSERT_EQUAL_UINT32(count, sample.count);
+		TEST_ASSERT_EQUAL_INT16(llround((double)sum / count), sample.mean);
+		TEST_ASSERT_EQUAL_INT16(low, sample.min);
+		TEST_ASSERT_EQUAL_INT16(high, sample.max);
+	}
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_empty_interval);
+	RUN_TEST(test_mean_rounds_half_away_from_zero);
+	RUN_TEST(test_take_starts_a_new_interval);
+	RUN_TEST(test_random_intervals_match_reference);
+	return UNITY_END();
+}
@@ -0,0 +1,254 @@
+#include <unity.h>
+#include <random>
+#include <vector>
+#include "GzipWriter.h"
+
+#define ARCHIVE_PATH "/log/2024/06/20240610.csv.gz"
+
+typedef std::vector<uint8_t> Bytes;
+
+static fs::FS card;
+static GzipWriter gz;
+
+// CRC-32 bit by bit, to check the writer's table version against
+static uint32_t referenceCrc32(const Bytes &data) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint8_t byte : data) {
+		crc ^= byte;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		}
+	}
+	return ~crc;
+}
+
+// Decoder for the part of RFC 1951 the writer uses: blocks with the fixed
+// Huffman codes. Anything else it doesn't expect fails the test.
+class Inflater {
+public:
+	Inflater(const uint8_t *data, size_t size) : _data(data), _size(size) {}
+
+	Bytes inflate() {
+		Bytes out;
+		bool final = false;
+		while (!final) {
+			final = bits(1);
+			TEST_ASSERT_EQUAL_MESSAGE(1, bits(2), "block type");
+			for (uint16_t symbol = symbolCode(); symbol != 256; symbol = symbolCode()) {
+				if (symbol < 256) {
+					out.push_back(symbol);
+					continue;
+				}
+				TEST_ASSERT_TRUE_MESSAGE(symbol <= 285, "length symbol");
+				uint16_t length = lengthBase[symbol - 257] + bits(lengthExtra[symbol - 257]);
+				uint16_t code = huffman(5);
+				TEST_ASSERT_TRUE_MESSAGE(code < 30, "distance code");
+				uint32_t distance = distanceBase[code] + bits(distanceExtra[code]);
+				TEST_ASSERT_TRUE_MESSAGE(distance <= out.size(), "distance before the start");
+				TEST_ASSERT_TRUE_MESSAGE(distance <= GZIP_WINDOW, "distance past the window");
+				for (uint16_t i = 0; i < length; i++) {
+					out.push_back(out[out.size() - distance]);
+				}
+			}
+		}
+		_bitCount = 0;	// The trailer starts at the next byte
+		return out;
+	}
+
+	size_t bytePosition() const { return _position; }
+
+private:
+	uint32_t bits(uint8_t count) {
+		uint32_t value = 0;
+		for (uint8_t i = 0; i < count; i++) {
+			if (_bitCount == 0) {
+				TEST_ASSERT_TRUE_MESSAGE(_position < _size, "stream ended in a block");
+				_byte = _data[_position++];
+				_bitCount = 8;
+			}
+			value |= (uint32_t)(_byte & 1) << i;
+			_byte >>= 1;
+			_bitCount--;
+		}
+		return value;
+	}
+
+	// Huffman codes are packed most significant bit first
+	uint16_t huffman(uint8_t count) {
+		uint16_t code = 0;
+		for (uint8_t i = 0; i < count; i++) {
+			code = code << 1 | bits(1);
+		}
+		return code;
+	}
+
+	// Fixed literal/length code (RFC 1951 3.2.6)
+	uint16_t symbolCode() {
+		uint16_t code = huffman(7);
+		if (code <= 0x17) {
+			return 256 + code;
+		}
+		code = code << 1 | bits(1);
+		if (code >= 0x30 && code <= 0xBF) {
+			return code - 0x30;
+		}
+		if (code >= 0xC0 && code <= 0xC7) {
+			return 280 + code - 0xC0;
+		}
+		code = code << 1 | bits(1);
+		return 144 + code - 0x190;
+	}
+
+	static constexpr uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+																							31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+	static constexpr uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+	static constexpr uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+																								257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+	static constexpr uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+																								7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+	const uint8_t *_data;
+	size_t _size;
+	size_t _position = 0;
+	uint8_t _byte = 0;
+	uint8_t _bitCount = 0;
+};
+
+static uint32_t readLe32(const Bytes &data, size_t offset) {
+	return data[offset] | data[offset + 1] << 8 | data[offset + 2] << 16 | (uint32_t)data[offset + 3] << 24;
+}
+
+// Compress input in writes of up to chunk bytes and return the archive
+static Bytes compress(const Bytes &input, size_t chunk) {
+	card.clear();
+	TEST_ASSERT_TRUE(gzipBegin(gz, card.open(ARCHIVE_PATH, FILE_WRITE)));
+	for (size_t i = 0; i < input.size(); i += chunk) {
+		TEST_ASSERT_TRUE(gzipWrite(gz, input.data() + i, min(chunk, input.size() - i)));
+	}
+	TEST_ASSERT_TRUE(gzipFinish(gz));
+	gz.file.close();
+	return card.data(ARCHIVE_PATH);
+}
+
+// Decode the archive and check header, data, CRC and size
+static void checkRoundTrip(const Bytes &input, size_t chunk = 4096) {
+	Bytes archive = compress(input, chunk);
+	TEST_ASSERT_TRUE(archive.size() >= 18);
+	TEST_ASSERT_EQUAL_HEX8(0x1F, archive[0]);
+	TEST_ASSERT_EQUAL_HEX8(0x8B, archive[1]);
+	TEST_ASSERT_EQUAL(8, archive[2]);	// Deflate
+	TEST_ASSERT_EQUAL(0, archive[3]);		// No name, comment or extra fields
+
+	Inflater inflater(archive.data() + 10, archive.size() - 10);
+	Bytes output = inflater.inflate();
+	TEST_ASSERT_EQUAL(input.size(), output.size());
+	TEST_ASSERT_TRUE(output == input);
+
+	size_t trailer = 10 + inflater.bytePosition();
+	TEST_ASSERT_EQUAL(archive.size(), trailer + 8);
+	TEST_ASSERT_EQUAL_HEX32(referenceCrc32(input), readLe32(archive, trailer));
+	TEST_ASSERT_EQUAL_UINT32(input.size(), readLe32(archive, trailer + 4));
+}
+
+// A day of the CSV the archive is made from
+static Bytes csvDay(uint32_t records) {
+	std::mt19937 random(1);
+	std::string csv;
+	for (uint32_t i = 0; i < records; i++) {
+		char line[64];
+		uint32_t second = 6 * 3600 + i * 30;
+		snprintf(line, sizeof(line), "%lu,2024-06-10,%02u:%02u:%02u,%.2f,%u,%u\r\n", (unsigned long)(1000 + i),
+						 second / 3600 % 24, second / 60 % 60, second % 60, 45 + (random() % 400) / 100.0, (i / 60) % 4,
+						 40 + (i / 60) % 4);
+		csv += line;
+	}
+	return Bytes(csv.begin(), csv.end());
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_input() {
+	checkRoundTrip(Bytes());
+}
+
+void test_short_text() {
+	const char *text = "readingID,date,time,psi,zone,avg\r\n";
+	checkRoundTrip(Bytes(text, text + strlen(text)));
+}
+
+void test_csv_day_compresses() {
+	Bytes csv = csvDay(2880);
+	checkRoundTrip(csv);
+	Bytes archive = card.data(ARCHIVE_PATH);
+	char message[64];
+	snprintf(message, sizeof(message), "%zu bytes to %zu", csv.size(), archive.size());
+	TEST_MESSAGE(message);
+	TEST_ASSERT_LESS_THAN(csv.size() * 2 / 5, archive.size());
+}
+
+// Nothing to match: every byte is a literal of at most 9 bits
+void test_random_bytes() {
+	std::mt19937 random(2);
+	Bytes input(50000);
+	for (uint8_t &byte : input) {
+		byte = random();
+	}
+	checkRoundTrip(input);
+	TEST_ASSERT_LESS_OR_EQUAL(input.size() * 9 / 8 + 18 + 1, card.data(ARCHIVE_PATH).size());
+}
+
+// A run is distance 1 matches of the longest length
+void test_long_run() {
+	checkRoundTrip(Bytes(100000, 0));
+	TEST_ASSERT_LESS_THAN(1000, card.data(ARCHIVE_PATH).size());
+}
+
+// Repeats right at the reach of the window, and across the window slides
+void test_repeats_at_the_window_edge() {
+	std::mt19937 random(3);
+	for (uint32_t distance : {GZIP_WINDOW - 1, GZIP_WINDOW, GZIP_WINDOW + 1, 2 * GZIP_WINDOW - 100}) {
+		Bytes block(distance);
+		for (uint8_t &byte : block) {
+			byte = random();
+		}
+		Bytes input;
+		for (int i = 0; i < 6; i++) {
+			input.insert(input.end(), block.begin(), block.end());
+		}
+		checkRoundTrip(input);
+	}
+}
+
+// The stream doesn't depend on how the input was split into writes
+void test_chunking_does_not_change_the_stream() {
+	Bytes csv = csvDay(3000);
+	Bytes whole = compress(csv, csv.size());
+	for (size_t chunk : {(size_t)1, (size_t)7, (size_t)255, (size_t)GZIP_WINDOW, (size_t)3 * GZIP_WINDOW + 5}) {
+		checkRoundTrip(csv, chunk);
+		TEST_ASSERT_TRUE(card.data(ARCHIVE_PATH) == whole);
+	}
+}
+
+void test_write_failure_is_reported() {
+	card.clear();
+	File file = card.open(ARCHIVE_PATH, FILE_WRITE);
+	gzipBegin(gz, file);
+	Bytes csv = csvDay(200);
+	TEST_ASSERT_TRUE(gzipWrite(gz, csv.data(), csv.size()));
+	file.failWrites();
+	TEST_ASSERT_FALSE(gzipFinish(gz));
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_empty_input);
+	RUN_TEST(test_short_text);
+	RUN_TEST(test_csv_day_compresses);
+	RUN_TEST(test_random_bytes);
+	RUN_TEST(test_long_run);
+	RUN_TEST(test_repeats_at_the_window_edge);
+	RUN_TEST(test_chunking_does_not_change_the_stream);
+	RUN_TEST(test_write_failure_is_reported);
+	return UNITY_END();
+}
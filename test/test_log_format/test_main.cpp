@@ -0,0 +1,352 @@
+#include <unity.h>
+#include <stddef.h>
+#include <vector>
+#include "LogFormat.h"
+
+#define LOG_PATH "/log/2024/06/20240610.bin"
+#define DAY_START 1718000000UL
+#define FLUSH_RECORDS 64	// Records one flush writes, LOG_BUFFER_RECORDS of the writer
+#define RESERVE_RECORDS 2881
+
+static fs::FS card;
+
+static LogCheckedRecord makeRecord(uint32_t epoch, uint32_t sequence) {
+	LogRecord record = {};
+	record.epoch = epoch;
+	record.centiPsi = 4000 + sequence % 700;
+	record.zone = sequence % 5;
+	record.avgPsi = 40 + record.zone;
+	record.zoneRow = record.zone;
+	LogCheckedRecord checked;
+	sealLogRecord(checked, record, sequence);
+	return checked;
+}
+
+// A version 3 log with reserved space, count records counted in the header
+// and the given records written from the first one on
+static File writeCheckedLog(const std::vector<LogCheckedRecord> &records, uint32_t count) {
+	card.clear();
+	File file = card.open(LOG_PATH, FILE_WRITE);
+	TEST_ASSERT_TRUE(writeLogHeader(file, DAY_START, records.empty() ? 1 : records[0].sequence));
+	file.seek(sizeof(LogFileHeader) + RESERVE_RECORDS * sizeof(LogCheckedRecord) - 1);
+	file.write((uint8_t)0);
+	file.seek(sizeof(LogFileHeader));
+	file.write((const uint8_t *)records.data(), records.size() * sizeof(LogCheckedRecord));
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	TEST_ASSERT_TRUE(setLogRecordCount(file, header, count));
+	file.close();
+	return card.open(LOG_PATH, "r+");
+}
+
+static std::vector<LogCheckedRecord> recordsFrom(uint32_t first, uint32_t count) {
+	std::vector<LogCheckedRecord> records;
+	for (uint32_t i = 0; i < count; i++) {
+		records.push_back(makeRecord(DAY_START + 30 * i, first + i));
+	}
+	return records;
+}
+
+// Overwrite the bytes of a record from offset on with what was on the card
+// before: a write cut short by a power cut
+static void tearRecord(uint32_t index, size_t offset, uint8_t fill = 0) {
+	std::vector<uint8_t> &data = card.data(LOG_PATH);
+	size_t start = sizeof(LogFileHeader) + index * sizeof(LogCheckedRecord);
+	memset(data.data() + start + offset, fill, sizeof(LogCheckedRecord) - offset);
+}
+
+static uint32_t recover(File &file, LogCheckedRecord &last, bool &haveLast) {
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	return recoverLogRecordCount(file, header, FLUSH_RECORDS, last, haveLast);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_sealed_record_is_intact() {
+	for (uint32_t i = 0; i < 1000; i++) {
+		LogCheckedRecord checked = makeRecord(DAY_START + i * 30, i + 1);
+		TEST_ASSERT_TRUE(isLogRecordIntact(checked));
+	}
+}
+
+// CRC-16/CCITT bit by bit, its check value for "123456789" is 0x29B1
+static uint16_t referenceCrc16(const uint8_t *bytes, size_t len) {
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= bytes[i] << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+// The CRC covers the record and its readingID, everything before the CRC
+void test_crc_is_ccitt_over_record_and_sequence() {
+	TEST_ASSERT_EQUAL_HEX16(0x29B1, referenceCrc16((const uint8_t *)"123456789", 9));
+	for (uint32_t i = 0; i < 1000; i++) {
+		LogCheckedRecord checked = makeRecord(DAY_START + i * 7, i * 131);
+		TEST_ASSERT_EQUAL_HEX16(referenceCrc16((const uint8_t *)&checked, offsetof(LogCheckedRecord, crc)), checked.crc);
+	}
+}
+
+void test_every_single_bit_flip_is_detected() {
+	LogCheckedRecord checked = makeRecord(DAY_START + 12345, 777);
+	for (size_t bit = 0; bit < sizeof(checked) * 8; bit++) {
+		LogCheckedRecord flipped = checked;
+		((uint8_t *)&flipped)[bit / 8] ^= 1 << (bit % 8);
+		TEST_ASSERT_FALSE(isLogRecordIntact(flipped));
+	}
+}
+
+// A record torn after any number of bytes, over zeros of reserved space or
+// over the 0xFF of an erased sector, is detected
+void test_torn_records_are_detected() {
+	for (uint8_t fill : {0x00, 0xFF}) {
+		for (size_t offset = 0; offset < sizeof(LogCheckedRecord); offset++) {
+			std::vector<LogCheckedRecord> records = recordsFrom(1, 3);
+			writeCheckedLog(records, 3).close();
+			tearRecord(1, offset, fill);
+			LogCheckedRecord torn;
+			memcpy(&torn, card.data(LOG_PATH).data() + sizeof(LogFileHeader) + sizeof(LogCheckedRecord), sizeof(torn));
+			TEST_ASSERT_FALSE(isLogRecordIntact(torn));
+		}
+	}
+}
+
+void test_zero_record_is_not_intact() {
+	LogCheckedRecord zero;
+	memset(&zero, 0, sizeof(zero));
+	TEST_ASSERT_FALSE(isLogRecordIntact(zero));
+}
+
+void test_recover_clean_log_keeps_the_count() {
+	File file = writeCheckedLog(recordsFrom(100, 50), 50);
+	LogCheckedRecord last;
+	bool haveLast;
+	TEST_ASSERT_EQUAL_UINT32(50, recover(file, last, haveLast));
+	TEST_ASSERT_TRUE(haveLast);
+	TEST_ASSERT_EQUAL_UINT32(149, last.sequence);
+}
+
+// A flush that wrote its records but was cut before it stored the count
+void test_recover_takes_in_an_uncounted_flush() {
+	File file = writeCheckedLog(recordsFrom(100, 50 + 32), 50);
+	LogCheckedRecord last;
+	bool haveLast;
+	TEST_ASSERT_EQUAL_UINT32(82, recover(file, last, haveLast));
+	TEST_ASSERT_EQUAL_UINT32(181, last.sequence);
+}
+
+// Only one flush can be uncounted, so no more than a flush is taken in
+void test_recover_takes_in_at_most_a_flush() {
+	File file = writeCheckedLog(recordsFrom(100, 50 + FLUSH_RECORDS + 10), 50);
+	LogCheckedRecord last;
+	bool haveLast;
+	TEST_ASSERT_EQUAL_UINT32(50 + FLUSH_RECORDS, recover(file, last, haveLast));
+}
+
+// The uncounted flush stops at its first torn record
+void test_recover_stops_at_a_torn_uncounted_record() {
+	writeCheckedLog(recordsFrom(100, 60), 50).close();
+	tearRecord(55, 6);
+	File file = card.open(LOG_PATH, "r+");
+	LogCheckedRecord last;
+	bool haveLast;
+	TEST_ASSERT_EQUAL_UINT32(55, recover(file, last, haveLast));
+	TEST_ASSERT_EQUAL_UINT32(154, last.sequence);
+}
+
+// Counted records that didn't reach the card, because the count's sector
+// was written before theirs, are dropped back to the last intact one
+void test_recover_drops_torn_counted_records() {
+	writeCheckedLog(recordsFrom(100, 50), 50).close();
+	tearRecord(49, 0);
+	tearRecord(48, 3);
+	File file = card.open(LOG_PATH, "r+");
+	LogCheckedRecord last;
+	bool haveLast;
+	TEST_ASSERT_EQUAL_UINT32(48, recover(file, last, haveLast));
+	TEST_ASSERT_EQUAL_UINT32(147, last.sequence);
+}
+
+// Intact records past the count that don't follow the last one, as left by
+// an older write of the day, are not taken in
+void test_recover_ignores_records_out_of_sequence() {
+	std::vector<LogCheckedRecord> records = recordsFrom(100, 50);
+	records.push_back(makeRecord(DAY_START + 30 * 60, 90));	// Older readingID
+	File file = writeCheckedLog(records, 50);
+	LogCheckedRecord last;
+	bool haveLast;
+	TEST_ASSERT_EQUAL_UINT32(50, recover(file, last, haveLast));
+
+	records.back() = makeRecord(DAY_START + 86400 + 10, 150);	// Another day's time
+	file = writeCheckedLog(records, 50);
+	TEST_ASSERT_EQUAL_UINT32(50, recover(file, last, haveLast));
+
+	records.back() = makeRecord(DAY_START, 150);	// Earlier than the last record
+	file = writeCheckedLog(records, 50);
+	TEST_ASSERT_EQUAL_UINT32(50, recover(file, last, haveLast));
+}
+
+void test_recover_empty_log() {
+	File file = writeCheckedLog({}, 0);
+	LogCheckedRecord last;
+	bool haveLast;
+	TEST_ASSERT_EQUAL_UINT32(0, recover(file, last, haveLast));
+	TEST_ASSERT_FALSE(haveLast);
+
+	// A first flush cut short before its count
+	file = writeCheckedLog(recordsFrom(7, 5), 0);
+	TEST_ASSERT_EQUAL_UINT32(5, recover(file, last, haveLast));
+	TEST_ASSERT_EQUAL_UINT32(11, last.sequence);
+}
+
+// Readers stop at the counted records and never read the reserved space,
+// and version 3 records give their own readingID
+void test_read_stops_at_the_count() {
+	std::vector<LogCheckedRecord> records = recordsFrom(100, 10);
+	records[4].sequence = 500;	// A gap in readingIDs, e.g. after a reset
+	sealLogRecord(records[4], records[4].record, 500);
+	File file = writeCheckedLog(records, 10);
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	TEST_ASSERT_EQUAL_UINT32(10, logRecordCount(file, header));
+	TEST_ASSERT_EQUAL_UINT32(sizeof(LogFileHeader) + 10 * sizeof(LogCheckedRecord), logDataSize(file, header));
+
+	LogRecord record;
+	uint32_t readingId;
+	for (uint32_t i = 0; i < 10; i++) {
+		TEST_ASSERT_TRUE(readLogRecord(file, header, record, &readingId));
+		TEST_ASSERT_EQUAL_UINT32(records[i].record.epoch, record.epoch);
+		TEST_ASSERT_EQUAL_UINT32(records[i].sequence, readingId);
+	}
+	TEST_ASSERT_FALSE(readLogRecord(file, header, record, &readingId));
+
+	TEST_ASSERT_TRUE(readLastLogRecord(file, header, record));
+	TEST_ASSERT_EQUAL_UINT32(records[9].record.epoch, record.epoch);
+}
+
+// A version 1 log has no count, the records run to the end of the file and
+// readingIDs count on from the header
+void test_version_1_log() {
+	card.clear();
+	File file = card.open(LOG_PATH, FILE_WRITE);
+	LogFileHeader header = {};
+	memcpy(header.magic, LOG_MAGIC, 4);
+	header.version = 1;
+	header.recordSize = sizeof(LogRecord);
+	header.headerSize = LOG_HEADER_V1_SIZE;
+	header.dayStart = DAY_START;
+	header.firstReadingId = 40;
+	file.write((const uint8_t *)&header, LOG_HEADER_V1_SIZE);
+	for (uint32_t i = 0; i < 5; i++) {
+		LogRecord record = makeRecord(DAY_START + i, 0).record;
+		file.write((const uint8_t *)&record, sizeof(record));
+	}
+	file.close();
+
+	file = card.open(LOG_PATH, FILE_READ);
+	LogFileHeader read;
+	TEST_ASSERT_TRUE(readLogHeader(file, read));
+	TEST_ASSERT_EQUAL_UINT32(5, logRecordCount(file, read));
+	LogRecord record;
+	uint32_t readingId;
+	for (uint32_t i = 0; i < 5; i++) {
+		TEST_ASSERT_TRUE(readLogRecord(file, read, record, &readingId));
+		TEST_ASSERT_EQUAL_UINT32(40 + i, readingId);
+		TEST_ASSERT_EQUAL_UINT32(DAY_START + i, record.epoch);
+	}
+	TEST_ASSERT_FALSE(readLogRecord(file, read, record));
+}
+
+void test_bad_headers_are_rejected() {
+	LogFileHeader header;
+	for (size_t offset : {offsetof(LogFileHeader, magic), offsetof(LogFileHeader, version), offsetof(LogFileHeader, recordSize)}) {
+		writeCheckedLog(recordsFrom(1, 2), 2).close();
+		card.data(LOG_PATH)[offset] = offset == offsetof(LogFileHeader, version) ? LOG_VERSION + 1 : 0xEE;
+		File file = card.open(LOG_PATH, FILE_READ);
+		TEST_ASSERT_FALSE(readLogHeader(file, header));
+	}
+}
+
+// The CSV and JSON renders send the stored readingID of each record
+void test_render_sends_stored_reading_ids() {
+	std::vector<LogCheckedRecord> records = recordsFrom(100, 3);
+	sealLogRecord(records[2], records[2].record, 900);
+	writeCheckedLog(records, 3).close();
+
+	for (LogFormat format : {LOG_FORMAT_CSV, LOG_FORMAT_JSON}) {
+		LogRenderState state;
+		TEST_ASSERT_TRUE(beginLogRender(state, card.open(LOG_PATH, FILE_READ), format));
+		std::string text;
+		uint8_t chunk[7];	// Small, so records are split across chunks
+		for (size_t n = renderLogRecords(state, chunk, sizeof(chunk)); n > 0; n = renderLogRecords(state, chunk, sizeof(chunk))) {
+			text.append((const char *)chunk, n);
+		}
+		std::string expected;
+		char line[80];
+		for (size_t i = 0; i < records.size(); i++) {
+			const LogRecord &record = records[i].record;
+			if (format == LOG_FORMAT_CSV) {
+				formatLogRecordCsv(record, records[i].sequence, line, sizeof(line));
+			} else {
+				snprintf(line, sizeof(line), "%s{\"id\":%lu,\"t\":%lu,\"psi\":%.2f,\"zone\":%u,\"avg\":%u,\"flags\":%u}",
+								 i ? "," : "[", (unsigned long)records[i].sequence, (unsigned long)record.epoch, record.centiPsi / 100.0f,
+								 record.zone, record.avgPsi, record.flags);
+			}
+			expected += line;
+		}
+		if (format == LOG_FORMAT_JSON) {
+			expected += "]";
+		}
+		TEST_ASSERT_EQUAL_STRING(expected.c_str(), text.c_str());
+	}
+}
+
+void test_summary_of_a_closed_day() {
+	std::vector<LogCheckedRecord> records = recordsFrom(1, 4);
+	int16_t psi[] = {4500, 3900, 6100, 5000};
+	for (size_t i = 0; i < 4; i++) {
+		records[i].record.centiPsi = psi[i];
+		records[i].record.flags = i == 2 ? LOG_FLAG_OUT_OF_BAND : 0;
+		sealLogRecord(records[i], records[i].record, records[i].sequence);
+	}
+	writeCheckedLog(records, 4).close();
+	TEST_ASSERT_TRUE(writeLogSummary(card, LOG_PATH, DAY_START + 86400));
+
+	File file = card.open(LOG_PATH, FILE_READ);
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	TEST_ASSERT_EQUAL_UINT32(DAY_START + 86400, header.summary.closedAt);
+	TEST_ASSERT_EQUAL_UINT32(4, header.summary.recordCount);
+	TEST_ASSERT_EQUAL(1, header.summary.outOfBandCount);
+	TEST_ASSERT_EQUAL(3900, header.summary.minCentiPsi);
+	TEST_ASSERT_EQUAL(6100, header.summary.maxCentiPsi);
+	TEST_ASSERT_EQUAL(4875, header.summary.meanCentiPsi);
+	TEST_ASSERT_EQUAL_UINT32(4, header.recordCount);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_sealed_record_is_intact);
+	RUN_TEST(test_crc_is_ccitt_over_record_and_sequence);
+	RUN_TEST(test_every_single_bit_flip_is_detected);
+	RUN_TEST(test_torn_records_are_detected);
+	RUN_TEST(test_zero_record_is_not_intact);
+	RUN_TEST(test_recover_clean_log_keeps_the_count);
+	RUN_TEST(test_recover_takes_in_an_uncounted_flush);
+	RUN_TEST(test_recover_takes_in_at_most_a_flush);
+	RUN_TEST(test_recover_stops_at_a_torn_uncounted_record);
+	RUN_TEST(test_recover_drops_torn_counted_records);
+	RUN_TEST(test_recover_ignores_records_out_of_sequence);
+	RUN_TEST(test_recover_empty_log);
+	RUN_TEST(test_read_stops_at_the_count);
+	RUN_TEST(test_version_1_log);
+	RUN_TEST(test_bad_headers_are_rejected);
+	RUN_TEST(test_render_sends_stored_reading_ids);
+	RUN_TEST(test_summary_of_a_closed_day);
+	return UNITY_END();
+}
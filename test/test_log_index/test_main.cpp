@@ -0,0 +1,217 @@
+#include <unity.h>
+#include <random>
+#include <vector>
+#include "LogIndex.h"
+
+#define LOG_PATH "/log/2024/06/20240610.bin"
+#define INDEX_PATH "/log/2024/06/20240610.idx"
+#define DAY_START 1718000000UL
+#define RESERVE_RECORDS 2881	// A record every 30 s for the day, as startDailyLog() reserves
+
+static fs::FS card;
+static std::vector<LogCheckedRecord> logged;
+
+// Create the daily log with its reserved space, as createLogFile() does
+static void createLog() {
+	File file = card.open(LOG_PATH, FILE_WRITE);
+	TEST_ASSERT_TRUE(writeLogHeader(file, DAY_START, 1));
+	file.seek(sizeof(LogFileHeader) + RESERVE_RECORDS * sizeof(LogCheckedRecord) - 1);
+	file.write((uint8_t)0);
+	file.close();
+	logged.clear();
+}
+
+// Append a batch of records the way writePending() does: in place after the
+// counted records, then the count, then the index
+static void appendRecords(const std::vector<uint32_t> &epochs, bool index = true) {
+	std::vector<LogCheckedRecord> batch;
+	for (uint32_t epoch : epochs) {
+		LogRecord record = {};
+		record.epoch = epoch;
+		record.centiPsi = 4000 + logged.size() % 500;
+		LogCheckedRecord checked;
+		sealLogRecord(checked, record, logged.size() + 1);
+		batch.push_back(checked);
+	}
+	File file = card.open(LOG_PATH, "r+");
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	uint32_t firstRecord = logRecordCount(file, header);
+	size_t len = batch.size() * sizeof(LogCheckedRecord);
+	TEST_ASSERT_TRUE(file.seek(header.headerSize + firstRecord * header.recordSize));
+	TEST_ASSERT_EQUAL(len, file.write((const uint8_t *)batch.data(), len));
+	TEST_ASSERT_TRUE(setLogRecordCount(file, header, firstRecord + batch.size()));
+	file.close();
+	if (index) {
+		TEST_ASSERT_TRUE(updateLogIndex(card, LOG_PATH, DAY_START, firstRecord, batch.data(), batch.size()));
+	}
+	logged.insert(logged.end(), batch.begin(), batch.end());
+}
+
+// The first record at or after epoch by reading every record
+static uint32_t scanForRecord(uint32_t epoch) {
+	uint32_t index = 0;
+	while (index < logged.size() && logged[index].record.epoch < epoch) {
+		index++;
+	}
+	return index;
+}
+
+// findLogRecord() against the scan for every time from before the day to
+// after it, and the record the file is left positioned at
+static void checkFind(uint32_t step) {
+	File file = card.open(LOG_PATH, FILE_READ);
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	for (uint32_t epoch = DAY_START - 120; epoch < DAY_START + 86400 + 300; epoch += step) {
+		uint32_t expected = scanForRecord(epoch);
+		uint32_t found = findLogRecord(card, LOG_PATH, file, header, epoch);
+		if (found != expected) {
+			char message[48];
+			snprintf(message, sizeof(message), "epoch day start + %ld", (long)(epoch - DAY_START));
+			TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected, found, message);
+		}
+		TEST_ASSERT_EQUAL(header.headerSize + found * header.recordSize, file.position());
+	}
+	file.close();
+}
+
+// A day of samples every 30 s with the gaps and bursts a real day has:
+// minutes without records, several records in one minute, and records
+// timed after the end of the log day
+static std::vector<uint32_t> dayOfSamples(std::mt19937 &random) {
+	std::vector<uint32_t> epochs;
+	uint32_t epoch = DAY_START + random() % 30;
+	while (epoch < DAY_START + 86400 + 200) {
+		epochs.push_back(epoch);
+		switch (random() % 20) {
+			case 0:
+				epoch += 600 + random() % 3000;	// Sensor task stalled or WiFi down
+				break;
+			case 1:
+				epoch += random() % 3;	// Transient captures
+				break;
+			default:
+				epoch += 30;
+		}
+	}
+	return epochs;
+}
+
+void setUp() {
+	card.clear();
+	createLog();
+}
+
+void tearDown() {}
+
+void test_incremental_index_matches_rebuild() {
+	std::mt19937 random(7);
+	std::vector<uint32_t> epochs = dayOfSamples(random);
+	for (size_t i = 0; i < epochs.size();) {
+		size_t n = min((size_t)(1 + random() % 10), epochs.size() - i);
+		appendRecords(std::vector<uint32_t>(epochs.begin() + i, epochs.begin() + i + n));
+		i += n;
+	}
+	std::vector<uint8_t> incremental = card.data(INDEX_PATH);
+	TEST_ASSERT_TRUE(rebuildLogIndex(card, LOG_PATH));
+	TEST_ASSERT_EQUAL(card.data(INDEX_PATH).size(), incremental.size());
+	TEST_ASSERT_EQUAL_MEMORY(card.data(INDEX_PATH).data(), incremental.data(), incremental.size());
+
+	LogIndexHeader header;
+	memcpy(&header, incremental.data(), sizeof(header));
+	TEST_ASSERT_EQUAL_UINT32(logged.size(), header.recordCount);
+	// Entries run to the minute of the newest record, late ones count as the last minute
+	uint32_t minutes = min((uint32_t)(logged.back().record.epoch - DAY_START) / 60 + 1, (uint32_t)LOG_INDEX_MINUTES);
+	TEST_ASSERT_EQUAL(sizeof(header) + minutes * sizeof(uint32_t), incremental.size());
+}
+
+void test_find_matches_scan() {
+	std::mt19937 random(11);
+	std::vector<uint32_t> epochs = dayOfSamples(random);
+	for (size_t i = 0; i < epochs.size(); i += 10) {
+		appendRecords(std::vector<uint32_t>(epochs.begin() + i, epochs.begin() + min(i + 10, epochs.size())));
+	}
+	checkFind(7);
+}
+
+// Part way through the day the index only covers the minutes up to the
+// newest record, later times go past every record
+void test_find_in_a_day_still_being_logged() {
+	appendRecords({DAY_START + 10, DAY_START + 40, DAY_START + 3600, DAY_START + 3601, DAY_START + 3630});
+	checkFind(13);
+	appendRecords({DAY_START + 7200});
+	checkFind(13);
+}
+
+void test_find_in_an_empty_log() {
+	checkFind(997);
+}
+
+// A batch whose index update was lost (reset between the log write and the
+// index write) makes the next update rebuild instead of extending
+void test_update_after_a_lost_batch_rebuilds() {
+	appendRecords({DAY_START + 30, DAY_START + 60});
+	appendRecords({DAY_START + 90, DAY_START + 120}, false);
+	appendRecords({DAY_START + 600, DAY_START + 630});
+
+	LogIndexHeader header;
+	memcpy(&header, card.data(INDEX_PATH).data(), sizeof(header));
+	TEST_ASSERT_EQUAL_UINT32(6, header.recordCount);
+	checkFind(11);
+}
+
+void test_missing_index_is_rebuilt_on_find() {
+	appendRecords({DAY_START + 30, DAY_START + 60, DAY_START + 4000});
+	card.remove(INDEX_PATH);
+	checkFind(17);
+	TEST_ASSERT_TRUE(card.exists(INDEX_PATH));
+}
+
+void test_damaged_index_is_rebuilt_on_find() {
+	appendRecords({DAY_START + 30, DAY_START + 60, DAY_START + 4000});
+	card.data(INDEX_PATH)[0] = 'X';
+	checkFind(17);
+	TEST_ASSERT_EQUAL_MEMORY(LOG_INDEX_MAGIC, card.data(INDEX_PATH).data(), 4);
+}
+
+// An index counting more records than the log holds (the log tail was cut
+// back at boot) is not trusted
+void test_index_ahead_of_the_log_is_not_used() {
+	appendRecords({DAY_START + 30, DAY_START + 60, DAY_START + 4000, DAY_START + 5000});
+	File file = card.open(LOG_PATH, "r+");
+	LogFileHeader header;
+	readLogHeader(file, header);
+	setLogRecordCount(file, header, 2);
+	file.close();
+	logged.resize(2);
+	checkFind(17);
+}
+
+// An entry pointing past the records it covers is damage, not a position
+void test_entry_past_the_count_is_not_used() {
+	appendRecords({DAY_START + 30, DAY_START + 60, DAY_START + 4000});
+	uint32_t bad = 99;
+	memcpy(card.data(INDEX_PATH).data() + sizeof(LogIndexHeader) + 60 * sizeof(uint32_t), &bad, sizeof(bad));
+	checkFind(17);
+}
+
+void test_index_path() {
+	String indexPath = logIndexPath(LOG_PATH);
+	TEST_ASSERT_EQUAL_STRING(INDEX_PATH, indexPath.c_str());
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_incremental_index_matches_rebuild);
+	RUN_TEST(test_find_matches_scan);
+	RUN_TEST(test_find_in_a_day_still_being_logged);
+	RUN_TEST(test_find_in_an_empty_log);
+	RUN_TEST(test_update_after_a_lost_batch_rebuilds);
+	RUN_TEST(test_missing_index_is_rebuilt_on_find);
+	RUN_TEST(test_damaged_index_is_rebuilt_on_find);
+	RUN_TEST(test_index_ahead_of_the_log_is_not_used);
+	RUN_TEST(test_entry_past_the_count_is_not_used);
+	RUN_TEST(test_index_path);
+	return UNITY_END();
+}
@@ -0,0 +1,325 @@
+#include <unity.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "LogRange.h"
+
+#define LOG_PATH "/log/2024/06/20240610.bin"
+#define DAY_START 1718000000UL
+
+// A record of the test log as the range read should see it
+struct Sample {
+	uint32_t epoch;
+	int16_t low;
+	int16_t high;
+	LogRecord record;
+	uint32_t readingId;
+};
+
+static fs::FS card;
+static std::vector<Sample> samples;
+
+// Write a day of raw samples, as the logger does
+static void writeSampleLog(const std::vector<uint32_t> &epochs, std::mt19937 &random) {
+	card.clear();
+	samples.clear();
+	File file = card.open(LOG_PATH, FILE_WRITE);
+	TEST_ASSERT_TRUE(writeLogHeader(file, DAY_START, 1));
+	for (uint32_t epoch : epochs) {
+		LogRecord record = {};
+		record.epoch = epoch;
+		record.centiPsi = 3000 + random() % 3000;
+		record.zone = random() % 4;
+		record.avgPsi = 40 + record.zone;
+		LogCheckedRecord checked;
+		uint32_t readingId = 1000 + samples.size() * 3;	// Not consecutive, the stored ID is what's sent
+		sealLogRecord(checked, record, readingId);
+		file.write((const uint8_t *)&checked, sizeof(checked));
+		samples.push_back({epoch, record.centiPsi, record.centiPsi, record, readingId});
+	}
+	LogFileHeader header;
+	readLogHeader(file, header);
+	setLogRecordCount(file, header, samples.size());
+	file.close();
+}
+
+// Write a compacted day, as the retention pass leaves it
+static void writeAggregateLog(const std::vector<uint32_t> &epochs, std::mt19937 &random) {
+	card.clear();
+	samples.clear();
+	File file = card.open(LOG_PATH, FILE_WRITE);
+	LogFileHeader header = {};
+	memcpy(header.magic, LOG_MAGIC, 4);
+	header.version = LOG_VERSION;
+	header.recordSize = sizeof(LogAggregateRecord);
+	header.headerSize = sizeof(LogFileHeader);
+	header.dayStart = DAY_START;
+	header.firstReadingId = 500;
+	header.recordCount = epochs.size();
+	file.write((const uint8_t *)&header, sizeof(header));
+	for (uint32_t epoch : epochs) {
+		LogAggregateRecord aggregate = {};
+		aggregate.sample.epoch = epoch;
+		aggregate.sample.centiPsi = 3000 + random() % 3000;
+		aggregate.sample.flags = LOG_FLAG_AGGREGATE;
+		aggregate.minCentiPsi = aggregate.sample.centiPsi - random() % 500;
+		aggregate.maxCentiPsi = aggregate.sample.centiPsi + random() % 500;
+		aggregate.count = 10;
+		aggregate.seconds = 300;
+		file.write((const uint8_t *)&aggregate, sizeof(aggregate));
+		samples.push_back({epoch, aggregate.minCentiPsi, aggregate.maxCentiPsi, aggregate.sample, 500 + (uint32_t)samples.size()});
+	}
+	file.close();
+}
+
+// The range read by brute force: every record of the clipped window into
+// its bucket, then each bucket's lowest and highest record in time order
+static std::string expectedRange(uint32_t from, uint32_t to, uint16_t points) {
+	if (samples.empty()) {
+		return "";
+	}
+	from = max(from, samples.front().epoch);
+	to = min(to, samples.back().epoch);
+	if (to < from) {
+		return "";
+	}
+	points = constrain(points, 2, RANGE_MAX_POINTS);
+	uint32_t bucketSeconds = (to - from) / (points / 2) + 1;
+
+	std::string csv;
+	size_t i = 0;
+	while (i < samples.size() && samples[i].epoch < from) {
+		i++;
+	}
+	while (i < samples.size() && samples[i].epoch <= to) {
+		uint32_t bucket = (samples[i].epoch - from) / bucketSeconds;
+		size_t minIndex = i;
+		size_t maxIndex = i;
+		for (; i < samples.size() && samples[i].epoch <= to && (samples[i].epoch - from) / bucketSeconds == bucket; i++) {
+			if (samples[i].low < samples[minIndex].low) {
+				minIndex = i;
+			}
+			if (samples[i].high > samples[maxIndex].high) {
+				maxIndex = i;
+			}
+		}
+		char line[80];
+		LogRecord low = samples[minIndex].record;
+		low.centiPsi = samples[minIndex].low;
+		LogRecord high = samples[maxIndex].record;
+		high.centiPsi = samples[maxIndex].high;
+		if (minIndex == maxIndex && low.centiPsi == high.centiPsi) {
+			formatLogRecordCsv(low, samples[minIndex].readingId, line, sizeof(line));
+			csv += line;
+		} else if (maxIndex < minIndex) {
+			formatLogRecordCsv(high, samples[maxIndex].readingId, line, sizeof(line));
+			csv += line;
+			formatLogRecordCsv(low, samples[minIndex].readingId, line, sizeof(line));
+			csv += line;
+		} else {
+			formatLogRecordCsv(low, samples[minIndex].readingId, line, sizeof(line));
+			csv += line;
+			formatLogRecordCsv(high, samples[maxIndex].readingId, line, sizeof(line));
+			csv += line;
+		}
+	}
+	return csv;
+}
+
+// The response body, taken in chunks of chunkSize as the web server asks for it
+static std::string renderRange(uint32_t from, uint32_t to, uint16_t points, size_t chunkSize = 1460) {
+	RangeQueryState state;
+	TEST_ASSERT_TRUE(beginRangeQuery(state, card, LOG_PATH, from, to, points));
+	std::string csv;
+	std::vector<uint8_t> chunk(chunkSize);
+	for (size_t n = renderRangeQuery(state, chunk.data(), chunk.size()); n > 0;
+			 n = renderRangeQuery(state, chunk.data(), chunk.size())) {
+		csv.append((const char *)chunk.data(), n);
+	}
+	state.file.close();
+	return csv;
+}
+
+static size_t countLines(const std::string &csv) {
+	return std::count(csv.begin(), csv.end(), '\n');
+}
+
+// Samples every interval seconds with stalls and bursts
+static std::vector<uint32_t> dayOfSamples(std::mt19937 &random, uint32_t interval) {
+	std::vector<uint32_t> epochs;
+	for (uint32_t epoch = DAY_START + random() % interval; epoch < DAY_START + 86400;) {
+		epochs.push_back(epoch);
+		uint32_t kind = random() % 50;
+		epoch += kind == 0 ? 600 + random() % 3000 : kind == 1 ? random() % 2 : interval;
+	}
+	return epochs;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_random_windows_match_brute_force() {
+	std::mt19937 random(3);
+	writeSampleLog(dayOfSamples(random, 30), random);
+	for (int i = 0; i < 200; i++) {
+		uint32_t from = DAY_START - 600 + random() % 88000;
+		uint32_t to = from + random() % 40000;
+		uint16_t points = random() % 1200;
+		size_t chunk = 1 + random() % 2000;
+		std::string expected = expectedRange(from, to, points);
+		std::string csv = renderRange(from, to, points, chunk);
+		TEST_ASSERT_EQUAL_STRING(expected.c_str(), csv.c_str());
+		TEST_ASSERT_LESS_OR_EQUAL((size_t)constrain(points, 2, RANGE_MAX_POINTS), countLines(csv));
+	}
+}
+
+void test_whole_day_by_default() {
+	std::mt19937 random(5);
+	std::vector<uint32_t> epochs;
+	for (uint32_t epoch = DAY_START; epoch < DAY_START + 86400; epoch += 30) {
+		epochs.push_back(epoch);
+	}
+	writeSampleLog(epochs, random);
+	std::string csv = renderRange(0, UINT32_MAX, RANGE_DEFAULT_POINTS);
+	TEST_ASSERT_EQUAL_STRING(expectedRange(0, UINT32_MAX, RANGE_DEFAULT_POINTS).c_str(), csv.c_str());
+	TEST_ASSERT_LESS_OR_EQUAL(RANGE_DEFAULT_POINTS, countLines(csv));
+	TEST_ASSERT_GREATER_THAN(RANGE_DEFAULT_POINTS * 9 / 10, countLines(csv));
+}
+
+// Fewer records than points: every record goes out once, unchanged
+void test_sparse_window_sends_every_record() {
+	std::mt19937 random(9);
+	writeSampleLog({DAY_START + 10, DAY_START + 70, DAY_START + 4000}, random);
+	std::string csv = renderRange(0, UINT32_MAX, 500);
+	TEST_ASSERT_EQUAL(3, countLines(csv));
+	TEST_ASSERT_EQUAL_STRING(expectedRange(0, UINT32_MAX, 500).c_str(), csv.c_str());
+}
+
+void test_empty_and_outside_windows() {
+	std::mt19937 random(13);
+	writeSampleLog({}, random);
+	TEST_ASSERT_EQUAL_STRING("", renderRange(0, UINT32_MAX, 500).c_str());
+	writeSampleLog({DAY_START + 3600, DAY_START + 7200}, random);
+	TEST_ASSERT_EQUAL_STRING("", renderRange(DAY_START, DAY_START + 3599, 500).c_str());
+	TEST_ASSERT_EQUAL_STRING("", renderRange(DAY_START + 7201, UINT32_MAX, 500).c_str());
+	TEST_ASSERT_EQUAL_STRING("", renderRange(DAY_START + 5000, DAY_START + 4000, 500).c_str());
+}
+
+void test_missing_file_fails() {
+	card.clear();
+	RangeQueryState state;
+	TEST_ASSERT_FALSE(beginRangeQuery(state, card, LOG_PATH, 0, UINT32_MAX, 500));
+}
+
+// A compacted day sends each bucket's lowest minimum and highest maximum
+void test_compacted_day_keeps_the_spread() {
+	std::mt19937 random(17);
+	std::vector<uint32_t> epochs;
+	for (uint32_t epoch = DAY_START; epoch < DAY_START + 86400; epoch += 300) {
+		epochs.push_back(epoch);
+	}
+	writeAggregateLog(epochs, random);
+	for (uint16_t points : {2, 50, 288, 576, 2000}) {
+		std::string csv = renderRange(0, UINT32_MAX, points, 97);
+		TEST_ASSERT_EQUAL_STRING(expectedRange(0, UINT32_MAX, points).c_str(), csv.c_str());
+	}
+}
+
+// A day sampled every second, read whole and zoomed to two hours. The zoom
+// has to start at its first record through the index instead of reading the
+// day up to it. Times are printed for comparison, not checked, as they depend
+// on the host.
+void test_benchmark_day_at_one_second() {
+	std::mt19937 random(21);
+	std::vector<uint32_t> epochs;
+	for (uint32_t epoch = DAY_START; epoch < DAY_START + 86400; epoch++) {
+		epochs.push_back(epoch);
+	}
+	writeSampleLog(epochs, random);
+	RangeQueryState warm;
+	beginRangeQuery(warm, card, LOG_PATH, DAY_START, DAY_START, 2);	// Builds the index
+	warm.file.close();
+
+	struct {
+		const char *name;
+		uint32_t from;
+		uint32_t to;
+	} windows[] = {
+			{"whole day", 0, UINT32_MAX},
+			{"2 hour zoom", DAY_START + 10 * 3600, DAY_START + 12 * 3600 - 1},
+	};
+	for (auto &window : windows) {
+		auto start = std::chrono::steady_clock::now();
+		std::string csv = renderRange(window.from, window.to, RANGE_DEFAULT_POINTS);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		char message[96];
+		snprintf(message, sizeof(message), "%s: %zu lines, %zu bytes, %.2f ms", window.name, countLines(csv), csv.size(), ms);
+		TEST_MESSAGE(message);
+		TEST_ASSERT_LESS_OR_EQUAL(RANGE_DEFAULT_POINTS, countLines(csv));
+	}
+
+	RangeQueryState state;
+	uint32_t from = DAY_START + 10 * 3600;
+	TEST_ASSERT_TRUE(beginRangeQuery(state, card, LOG_PATH, from, from + 7199, RANGE_DEFAULT_POINTS));
+	TEST_ASSERT_EQUAL_UINT32(10 * 3600, state.index);
+	TEST_ASSERT_EQUAL(state.header.headerSize + state.index * state.header.recordSize, state.file.position());
+	uint8_t chunk[1460];
+	while (renderRangeQuery(state, chunk, sizeof(chunk)) > 0) {
+	}
+	TEST_ASSERT_EQUAL_UINT32(12 * 3600, state.index);	// Stopped at the first record after the window
+	state.file.close();
+}
+
+// Week-long files of 20,160 records (30 s sampling) and 604,800 records
+// (1 s sampling), read whole and zoomed to two hours on the first and the
+// sixth day. The minute index only covers the first day, so the later zoom
+// scans from the end of it; both are printed to show the difference.
+// Times are for the in-memory FS and measure CPU cost only.
+void test_benchmark_week_long_files() {
+	std::mt19937 random(23);
+	for (uint32_t interval : {30, 1}) {
+		std::vector<uint32_t> epochs;
+		for (uint32_t epoch = DAY_START; epoch < DAY_START + 7 * 86400; epoch += interval) {
+			epochs.push_back(epoch);
+		}
+		writeSampleLog(epochs, random);
+		RangeQueryState warm;
+		beginRangeQuery(warm, card, LOG_PATH, DAY_START, DAY_START, 2);	// Builds the index
+		warm.file.close();
+
+		struct {
+			const char *name;
+			uint32_t from;
+			uint32_t to;
+		} windows[] = {
+				{"whole week", 0, UINT32_MAX},
+				{"2 hour zoom, day 1", DAY_START + 10 * 3600, DAY_START + 12 * 3600 - 1},
+				{"2 hour zoom, day 6", DAY_START + 5 * 86400 + 10 * 3600, DAY_START + 5 * 86400 + 12 * 3600 - 1},
+		};
+		for (auto &window : windows) {
+			auto start = std::chrono::steady_clock::now();
+			std::string csv = renderRange(window.from, window.to, RANGE_DEFAULT_POINTS);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			char message[128];
+			snprintf(message, sizeof(message), "%u s sampling, %zu records (%zu KB), %s: %zu lines, %zu bytes, %.2f ms",
+							 (unsigned)interval, samples.size(), card.data(LOG_PATH).size() / 1024, window.name, countLines(csv),
+							 csv.size(), ms);
+			TEST_MESSAGE(message);
+			TEST_ASSERT_EQUAL_STRING(expectedRange(window.from, window.to, RANGE_DEFAULT_POINTS).c_str(), csv.c_str());
+			TEST_ASSERT_LESS_OR_EQUAL(RANGE_DEFAULT_POINTS, countLines(csv));
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_random_windows_match_brute_force);
+	RUN_TEST(test_whole_day_by_default);
+	RUN_TEST(test_sparse_window_sends_every_record);
+	RUN_TEST(test_empty_and_outside_windows);
+	RUN_TEST(test_missing_file_fails);
+	RUN_TEST(test_compacted_day_keeps_the_spread);
+	RUN_TEST(test_benchmark_day_at_one_second);
+	RUN_TEST(test_benchmark_week_long_files);
+	return UNITY_END();
+}
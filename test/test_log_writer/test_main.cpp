@@ -0,0 +1,261 @@
+// Host tests of the daily log writer: pio test -e native_log
+// The real writePending() and createLogFile() write to the in-memory card of
+// SD.h, whose cost model charges every data sector, FAT sector and directory
+// entry update to the fake clock. The flush histogram of logWriterStats()
+// then shows what allocating clusters in the middle of a day costs. The same
+// comparison on a real card is test_target_log_latency.
+
+#include <unity.h>
+#include "LogWriter.h"
+#include "SdCardUtils.h"
+
+#define DAY_START 1717999200UL	// 2024-06-10 06:00, start of a log day
+#define DAY_SECONDS 86400UL
+#define LOG_DAYS 3
+
+// Card model: 32 KB clusters, 0.25 ms per data sector, 1 ms per directory
+// entry, 12 ms per FAT sector and a 120 ms stall on every 8th FAT write
+static const fs::HostCardCosts cheapCard = {32768, 250, 1000, 12000, 8, 120000};
+
+// Flushes of one run of the writer
+struct FlushRun {
+	uint32_t histogram[LOG_FLUSH_BUCKETS];
+	uint32_t flushes;
+	uint32_t allocatingFlushes;	// Flushes that allocated a cluster of the log or its index
+	uint32_t maxUs;
+	uint64_t totalUs;
+	uint64_t reserveUs;					// Spent in createLogFile() at the start of the days
+};
+
+// The SD task: jobs run at once on the caller
+bool sdRun(SdPriority priority, const std::function<void()> &job, TickType_t timeout) {
+	job();
+	return true;
+}
+
+void sdPost(SdPriority priority, const std::function<void()> &job) {
+	job();
+}
+
+bool truncateSdFile(const char *path, uint32_t size) {
+	return SD.truncate(path, size);
+}
+
+static String logPath(uint32_t day) {
+	char path[40];
+	snprintf(path, sizeof(path), "/log/2024/06/202406%02lu.bin", (unsigned long)(10 + day));
+	return String(path);
+}
+
+static void flush(FlushRun &run) {
+	LogWriterStats before = logWriterStats();
+	uint32_t allocated = SD.card().counts.clustersAllocated;
+	TEST_ASSERT_TRUE(flushLog());
+	const LogWriterStats &after = logWriterStats();
+	TEST_ASSERT_EQUAL_UINT32(before.flushes + 1, after.flushes);
+	for (uint8_t i = 0; i < LOG_FLUSH_BUCKETS; i++) {
+		run.histogram[i] += after.flushHistogram[i] - before.flushHistogram[i];
+	}
+	run.flushes++;
+	run.allocatingFlushes += SD.card().counts.clustersAllocated != allocated;
+	run.maxUs = max(run.maxUs, after.lastFlushUs);
+	run.totalUs += after.lastFlushUs;
+}
+
+// Log days of samples every interval seconds, flushing whenever the writer
+// asks for it, and close each day as rolloverDailyLog() does. With reserve
+// each day is created at its full size first, as startDailyLog() does,
+// otherwise the first flush creates it and every flush makes it grow.
+static void logDays(uint32_t interval, bool reserve, FlushRun &run) {
+	memset(&run, 0, sizeof(run));
+	SD.clear();
+	SD.card().costs = cheapCard;
+	SD.card().counts = {};
+	uint32_t dayRecords = DAY_SECONDS / interval;
+	uint32_t readingId = 1;
+
+	for (uint32_t day = 0; day < LOG_DAYS; day++) {
+		uint32_t dayStart = DAY_START + day * DAY_SECONDS;
+		String path = logPath(day);
+		if (reserve) {
+			uint64_t start = hostMicros;
+			TEST_ASSERT_TRUE(createLogFile(SD, path.c_str(), dayStart, readingId, dayRecords + 1));
+			run.reserveUs += hostMicros - start;
+		}
+		size_t reservedSize = reserve ? SD.data(path).size() : 0;
+
+		for (uint32_t second = 0; second < DAY_SECONDS; second += interval) {
+			hostAdvanceMillis(interval * 1000);
+			LogRecord record = {};
+			record.epoch = dayStart + second;
+			record.centiPsi = 4000 + second % 700;
+			TEST_ASSERT_TRUE(logRecord(path, record, dayStart, readingId++));
+			if (logFlushDue()) {
+				flush(run);
+			}
+		}
+		if (logBufferDepth() > 0) {
+			flush(run);
+		}
+		if (reserve) {
+			TEST_ASSERT_EQUAL_UINT32_MESSAGE(reservedSize, SD.data(path).size(), "a preallocated day must not grow");
+		}
+
+		TEST_ASSERT_TRUE(writeLogSummary(SD, path.c_str(), dayStart + DAY_SECONDS));
+		TEST_ASSERT_TRUE(trimLogFile(SD, path.c_str()));
+		File file = SD.open(path);
+		LogFileHeader header;
+		TEST_ASSERT_TRUE(readLogHeader(file, header));
+		TEST_ASSERT_EQUAL_UINT32(dayRecords, header.recordCount);
+		TEST_ASSERT_EQUAL_UINT32(dayRecords, header.summary.recordCount);
+		TEST_ASSERT_EQUAL_UINT32(sizeof(LogFileHeader) + dayRecords * sizeof(LogCheckedRecord), file.size());
+		LogRecord last;
+		TEST_ASSERT_TRUE(readLastLogRecord(file, header, last));
+		TEST_ASSERT_EQUAL_UINT32(dayStart + DAY_SECONDS - interval, last.epoch);
+		file.close();
+	}
+}
+
+static uint32_t stalls(const FlushRun &run) {
+	uint32_t count = 0;
+	for (uint8_t i = 5; i < LOG_FLUSH_BUCKETS; i++) {	// 16 ms and longer
+		count += run.histogram[i];
+	}
+	return count;
+}
+
+static void printRun(const char *name, const FlushRun &run) {
+	char line[200];
+	int len = snprintf(line, sizeof(line), "%-9s", name);
+	for (uint8_t i = 0; i < LOG_FLUSH_BUCKETS; i++) {
+		len += snprintf(line + len, sizeof(line) - len, " %5lu", (unsigned long)run.histogram[i]);
+	}
+	snprintf(line + len, sizeof(line) - len, "  mean %.2f ms, max %.1f ms, %lu of %lu allocate, reserving %.1f ms/day",
+					 run.totalUs / 1000.0 / run.flushes, run.maxUs / 1000.0, (unsigned long)run.allocatingFlushes,
+					 (unsigned long)run.flushes, run.reserveUs / 1000.0 / LOG_DAYS);
+	TEST_MESSAGE(line);
+}
+
+// Growing and preallocated days at one sample interval. Preallocated days
+// only allocate for their index, about once a day, and never stall more often.
+static void compareRuns(uint32_t interval) {
+	FlushRun growing;
+	FlushRun reserved;
+	logDays(interval, false, growing);
+	logDays(interval, true, reserved);
+
+	char title[120];
+	snprintf(title, sizeof(title), "%lu s samples, %d days, flush ms   <1    <2    <4    <8   <16   <32   <64  >=64",
+					 (unsigned long)interval, LOG_DAYS);
+	TEST_MESSAGE(title);
+	printRun("growing", growing);
+	printRun("prealloc", reserved);
+
+	TEST_ASSERT_EQUAL_UINT32(growing.flushes, reserved.flushes);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LOG_DAYS, reserved.allocatingFlushes);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(growing.allocatingFlushes, reserved.allocatingFlushes);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(stalls(growing), stalls(reserved));
+}
+
+void test_flushes_of_one_second_samples() {
+	compareRuns(1);
+}
+
+void test_flushes_of_thirty_second_samples() {
+	compareRuns(30);
+}
+
+// Records buffered before a software reset are written by initLogWriter()
+void test_records_survive_a_software_reset() {
+	SD.clear();
+	SD.card().costs = fs::HostCardCosts();
+	String path = logPath(0);
+	TEST_ASSERT_TRUE(createLogFile(SD, path.c_str(), DAY_START, 100, 2881));
+	for (uint32_t i = 0; i < 10; i++) {
+		LogRecord record = {};
+		record.epoch = DAY_START + i * 30;
+		TEST_ASSERT_TRUE(logRecord(path, record, DAY_START, 100 + i));
+	}
+	TEST_ASSERT_EQUAL_UINT8(10, logBufferDepth());
+
+	hostResetReason = ESP_RST_SW;
+	initLogWriter(SD);
+	hostResetReason = ESP_RST_POWERON;
+	TEST_ASSERT_EQUAL_UINT8(0, logBufferDepth());
+
+	uint32_t nextReadingId = 0;
+	TEST_ASSERT_TRUE(recoverLogTail(SD, path.c_str(), nextReadingId));
+	TEST_ASSERT_EQUAL_UINT32(110, nextReadingId);
+	File file = SD.open(path);
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	TEST_ASSERT_EQUAL_UINT32(10, logRecordCount(file, header));
+	file.close();
+}
+
+// A day that was being filled when a reset came after its end is found at
+// boot and closed as closeStaleLog() does
+void test_day_left_open_by_a_reset_is_closed_at_boot() {
+	SD.clear();
+	SD.card().costs = fs::HostCardCosts();
+	String path = logPath(0);
+	TEST_ASSERT_TRUE(createLogFile(SD, path.c_str(), DAY_START, 1, 2881));
+	for (uint32_t i = 0; i < 100; i++) {
+		LogRecord record = {};
+		record.epoch = DAY_START + i * 30;
+		record.centiPsi = 4000 + i;
+		TEST_ASSERT_TRUE(logRecord(path, record, DAY_START, 1 + i));
+	}
+	TEST_ASSERT_TRUE(flushLog());
+
+	// The day being logged is not stale, the next day finds it open
+	TEST_ASSERT_FALSE(isLogLeftOpen(SD, path.c_str(), DAY_START));
+	TEST_ASSERT_TRUE(isLogLeftOpen(SD, path.c_str(), DAY_START + DAY_SECONDS));
+	TEST_ASSERT_FALSE(isLogLeftOpen(SD, logPath(1).c_str(), DAY_START + DAY_SECONDS));
+
+	// Boot after the reset: recover the tail, then close the day
+	initLogWriter(SD);
+	uint32_t nextReadingId = 0;
+	TEST_ASSERT_TRUE(recoverLogTail(SD, path.c_str(), nextReadingId));
+	TEST_ASSERT_EQUAL_UINT32(101, nextReadingId);
+	uint32_t closedAt = DAY_START + DAY_SECONDS + 600;
+	TEST_ASSERT_TRUE(writeLogSummary(SD, path.c_str(), closedAt));
+	TEST_ASSERT_TRUE(trimLogFile(SD, path.c_str()));
+
+	TEST_ASSERT_FALSE(isLogLeftOpen(SD, path.c_str(), DAY_START + DAY_SECONDS));
+	File file = SD.open(path);
+	LogFileHeader header;
+	TEST_ASSERT_TRUE(readLogHeader(file, header));
+	TEST_ASSERT_EQUAL_UINT32(closedAt, header.summary.closedAt);
+	TEST_ASSERT_EQUAL_UINT32(100, header.summary.recordCount);
+	TEST_ASSERT_EQUAL(4000, header.summary.minCentiPsi);
+	TEST_ASSERT_EQUAL(4099, header.summary.maxCentiPsi);
+	TEST_ASSERT_EQUAL_UINT32(sizeof(LogFileHeader) + 100 * sizeof(LogCheckedRecord), file.size());
+	file.close();
+}
+
+// A closed day with no records still has a summary, so it is not taken as open
+void test_empty_closed_day_is_not_open() {
+	SD.clear();
+	String path = logPath(0);
+	TEST_ASSERT_TRUE(createLogFile(SD, path.c_str(), DAY_START, 1, 2881));
+	TEST_ASSERT_TRUE(isLogLeftOpen(SD, path.c_str(), DAY_START + DAY_SECONDS));
+	TEST_ASSERT_TRUE(writeLogSummary(SD, path.c_str(), DAY_START + DAY_SECONDS));
+	TEST_ASSERT_FALSE(isLogLeftOpen(SD, path.c_str(), DAY_START + DAY_SECONDS));
+}
+
+void setUp() {
+	initLogWriter(SD);
+}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_flushes_of_one_second_samples);
+	RUN_TEST(test_flushes_of_thirty_second_samples);
+	RUN_TEST(test_records_survive_a_software_reset);
+	RUN_TEST(test_day_left_open_by_a_reset_is_closed_at_boot);
+	RUN_TEST(test_empty_closed_day_is_not_open);
+	return UNITY_END();
+}
@@ -0,0 +1,210 @@
+#include <unity.h>
+#include <deque>
+#include <vector>
+#include "NTPClient.h"
+
+#define UNIX_SECS 1718000000UL	// 2024-06-10, what the fake server answers with
+
+// A UDP socket with a scripted server behind it: replies are queued with the
+// fake millis() at which they arrive and are only seen by parsePacket() from then on
+class FakeUdp : public UDP {
+public:
+	struct Packet {
+		uint32_t arrival;
+		std::vector<uint8_t> data;
+	};
+
+	std::deque<Packet> packets;
+	std::vector<Packet> sent;
+	uint32_t replyDelay = 0;	// Answer every request this many ms after it was sent
+	bool answer = false;
+	uint8_t fractionHigh = 0;	// Top byte of the transmit timestamp fraction of answers
+
+	uint8_t begin(uint16_t port) override { return 1; }
+	void stop() override {}
+	int beginPacket(const char *host, uint16_t port) override {
+		sent.push_back({(uint32_t)millis(), {}});
+		return 1;
+	}
+	int endPacket() override {
+		if (answer) {
+			queue(millis() + replyDelay, reply(UNIX_SECS, fractionHigh));
+		}
+		return 1;
+	}
+	size_t write(const uint8_t *buffer, size_t size) override {
+		sent.back().data.assign(buffer, buffer + size);
+		return size;
+	}
+	int parsePacket() override {
+		return !packets.empty() && (int32_t)(millis() - packets.front().arrival) >= 0 ? packets.front().data.size() : 0;
+	}
+	int read(unsigned char *buffer, size_t len) override {
+		if (!parsePacket()) {
+			return 0;
+		}
+		size_t n = min(len, packets.front().data.size());
+		memcpy(buffer, packets.front().data.data(), n);
+		packets.pop_front();
+		return n;
+	}
+	void flush() override {
+		if (parsePacket()) {
+			packets.pop_front();
+		}
+	}
+
+	void queue(uint32_t arrival, const std::vector<uint8_t> &data) { packets.push_back({arrival, data}); }
+
+	// A version 4 server reply carrying unixSecs and a fraction of fractionHigh/256 s
+	static std::vector<uint8_t> reply(uint32_t unixSecs, uint8_t fractionHigh, uint8_t leap = 0) {
+		std::vector<uint8_t> packet(NTP_PACKET_SIZE, 0);
+		packet[0] = leap << 6 | 4 << 3 | 4;
+		packet[1] = 2;	// Stratum
+		packet[16] = 0xE9;	// Reference timestamp
+		uint32_t secs = unixSecs + SEVENZYYEARS;
+		packet[40] = secs >> 24;
+		packet[41] = secs >> 16;
+		packet[42] = secs >> 8;
+		packet[43] = secs;
+		packet[44] = fractionHigh;
+		return packet;
+	}
+};
+
+static FakeUdp udp;
+
+void setUp() {
+	udp = FakeUdp();
+	hostSetMillis(10001);
+}
+
+void tearDown() {}
+
+void test_first_call_sends_and_reply_completes() {
+	NTPClient client(udp);
+	TEST_ASSERT_FALSE(client.isTimeSet());
+	TEST_ASSERT_EQUAL(NTP_UPDATE_PENDING, client.updateAsync());
+	TEST_ASSERT_EQUAL(1, udp.sent.size());
+	TEST_ASSERT_EQUAL(NTP_PACKET_SIZE, udp.sent[0].data.size());
+	TEST_ASSERT_EQUAL_HEX8(0xE3, udp.sent[0].data[0]);
+	TEST_ASSERT_TRUE(client.isUpdatePending());
+
+	udp.queue(millis() + 40, FakeUdp::reply(UNIX_SECS, 0));
+	hostAdvanceMillis(39);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_PENDING, client.updateAsync());
+	hostAdvanceMillis(1);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_DONE, client.updateAsync());
+	TEST_ASSERT_FALSE(client.isUpdatePending());
+	TEST_ASSERT_TRUE(client.isTimeSet());
+	TEST_ASSERT_EQUAL_UINT32(UNIX_SECS, client.getEpochTime());
+	TEST_ASSERT_EQUAL(1, udp.sent.size());
+}
+
+void test_no_reply_times_out_then_waits_to_retry() {
+	NTPClient client(udp);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_PENDING, client.updateAsync());
+	uint32_t sentAt = millis();
+	hostAdvanceMillis(NTP_DEFAULT_TIMEOUT - 1);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_PENDING, client.updateAsync());
+	hostAdvanceMillis(1);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_TIMEOUT, client.updateAsync());
+	TEST_ASSERT_FALSE(client.isUpdatePending());
+
+	// Nothing is sent again until the retry interval from the failed request
+	while (millis() - sentAt < NTP_DEFAULT_RETRY_INTERVAL - 1) {
+		TEST_ASSERT_EQUAL(NTP_UPDATE_IDLE, client.updateAsync());
+		hostAdvanceMillis(100);
+	}
+	hostSetMillis(sentAt + NTP_DEFAULT_RETRY_INTERVAL);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_PENDING, client.updateAsync());
+	TEST_ASSERT_EQUAL(2, udp.sent.size());
+}
+
+void test_update_interval_after_success() {
+	NTPClient client(udp, "pool.ntp.org", 0, 60000);
+	udp.answer = true;
+	udp.replyDelay = 20;
+	client.updateAsync();
+	hostAdvanceMillis(20);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_DONE, client.updateAsync());
+	uint32_t doneAt = millis();
+
+	hostSetMillis(doneAt + 59998);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_IDLE, client.updateAsync());
+	TEST_ASSERT_EQUAL(1, udp.sent.size());
+	hostSetMillis(doneAt + 60000);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_PENDING, client.updateAsync());
+	TEST_ASSERT_EQUAL(2, udp.sent.size());
+}
+
+// A reply half a second into its second rolls over to the next second half a
+// second later, not a whole second later
+void test_fraction_moves_the_second_boundary() {
+	NTPClient client(udp);
+	udp.answer = true;
+	udp.fractionHigh = 0x80;
+	client.updateAsync();
+	TEST_ASSERT_EQUAL(NTP_UPDATE_DONE, client.updateAsync());
+	TEST_ASSERT_EQUAL_UINT32(UNIX_SECS, client.getEpochTime());
+	hostAdvanceMillis(499);
+	TEST_ASSERT_EQUAL_UINT32(UNIX_SECS, client.getEpochTime());
+	hostAdvanceMillis(1);
+	TEST_ASSERT_EQUAL_UINT32(UNIX_SECS + 1, client.getEpochTime());
+}
+
+void test_invalid_reply_is_ignored() {
+	NTPClient client(udp);
+	client.updateAsync();
+	udp.queue(millis(), FakeUdp::reply(UNIX_SECS, 0, 3));	// Unsynchronised server
+	TEST_ASSERT_EQUAL(NTP_UPDATE_PENDING, client.updateAsync());
+	TEST_ASSERT_FALSE(client.isTimeSet());
+	hostAdvanceMillis(NTP_DEFAULT_TIMEOUT);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_TIMEOUT, client.updateAsync());
+	TEST_ASSERT_FALSE(client.isTimeSet());
+}
+
+void test_stale_reply_is_flushed_before_sending() {
+	NTPClient client(udp);
+	udp.queue(millis() - 5000, FakeUdp::reply(UNIX_SECS - 3600, 0));
+	client.updateAsync();
+	TEST_ASSERT_TRUE(udp.packets.empty());
+	udp.queue(millis() + 10, FakeUdp::reply(UNIX_SECS, 0));
+	hostAdvanceMillis(10);
+	TEST_ASSERT_EQUAL(NTP_UPDATE_DONE, client.updateAsync());
+	TEST_ASSERT_EQUAL_UINT32(UNIX_SECS, client.getEpochTime());
+}
+
+// update() still blocks: it polls every 10 ms of the fake delay() until the
+// reply or the timeout
+void test_blocking_update() {
+	NTPClient client(udp);
+	udp.answer = true;
+	udp.replyDelay = 35;
+	uint32_t start = millis();
+	TEST_ASSERT_TRUE(client.update());
+	TEST_ASSERT_EQUAL_UINT32(40, millis() - start);
+	TEST_ASSERT_EQUAL_UINT32(UNIX_SECS, client.getEpochTime());
+
+	// Within the interval it returns at once without a request
+	TEST_ASSERT_TRUE(client.update());
+	TEST_ASSERT_EQUAL(1, udp.sent.size());
+
+	udp.answer = false;
+	hostAdvanceMillis(60000);
+	start = millis();
+	TEST_ASSERT_FALSE(client.update());
+	TEST_ASSERT_EQUAL_UINT32(NTP_DEFAULT_TIMEOUT, millis() - start);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_first_call_sends_and_reply_completes);
+	RUN_TEST(test_no_reply_times_out_then_waits_to_retry);
+	RUN_TEST(test_update_interval_after_success);
+	RUN_TEST(test_fraction_moves_the_second_boundary);
+	RUN_TEST(test_invalid_reply_is_ignored);
+	RUN_TEST(test_stale_reply_is_flushed_before_sending);
+	RUN_TEST(test_blocking_update);
+	return UNITY_END();
+}
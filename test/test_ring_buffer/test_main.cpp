@@ -0,0 +1,134 @@
+#include <unity.h>
+#include <thread>
+#include "RingBuffer.h"
+
+#define STRESS_ITEMS 2000000
+
+// A struct item, like the Reading the sampling task hands to the SD writer,
+// so a torn copy shows up as a mismatch between its fields
+struct Item {
+	uint32_t sequence;
+	uint32_t check;
+	uint8_t padding[24];
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_fifo_order_and_wrap() {
+	RingBuffer<uint16_t, 8> ring;
+	uint16_t value;
+	TEST_ASSERT_FALSE(ring.pop(value));
+	// Several laps so the indexes wrap the storage many times
+	for (uint16_t lap = 0; lap < 100; lap++) {
+		for (uint16_t i = 0; i < 5; i++) {
+			TEST_ASSERT_TRUE(ring.push(lap * 5 + i));
+		}
+		TEST_ASSERT_EQUAL_size_t(5, ring.size());
+		for (uint16_t i = 0; i < 5; i++) {
+			TEST_ASSERT_TRUE(ring.pop(value));
+			TEST_ASSERT_EQUAL_UINT16(lap * 5 + i, value);
+		}
+	}
+	TEST_ASSERT_FALSE(ring.pop(value));
+	TEST_ASSERT_EQUAL_UINT32(0, ring.dropped());
+}
+
+void test_full_buffer_drops_and_counts() {
+	RingBuffer<uint16_t, 4> ring;
+	for (uint16_t i = 0; i < 4; i++) {
+		TEST_ASSERT_TRUE(ring.push(i));
+	}
+	TEST_ASSERT_FALSE(ring.push(99));
+	TEST_ASSERT_FALSE(ring.push(99));
+	TEST_ASSERT_EQUAL_UINT32(2, ring.dropped());
+	TEST_ASSERT_EQUAL_size_t(4, ring.size());
+
+	// The oldest items are kept, the dropped ones never show up
+	uint16_t value;
+	for (uint16_t i = 0; i < 4; i++) {
+		TEST_ASSERT_TRUE(ring.pop(value));
+		TEST_ASSERT_EQUAL_UINT16(i, value);
+	}
+	TEST_ASSERT_TRUE(ring.push(4));
+	TEST_ASSERT_TRUE(ring.pop(value));
+	TEST_ASSERT_EQUAL_UINT16(4, value);
+}
+
+// One producer and one consumer thread, as the sampler task and the
+// analytics task use it. The producer retries when the buffer is full, so
+// every item must arrive once, whole and in order.
+void test_spsc_stress_delivers_every_item_in_order() {
+	static RingBuffer<Item, 64> ring;
+	std::thread producer([]() {
+		for (uint32_t i = 0; i < STRESS_ITEMS; i++) {
+			Item item;
+			item.sequence = i;
+			item.check = ~i;
+			memset(item.padding, i & 0xFF, sizeof(item.padding));
+			while (!ring.push(item)) {
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	uint32_t expected = 0;
+	uint32_t errors = 0;
+	while (expected < STRESS_ITEMS) {
+		Item item;
+		if (!ring.pop(item)) {
+			std::this_thread::yield();
+			continue;
+		}
+		bool padded = true;
+		for (uint8_t b : item.padding) {
+			padded = padded && b == (item.sequence & 0xFF);
+		}
+		if (item.sequence != expected || item.check != ~expected || !padded) {
+			errors++;
+		}
+		expected = item.sequence + 1;
+	}
+	producer.join();
+
+	TEST_ASSERT_EQUAL_UINT32(0, errors);
+	TEST_ASSERT_EQUAL_size_t(0, ring.size());
+}
+
+// A producer that never waits, like the sampler with a stalled consumer:
+// what is delivered plus what is dropped is what was pushed
+void test_spsc_stress_accounts_for_drops() {
+	static RingBuffer<uint32_t, 16> ring;
+	std::thread producer([]() {
+		for (uint32_t i = 0; i < STRESS_ITEMS; i++) {
+			ring.push(i);
+		}
+	});
+
+	uint32_t received = 0;
+	uint32_t last = 0;
+	bool ordered = true;
+	bool done = false;
+	while (!done) {
+		done = ring.size() == 0 && ring.dropped() + received == STRESS_ITEMS;
+		uint32_t value;
+		if (ring.pop(value)) {
+			ordered = ordered && (received == 0 || value > last);
+			last = value;
+			received++;
+		}
+	}
+	producer.join();
+
+	TEST_ASSERT_TRUE(ordered);
+	TEST_ASSERT_EQUAL_UINT32(STRESS_ITEMS, received + ring.dropped());
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_fifo_order_and_wrap);
+	RUN_TEST(test_full_buffer_drops_and_counts);
+	RUN_TEST(test_spsc_stress_delivers_every_item_in_order);
+	RUN_TEST(test_spsc_stress_accounts_for_drops);
+	return UNITY_END();
+}
@@ -0,0 +1,150 @@
+// On-target flush latency of a daily log: pio test -e esp32dev -f test_target_log_latency
+// Needs the board with an SD card in the module on SD_CS. It writes a day of
+// one second samples twice, to a file that grows with every flush as before
+// preallocation and to one created at its full size as startDailyLog() does,
+// times every flush and prints both histograms.
+//
+// It only uses the SD library, so the write pattern of writePending() is
+// repeated here: a flush of records in place after the counted ones, then
+// the count in the header. The index sidecar is left out. test_log_writer
+// runs the real writer against a card model on the host.
+
+#include <Arduino.h>
+#include <SD.h>
+#include <SPI.h>
+#include <unity.h>
+
+#define SD_CS 5								 // As main.cpp
+#define HEADER_SIZE 36				 // sizeof(LogFileHeader)
+#define RECORD_SIZE 16				 // sizeof(LogCheckedRecord)
+#define COUNT_OFFSET 32				 // offsetof(LogFileHeader, recordCount)
+#define FLUSH_RECORDS 32			 // LOG_FLUSH_RECORDS
+#define DAY_RECORDS 86400			 // A day of one second samples
+#define FLUSH_BUCKETS 8				 // LOG_FLUSH_BUCKETS: <1, <2, <4 ... <64 ms and longer
+#define GROWING_PATH "/latency_grow.bin"
+#define RESERVED_PATH "/latency_reserve.bin"
+
+struct FlushTimes {
+	uint32_t histogram[FLUSH_BUCKETS];
+	uint32_t maxUs;
+	uint64_t totalUs;
+	uint32_t flushes;
+};
+
+// Bucket of a flush time, as writePending() counts it
+static uint8_t flushBucket(uint32_t us) {
+	uint8_t bucket = 0;
+	for (uint32_t ms = us / 1000; ms > 0 && bucket < FLUSH_BUCKETS - 1; ms >>= 1) {
+		bucket++;
+	}
+	return bucket;
+}
+
+static void printTimes(const char *name, const FlushTimes &times) {
+	char line[160];
+	int len = snprintf(line, sizeof(line), "%-8s", name);
+	for (uint8_t i = 0; i < FLUSH_BUCKETS; i++) {
+		len += snprintf(line + len, sizeof(line) - len, " %5lu", (unsigned long)times.histogram[i]);
+	}
+	snprintf(line + len, sizeof(line) - len, "  mean %.2f ms, max %.1f ms", times.totalUs / 1000.0 / times.flushes,
+					 times.maxUs / 1000.0);
+	TEST_MESSAGE(line);
+}
+
+// Create a log file with a zero header, and reserve room for reserveRecords
+// records by writing its last byte
+static void createLog(const char *path, uint32_t reserveRecords) {
+	SD.remove(path);
+	File file = SD.open(path, FILE_WRITE);
+	TEST_ASSERT_TRUE(file);
+	uint8_t header[HEADER_SIZE] = {};
+	TEST_ASSERT_EQUAL(HEADER_SIZE, file.write(header, sizeof(header)));
+	if (reserveRecords > 0) {
+		uint8_t zero = 0;
+		TEST_ASSERT_TRUE(file.seek(HEADER_SIZE + reserveRecords * RECORD_SIZE - 1));
+		TEST_ASSERT_EQUAL(1, file.write(&zero, 1));
+	}
+	file.close();
+}
+
+// Write a day of records a flush at a time and time each flush from open
+// to close, as writePending() runs it
+static void writeDay(const char *path, FlushTimes &times) {
+	memset(&times, 0, sizeof(times));
+	uint8_t records[FLUSH_RECORDS * RECORD_SIZE];
+	for (uint32_t count = 0; count < DAY_RECORDS; count += FLUSH_RECORDS) {
+		for (size_t i = 0; i < sizeof(records); i++) {
+			records[i] = count + i;
+		}
+		uint32_t start = micros();
+		File file = SD.open(path, "r+");
+		bool written = file && file.seek(HEADER_SIZE + count * RECORD_SIZE) &&
+									 file.write(records, sizeof(records)) == sizeof(records);
+		uint32_t newCount = count + FLUSH_RECORDS;
+		written = written && file.seek(COUNT_OFFSET) &&
+							file.write((const uint8_t *)&newCount, sizeof(newCount)) == sizeof(newCount);
+		file.close();
+		uint32_t us = micros() - start;
+		TEST_ASSERT_TRUE_MESSAGE(written, path);
+
+		times.histogram[flushBucket(us)]++;
+		times.maxUs = max(times.maxUs, us);
+		times.totalUs += us;
+		times.flushes++;
+	}
+}
+
+static FlushTimes growing;
+static FlushTimes reserved;
+
+void test_card_mounts() {
+	TEST_ASSERT_TRUE(SD.begin(SD_CS));
+}
+
+void test_growing_file() {
+	createLog(GROWING_PATH, 0);
+	writeDay(GROWING_PATH, growing);
+}
+
+void test_preallocated_file() {
+	uint32_t start = millis();
+	createLog(RESERVED_PATH, DAY_RECORDS);
+	char line[64];
+	snprintf(line, sizeof(line), "reserving the day took %lu ms", (unsigned long)(millis() - start));
+	TEST_MESSAGE(line);
+	writeDay(RESERVED_PATH, reserved);
+}
+
+// The flushes of a preallocated day must not stall (16 ms or longer) more
+// often than those of a growing one
+void test_preallocation_removes_stalls() {
+	TEST_MESSAGE("flush ms   <1    <2    <4    <8   <16   <32   <64  >=64");
+	printTimes("growing", growing);
+	printTimes("reserved", reserved);
+	uint32_t growingStalls = 0;
+	uint32_t reservedStalls = 0;
+	for (uint8_t i = flushBucket(16000); i < FLUSH_BUCKETS; i++) {
+		growingStalls += growing.histogram[i];
+		reservedStalls += reserved.histogram[i];
+	}
+	TEST_ASSERT_EQUAL_UINT32(DAY_RECORDS / FLUSH_RECORDS, reserved.flushes);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(growingStalls, reservedStalls);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void setup() {
+	delay(2000);	// Let the serial monitor attach
+	UNITY_BEGIN();
+	RUN_TEST(test_card_mounts);
+	RUN_TEST(test_growing_file);
+	RUN_TEST(test_preallocated_file);
+	RUN_TEST(test_preallocation_removes_stalls);
+	SD.remove(GROWING_PATH);
+	SD.remove(RESERVED_PATH);
+	UNITY_END();
+}
+
+void loop() {}
@@ -0,0 +1,532 @@
+#include <unity.h>
+#include <Arduino_JSON.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include "Clock.h"
+#include "ZoneSchedule.h"
+
+// A zone_data.json row
+struct Row {
+	uint8_t znumber;
+	const char *controller;
+	std::string days;
+	uint16_t start;	// Minutes after midnight, 0 = chained to the row before
+	uint16_t run;
+	uint8_t avgPsi;
+};
+
+static String tableJson(const std::vector<Row> &rows) {
+	String json = "[";
+	for (size_t i = 0; i < rows.size(); i++) {
+		const Row &row = rows[i];
+		char text[192];
+		snprintf(text, sizeof(text),
+						 "%s{\"znumber\":\"%u\",\"zname\":\"Zone %u\",\"controller\":\"%s\",\"days\":\"%s\","
+						 "\"start\":\"%02u:%02u\",\"run\":\"%02u\",\"avgpsi\":\"%u\"}",
+						 i ? "," : "", row.znumber, row.znumber, row.controller, row.days.c_str(), row.start / 60, row.start % 60,
+						 row.run, row.avgPsi);
+		json += text;
+	}
+	return json + "]";
+}
+
+// The lookup the firmware used before the weekly timeline: a per-minute
+// state machine over the compiled table, as checkActiveZone() in main.cpp.
+// It has to be stepped through every minute in order.
+struct LinearScan {
+	std::vector<Row> rows;
+	bool programRunning = false;
+	uint8_t index = 0;
+	int zoneStart = 0;
+	int runTime = 0;
+
+	uint8_t step(uint8_t day, int minute) {
+		if (rows.empty()) {
+			return 0;
+		}
+		if (programRunning) {
+			if (minute - zoneStart >= runTime) {
+				index++;
+				if (index >= rows.size()) {
+					index = 0;
+					programRunning = false;
+					return 0;
+				}
+				const Row &next = rows[index];
+				if (next.start == 0) {
+					runTime = next.run;
+					zoneStart = minute;
+				} else if (next.start == minute) {
+					runTime = next.run;
+					zoneStart = next.start;
+				} else {
+					index = 0;
+					programRunning = false;
+					return 0;
+				}
+			}
+			return index;
+		}
+		for (uint8_t i = 0; i < rows.size(); i++) {
+			const Row &row = rows[i];
+			if (row.start != 0 && row.start == minute && row.days.find('0' + day) != std::string::npos) {
+				index = i;
+				programRunning = true;
+				runTime = row.run;
+				zoneStart = minute;
+				return i;
+			}
+		}
+		index = 0;
+		return 0;
+	}
+};
+
+// A zone table from the project's data directory, found next to this file
+// or, if the compiler was given a relative path, from the working directory
+static String readDataFile(const char *name) {
+	std::string path = __FILE__;
+	size_t test = path.rfind("test/test_zone_schedule/");
+	path = (test == std::string::npos ? std::string() : path.substr(0, test)) + "data/" + name;
+	FILE *file = fopen(path.c_str(), "rb");
+	TEST_ASSERT_NOT_NULL_MESSAGE(file, path.c_str());
+	std::string text;
+	char buffer[512];
+	for (size_t n = fread(buffer, 1, sizeof(buffer), file); n > 0; n = fread(buffer, 1, sizeof(buffer), file)) {
+		text.append(buffer, n);
+	}
+	fclose(file);
+	return String(text);
+}
+
+// checkActiveZone() as it was before the zone table was compiled: every tick
+// reads /zone_data.json, parses it and walks the JSON with String
+// temporaries. Its logMsg() calls, which appended to a file on SD, are left
+// out, so the times below are its best case.
+struct JsonWalkScan {
+	fs::FS *card;
+	bool programRunning = false;
+	int lastActiveZoneIndex = 0;
+	int runTime = 0;
+	int zoneStartHour = 0;
+	int zoneStartMinute = 0;
+
+	static int calculateDayOfWeek(int year, int month, int day) {
+		if (month < 3) {
+			month += 12;
+			year -= 1;
+		}
+		int k = year % 100;
+		int j = year / 100;
+		int dayOfWeek = (day + ((13 * (month + 1)) / 5) + k + (k / 4) + (j / 4) + (5 * j)) % 7;
+		return (dayOfWeek + 6) % 7;
+	}
+
+	static bool isDayMatching(String days, int currentDay) {
+		String currentDayStr = String(currentDay);
+		for (unsigned int i = 0; i < days.length(); i++) {
+			if (days.charAt(i) == currentDayStr.charAt(0)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	String loadZoneTable() {
+		File file = card->open("/zone_data.json", FILE_READ);
+		if (!file) {
+			return "[]";
+		}
+		String zoneData = file.readString();
+		file.close();
+		return zoneData;
+	}
+
+	String check(const String &currentDayStamp, const String &currentTimeStamp) {
+		int year = currentDayStamp.substring(0, 4).toInt();
+		int month = currentDayStamp.substring(5, 7).toInt();
+		int day = currentDayStamp.substring(8, 10).toInt();
+		int currentHourInt = currentTimeStamp.substring(0, 2).toInt();
+		int currentMinuteInt = currentTimeStamp.substring(3, 5).toInt();
+		int currentDay = calculateDayOfWeek(year, month, day);
+
+		String zoneData = loadZoneTable();
+		JSONVar zones = JSON.parse(zoneData);
+		if (JSON.typeof(zones) == "undefined" || zones.length() == 0) {
+			return "{}";
+		}
+
+		JSONVar activeZone;
+		if (programRunning) {
+			int elapsedMinutes = (currentHourInt * 60 + currentMinuteInt) - (zoneStartHour * 60 + zoneStartMinute);
+			if (elapsedMinutes >= runTime) {
+				lastActiveZoneIndex += 1;
+				if (lastActiveZoneIndex >= zones.length()) {
+					lastActiveZoneIndex = 0;
+					programRunning = false;
+					return JSON.stringify(zones[0]);
+				}
+				String startTime = String((const char *)zones[lastActiveZoneIndex]["start"]);
+				int runMinutes = String((const char *)zones[lastActiveZoneIndex]["run"]).toInt();
+				if (startTime == "00:00" && programRunning) {
+					activeZone = zones[lastActiveZoneIndex];
+					runTime = runMinutes;
+					zoneStartHour = currentHourInt;
+					zoneStartMinute = currentMinuteInt;
+				} else if (startTime != "00:00") {
+					zoneStartHour = startTime.substring(0, 2).toInt();
+					zoneStartMinute = startTime.substring(3, 5).toInt();
+					if (currentHourInt == zoneStartHour && currentMinuteInt == zoneStartMinute) {
+						activeZone = zones[lastActiveZoneIndex];
+						runTime = runMinutes;
+					} else {
+						lastActiveZoneIndex = 0;
+						programRunning = false;
+						return JSON.stringify(zones[0]);
+					}
+				}
+			}
+		} else {
+			for (int i = lastActiveZoneIndex; i < zones.length(); i++) {
+				String znumber = String((const char *)zones[i]["znumber"]);
+				String zname = String((const char *)zones[i]["zname"]);
+				String controller = String((const char *)zones[i]["controller"]);
+				String days = String((const char *)zones[i]["days"]);
+				String startTime = String((const char *)zones[i]["start"]);
+				int runMinutes = String((const char *)zones[i]["run"]).toInt();
+				if (isDayMatching(days, currentDay) && startTime != "00:00") {
+					zoneStartHour = startTime.substring(0, 2).toInt();
+					zoneStartMinute = startTime.substring(3, 5).toInt();
+					if (currentHourInt == zoneStartHour && currentMinuteInt == zoneStartMinute) {
+						activeZone = zones[i];
+						lastActiveZoneIndex = i;
+						programRunning = true;
+						runTime = runMinutes;
+						break;
+					}
+				}
+			}
+		}
+
+		if (!programRunning) {
+			lastActiveZoneIndex = 0;
+			return JSON.stringify(zones[0]);
+		}
+		return JSON.stringify(activeZone);
+	}
+};
+
+#define REPLAY_START 1717891200UL	// Sunday 2024-06-09 00:00
+
+// Rows of a zone_data.json table, for the old scan
+static std::vector<Row> rowsFromJson(const String &zoneData) {
+	JSONVar zones = JSON.parse(zoneData);
+	std::vector<Row> rows;
+	for (int i = 0; i < zones.length(); i++) {
+		String start = (const char *)zones[i]["start"];
+		rows.push_back({(uint8_t)atoi((const char *)zones[i]["znumber"]), "", (const char *)zones[i]["days"],
+										(uint16_t)(start.substring(0, 2).toInt() * 60 + start.substring(3, 5).toInt()),
+										(uint16_t)atoi((const char *)zones[i]["run"]), (uint8_t)atoi((const char *)zones[i]["avgpsi"])});
+	}
+	return rows;
+}
+
+// Replay a table second by second over two weeks with both lookups, taking
+// each second apart with the clock as a sample tick does
+static void replay(const std::vector<Row> &rows, const String &zoneData) {
+	TEST_ASSERT_TRUE(compileZoneTable(zoneData));
+	LinearScan scan;
+	scan.rows = rows;
+	for (uint32_t epoch = REPLAY_START; epoch < REPLAY_START + 2 * MINUTES_PER_WEEK * 60; epoch++) {
+		ClockTime now;
+		clockBreakdown(epoch, now);
+		uint8_t expected = scan.step(now.weekday, now.hour * 60 + now.minute);
+		Zone zone;
+		uint8_t found = findActiveZone(now.minuteOfWeek, &zone);
+		if (found != expected) {
+			char message[64];
+			snprintf(message, sizeof(message), "day %u %02u:%02u:%02u", now.weekday, now.hour, now.minute, now.second);
+			TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected, found, message);
+		}
+		if (zone.znumber != rows[found].znumber || zone.avgPsi != rows[found].avgPsi) {
+			TEST_ASSERT_EQUAL_UINT8(rows[found].znumber, zone.znumber);
+			TEST_ASSERT_EQUAL_UINT8(rows[found].avgPsi, zone.avgPsi);
+		}
+	}
+}
+
+static void replay(const std::vector<Row> &rows) {
+	replay(rows, tableJson(rows));
+}
+
+// A random table of programs, a start row and the chained rows after it,
+// each placed in its own part of the day so no two ever overlap or run past
+// midnight. That is the case where the old lookup was right, so both must agree.
+static std::vector<Row> randomTable(std::mt19937 &random) {
+	std::vector<Row> rows = {{0, "", "", 0, 0, 0}};	// The OFF row
+	const uint8_t programs = 1 + random() % 8;
+	const uint16_t slot = 1440 / 8;
+	for (uint8_t p = 0; p < programs; p++) {
+		std::string days;
+		for (char day = '0'; day <= '6'; day++) {
+			if (random() % 2) {
+				days += day;
+			}
+		}
+		uint8_t chained = random() % 4;
+		uint16_t total = 0;
+		std::vector<uint16_t> runs;
+		for (uint8_t z = 0; z <= chained; z++) {
+			runs.push_back(1 + random() % 30);
+			total += runs.back();
+		}
+		uint16_t start = p * slot + 1 + random() % (slot - total - 1);
+		const char *controller = p % 2 ? "Back" : "Front";
+		for (uint8_t z = 0; z <= chained; z++) {
+			rows.push_back({(uint8_t)(z + 1), controller, days, z == 0 ? start : (uint16_t)0, runs[z], (uint8_t)(40 + rows.size())});
+		}
+	}
+	return rows;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_replay_fixed_table() {
+	replay({
+			{0, "", "", 0, 0, 0},
+			{1, "Front", "135", 6 * 60, 10, 45},
+			{2, "Front", "", 0, 15, 48},
+			{3, "Front", "", 0, 5, 50},
+			{1, "Back", "0246", 20 * 60, 20, 42},
+			{2, "Back", "", 0, 20, 44},
+			{7, "Back", "0123456", 22 * 60, 30, 39},
+			{8, "Back", "0123456", 22 * 60 + 30, 10, 41},	// Starts as the row before it ends
+	});
+}
+
+void test_replay_random_tables() {
+	std::mt19937 random(2024);
+	for (int table = 0; table < 50; table++) {
+		replay(randomTable(random));
+	}
+}
+
+// The zone tables in data/ whose runs all end before midnight, the case the
+// old scan handled, against that scan
+void test_replay_data_tables() {
+	for (const char *name : {"zonedataSp.json", "zonedataT.json"}) {
+		String zoneData = readDataFile(name);
+		replay(rowsFromJson(zoneData), zoneData);
+	}
+}
+
+// A change of row at a day of the week (0 = Sunday) and time
+struct Change {
+	uint8_t day;
+	const char *time;	// "HH:MM"
+	uint8_t row;
+};
+
+// zonedataSu.json worked out by hand. Its Field programs start at 20:00 and
+// run 10.5 h and 6 h, so they carry on past midnight into the next morning,
+// the last one past the end of the week. The old scan counted the minutes
+// of a run from the time of day, so after midnight a run never ended and the
+// chain stopped there.
+static const Change yardProgram[] = {	// Rows 1-9, 45 min each from 07:30
+		{0, "07:30", 1}, {0, "08:15", 2}, {0, "09:00", 3}, {0, "09:45", 4}, {0, "10:30", 5},
+		{0, "11:15", 6}, {0, "12:00", 7}, {0, "12:45", 8}, {0, "13:30", 9}, {0, "14:15", 0},
+};
+static const Change fieldOddDays[] = {	// Rows 10-16, 90 min each from 20:00
+		{0, "20:00", 10}, {0, "21:30", 11}, {0, "23:00", 12}, {1, "00:30", 13},
+		{1, "02:00", 14}, {1, "03:30", 15}, {1, "05:00", 16}, {1, "06:30", 0},
+};
+static const Change fieldEvenDays[] = {	// Rows 17-20, 90 min each from 20:00
+		{0, "20:00", 17}, {0, "21:30", 18}, {0, "23:00", 19}, {1, "00:30", 20}, {1, "02:00", 0},
+};
+
+// Minute after the start of the week of a change in a program started on day
+static uint32_t changeMinute(char day, const Change &change) {
+	return (day - '0' + change.day) * 1440 + atoi(change.time) * 60 + atoi(change.time + 3);
+}
+
+void test_data_table_with_runs_past_midnight() {
+	TEST_ASSERT_TRUE(compileZoneTable(readDataFile("zonedataSu.json")));
+
+	// Row for every minute of the week, from the changes on each day a program runs
+	std::vector<uint8_t> expected(MINUTES_PER_WEEK, 0);
+	auto addProgram = [&](const Change *changes, size_t count, const char *days) {
+		for (const char *day = days; *day; day++) {
+			for (size_t i = 0; i + 1 < count; i++) {
+				for (uint32_t minute = changeMinute(*day, changes[i]); minute < changeMinute(*day, changes[i + 1]); minute++) {
+					expected[minute % MINUTES_PER_WEEK] = changes[i].row;
+				}
+			}
+		}
+	};
+	addProgram(yardProgram, sizeof(yardProgram) / sizeof(Change), "0246");
+	addProgram(fieldOddDays, sizeof(fieldOddDays) / sizeof(Change), "135");
+	addProgram(fieldEvenDays, sizeof(fieldEvenDays) / sizeof(Change), "246");
+
+	for (uint32_t epoch = REPLAY_START; epoch < REPLAY_START + MINUTES_PER_WEEK * 60; epoch++) {
+		ClockTime now;
+		clockBreakdown(epoch, now);
+		uint8_t found = findActiveZone(now.minuteOfWeek);
+		if (found != expected[now.minuteOfWeek]) {
+			char message[64];
+			snprintf(message, sizeof(message), "day %u %02u:%02u:%02u", now.weekday, now.hour, now.minute, now.second);
+			TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected[now.minuteOfWeek], found, message);
+		}
+	}
+
+	// Zone numbers either side of midnight, and of the end of the week
+	Zone zone;
+	TEST_ASSERT_EQUAL_UINT8(12, findActiveZone(1 * 1440 + 1439, &zone));	// Monday 23:59
+	TEST_ASSERT_EQUAL_UINT8(4, zone.znumber);
+	TEST_ASSERT_EQUAL_UINT8(12, findActiveZone(2 * 1440 + 29, &zone));	// Tuesday 00:29
+	TEST_ASSERT_EQUAL_UINT8(4, zone.znumber);
+	TEST_ASSERT_EQUAL_UINT8(16, findActiveZone(2 * 1440 + 6 * 60, &zone));	// Tuesday 06:00
+	TEST_ASSERT_EQUAL_UINT8(11, zone.znumber);
+	TEST_ASSERT_EQUAL_UINT8(20, findActiveZone(1 * 60 + 59, &zone));	// Sunday 01:59, from Saturday
+	TEST_ASSERT_EQUAL_UINT8(12, zone.znumber);
+	TEST_ASSERT_EQUAL_UINT8(0, findActiveZone(2 * 60));
+}
+
+void test_run_past_the_end_of_the_week_wraps() {
+	TEST_ASSERT_TRUE(compileZoneTable(tableJson({
+			{0, "", "", 0, 0, 0},
+			{4, "Front", "6", 23 * 60 + 50, 20, 47},	// Saturday 23:50 for 20 minutes
+	})));
+	TEST_ASSERT_EQUAL_UINT8(0, findActiveZone(MINUTES_PER_WEEK - 11));
+	TEST_ASSERT_EQUAL_UINT8(1, findActiveZone(MINUTES_PER_WEEK - 10));
+	TEST_ASSERT_EQUAL_UINT8(1, findActiveZone(MINUTES_PER_WEEK - 1));
+	TEST_ASSERT_EQUAL_UINT8(1, findActiveZone(0));
+	TEST_ASSERT_EQUAL_UINT8(1, findActiveZone(9));
+	TEST_ASSERT_EQUAL_UINT8(0, findActiveZone(10));
+}
+
+void test_overlapping_run_waits_for_the_running_zone() {
+	TEST_ASSERT_TRUE(compileZoneTable(tableJson({
+			{0, "", "", 0, 0, 0},
+			{1, "Front", "1", 6 * 60, 30, 45},
+			{1, "Back", "1", 6 * 60 + 10, 30, 52},
+	})));
+	uint16_t monday = 1440;
+	TEST_ASSERT_EQUAL_UINT8(1, findActiveZone(monday + 6 * 60 + 29));
+	TEST_ASSERT_EQUAL_UINT8(2, findActiveZone(monday + 6 * 60 + 30));
+	TEST_ASSERT_EQUAL_UINT8(2, findActiveZone(monday + 6 * 60 + 39));
+	TEST_ASSERT_EQUAL_UINT8(0, findActiveZone(monday + 6 * 60 + 40));
+}
+
+void test_bad_json_keeps_the_table() {
+	TEST_ASSERT_TRUE(compileZoneTable(tableJson({
+			{0, "", "", 0, 0, 0},
+			{5, "Front", "0123456", 12 * 60, 10, 45},
+	})));
+	TEST_ASSERT_FALSE(compileZoneTable("not json"));
+	TEST_ASSERT_EQUAL_UINT8(1, findActiveZone(12 * 60 + 5));
+}
+
+// Lookups on one thread while another keeps recompiling between two tables.
+// Every lookup must see one whole table: row 1 of A is zone 1 at 41 PSI,
+// row 1 of B is zone 2 at 52 PSI, anything else is a half-published table.
+void test_lookups_during_recompiles_see_whole_tables() {
+	String tableA = tableJson({{0, "", "", 0, 0, 0}, {1, "Front", "0123456", 1, 1438, 41}});
+	String tableB = tableJson({{0, "", "", 0, 0, 0}, {2, "Back", "0123456", 1, 1438, 52}, {3, "Back", "", 0, 1, 60}});
+	TEST_ASSERT_TRUE(compileZoneTable(tableA));
+
+	std::atomic<bool> stop(false);
+	std::atomic<uint32_t> torn(0);
+	std::thread reader([&]() {
+		while (!stop) {
+			Zone zone;
+			uint8_t row = findActiveZone(3 * 1440 + 600, &zone);
+			bool whole = row == 1 && ((zone.znumber == 1 && zone.avgPsi == 41) || (zone.znumber == 2 && zone.avgPsi == 52));
+			if (!whole) {
+				torn++;
+			}
+		}
+	});
+	for (int i = 0; i < 2000; i++) {
+		compileZoneTable(i % 2 ? tableA : tableB);
+	}
+	stop = true;
+	reader.join();
+	TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+}
+
+// Per-tick cost of finding the active zone on the 21-zone, two-controller
+// table, a week of ticks at the default 30 s sample interval. Times are
+// printed for comparison and depend on the host; on the ESP32 the old scan
+// also paid for reading the file from SD.
+void test_benchmark_json_walk_against_timeline() {
+	String zoneData = readDataFile("zonedataSu.json");
+	fs::FS card;
+	File file = card.open("/zone_data.json", FILE_WRITE);
+	file.print(zoneData);
+	file.close();
+	TEST_ASSERT_TRUE(loadZoneSchedule(card, "/zone_data.json"));
+
+	// Sunday 2024-06-09 to Saturday 2024-06-15, stamps as getTimeStamp() made them
+	const uint32_t ticks = MINUTES_PER_WEEK * 2;
+	std::vector<String> dayStamps;
+	std::vector<String> timeStamps;
+	for (uint32_t tick = 0; tick < ticks; tick++) {
+		uint32_t second = tick * 30;
+		char text[16];
+		snprintf(text, sizeof(text), "2024-06-%02u", (unsigned)(9 + second / 86400));
+		dayStamps.push_back(text);
+		snprintf(text, sizeof(text), "%02u:%02u:%02u", (unsigned)(second / 3600 % 24), (unsigned)(second / 60 % 60),
+						 (unsigned)(second % 60));
+		timeStamps.push_back(text);
+	}
+
+	JsonWalkScan scan;
+	scan.card = &card;
+	size_t jsonBytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t tick = 0; tick < ticks; tick++) {
+		jsonBytes += scan.check(dayStamps[tick], timeStamps[tick]).length();
+	}
+	double walkUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ticks;
+
+	uint32_t running = 0;
+	start = std::chrono::steady_clock::now();
+	for (uint32_t tick = 0; tick < ticks; tick++) {
+		Zone zone;
+		running += findActiveZone(tick / 2, &zone) != 0;
+	}
+	double lookupUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ticks;
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t tick = 0; tick < ticks; tick++) {
+		jsonBytes += zoneToJson(findActiveZone(tick / 2)).length();
+	}
+	double lookupJsonUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ticks;
+
+	char message[160];
+	snprintf(message, sizeof(message),
+					 "per tick: JSON walk %.2f us, findActiveZone %.3f us, findActiveZone + zoneToJson %.2f us (%lu ticks, %lu running)",
+					 walkUs, lookupUs, lookupJsonUs, (unsigned long)ticks, (unsigned long)running);
+	TEST_MESSAGE(message);
+	TEST_ASSERT_GREATER_THAN(0, jsonBytes);
+	TEST_ASSERT_GREATER_THAN(0, running);
+	TEST_ASSERT_TRUE(lookupJsonUs < walkUs);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_replay_fixed_table);
+	RUN_TEST(test_replay_random_tables);
+	RUN_TEST(test_replay_data_tables);
+	RUN_TEST(test_data_table_with_runs_past_midnight);
+	RUN_TEST(test_run_past_the_end_of_the_week_wraps);
+	RUN_TEST(test_overlapping_run_waits_for_the_running_zone);
+	RUN_TEST(test_bad_json_keeps_the_table);
+	RUN_TEST(test_lookups_during_recompiles_see_whole_tables);
+	RUN_TEST(test_benchmark_json_walk_against_timeline);
+	return UNITY_END();
+}
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Convert text daily logs (YYYYMMDD.txt or the older DDMMYY.txt) to the binary
+log format (.bin next to the .txt).
+
+Run on a PC with the SD card mounted:
+
+    python tools/convert_logs.py /media/sdcard            # every text log in the folder and below it
+    python tools/convert_logs.py 20240901.txt 020924.txt  # selected files
+    python tools/convert_logs.py --delete /media/sdcard   # also remove the .txt files
+
+The layout must match LogFileHeader and LogRecord in src/LogFormat.h.
+"""
+
+import argparse
+import calendar
+import os
+import re
+import struct
+import sys
+from datetime import datetime
+
+LOG_MAGIC = b"WPLG"
+LOG_VERSION = 1
+DAY_START_HOUR = 6
+LOG_FLAG_OUT_OF_BAND = 0x01
+
+HEADER = struct.Struct("<4sBBHII16s")  # LogFileHeader
+RECORD = struct.Struct("<IhBBBB")  # LogRecord
+
+NAME_PATTERN = re.compile(r"^(\d{2})(\d{2})(\d{2})\.txt$")  # DDMMYY.txt, SD root of older firmware
+DAY_PATTERN = re.compile(r"^(\d{4})(\d{2})(\d{2})\.txt$")  # YYYYMMDD.txt, in /log/YYYY/MM/
+
+
+def to_int(text):
+    try:
+        return int(float(text))
+    except ValueError:
+        return 0
+
+
+def convert(txt_path):
+    name = os.path.basename(txt_path)
+    if NAME_PATTERN.match(name):
+        day, month, year = (int(g) for g in NAME_PATTERN.match(name).groups())
+        year += 2000
+    elif DAY_PATTERN.match(name):
+        year, month, day = (int(g) for g in DAY_PATTERN.match(name).groups())
+    else:
+        print(f"skip {txt_path}: not a daily text log")
+        return None
+    day_start = calendar.timegm(datetime(year, month, day, DAY_START_HOUR).timetuple())
+
+    records = []
+    first_id = None
+    with open(txt_path, "r", errors="replace") as f:
+        for line in f:
+            parts = line.strip().split(",")
+            if len(parts) < 5:
+                continue
+            try:
+                stamp = datetime.strptime(parts[1] + " " + parts[2], "%Y-%m-%d %H:%M:%S")
+                psi = float(parts[3])
+            except ValueError:
+                continue
+            if first_id is None:
+                first_id = to_int(parts[0])
+            zone = to_int(parts[4]) & 0xFF
+            avg = to_int(parts[5]) & 0xFF if len(parts) > 5 else 0
+            centi = max(-32768, min(32767, round(psi * 100)))
+            flags = LOG_FLAG_OUT_OF_BAND if zone != 0 and abs(centi - avg * 100) > 200 else 0
+            epoch = calendar.timegm(stamp.timetuple())
+            records.append(RECORD.pack(epoch, centi, zone, avg, flags, 0))
+
+    bin_path = txt_path[:-4] + ".bin"
+    with open(bin_path, "wb") as f:
+        f.write(HEADER.pack(LOG_MAGIC, LOG_VERSION, RECORD.size, HEADER.size, day_start, first_id or 0, bytes(16)))
+        f.writelines(records)
+
+    print(f"{txt_path} -> {bin_path}: {len(records)} records, "
+          f"{os.path.getsize(txt_path)} -> {os.path.getsize(bin_path)} bytes")
+    return bin_path
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("paths", nargs="+", help="daily text logs or folders containing them")
+    parser.add_argument("--delete", action="store_true", help="remove each .txt after converting it")
+    args = parser.parse_args()
+
+    files = []
+    for path in args.paths:
+        if os.path.isdir(path):
+            for folder, _, names in os.walk(path):
+                files += sorted(os.path.join(folder, n) for n in names if NAME_PATTERN.match(n) or DAY_PATTERN.match(n))
+        else:
+            files.append(path)
+
+    for txt_path in files:
+        if convert(txt_path) and args.delete:
+            os.remove(txt_path)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,54 @@
+"""PlatformIO pre-build script: build the SPIFFS image from gzip'd web assets.
+
+The files in data/ are copied to .pio/build/<env>/data, with .html, .js and
+.css stored only as <name>.gz. The web server sends those with
+Content-Encoding: gzip. assets.ver holds a hash of data/; the firmware uses it
+as the ETag of every asset, so browsers revalidate with a tiny 304 until a new
+image is uploaded.
+
+Enabled with `extra_scripts = pre:tools/gzip_assets.py` in platformio.ini.
+"""
+
+import gzip
+import hashlib
+import os
+import shutil
+
+Import("env")  # noqa: F821 (provided by PlatformIO)
+
+COMPRESSED_EXTENSIONS = (".html", ".js", ".css")
+VERSION_FILE = "assets.ver"  # ASSET_VERSION_PATH in src/StaticAssets.h
+
+
+def build_data_dir(source, target):
+    if os.path.isdir(target):
+        shutil.rmtree(target)
+    os.makedirs(target)
+
+    digest = hashlib.sha1()
+    for name in sorted(os.listdir(source)):
+        path = os.path.join(source, name)
+        if not os.path.isfile(path):
+            continue
+        with open(path, "rb") as f:
+            content = f.read()
+        digest.update(name.encode() + b"\0" + content)
+
+        if name.endswith(COMPRESSED_EXTENSIONS):
+            # mtime=0 keeps the image identical when the sources are
+            with open(os.path.join(target, name + ".gz"), "wb") as f:
+                with gzip.GzipFile(filename="", mode="wb", compresslevel=9, fileobj=f, mtime=0) as gz:
+                    gz.write(content)
+        else:
+            shutil.copyfile(path, os.path.join(target, name))
+
+    version = digest.hexdigest()[:12]
+    with open(os.path.join(target, VERSION_FILE), "w") as f:
+        f.write(version)
+    return version
+
+
+source_dir = env.subst("$PROJECT_DATA_DIR")  # noqa: F821
+target_dir = os.path.join(env.subst("$BUILD_DIR"), "data")  # noqa: F821
+print("Web assets %s -> %s (version %s)" % (source_dir, target_dir, build_data_dir(source_dir, target_dir)))
+env.Replace(PROJECT_DATA_DIR=target_dir)  # noqa: F821